@@ -17,61 +17,87 @@ Also manage punctuation pronunciations and word replacements.
 
 /* Internationalization support routines */
 /* Switch between unicode and utf8. */
+/* There is no state here; the caller carries the pointer,
+ * so the conversions can run in parallel. */
 
-static unsigned char *uni_p;
-
-/* assumes there is room at uni_p and advances it accordingly */
-static int uni_1(unsigned int c)
+/* Put c at p, in utf8, and return the byte after it.
+ * There has to be room, 6 bytes at most. */
+static unsigned char *uni_1(unsigned char *p, unsigned int c)
 {
 	    if(c <= 0x7f) {
-			*uni_p++ = c;
-		return 1;
+			*p++ = c;
+		return p;
 	}
 	    if(c <= 0x7ff) {
-			*uni_p++ = 0xc0 | ((c >> 6) & 0x1f);
-			*uni_p++ = 0x80 | (c & 0x3f);
-		return 2;
+			*p++ = 0xc0 | ((c >> 6) & 0x1f);
+			*p++ = 0x80 | (c & 0x3f);
+		return p;
 	}
 	    if(c <= 0xffff) {
-			*uni_p++ = 0xe0 | ((c >> 12) & 0xf);
-			*uni_p++ = 0x80 | ((c >> 6) & 0x3f);
-			*uni_p++ = 0x80 | (c & 0x3f);
-		return 3;
+			*p++ = 0xe0 | ((c >> 12) & 0xf);
+			*p++ = 0x80 | ((c >> 6) & 0x3f);
+			*p++ = 0x80 | (c & 0x3f);
+		return p;
 	}
 	    if(c <= 0x1fffff) {
-			*uni_p++ = 0xf0 | ((c >> 18) & 7);
-			*uni_p++ = 0x80 | ((c >> 12) & 0x3f);
-			*uni_p++ = 0x80 | ((c >> 6) & 0x3f);
-			*uni_p++ = 0x80 | (c & 0x3f);
-		return 4;
+			*p++ = 0xf0 | ((c >> 18) & 7);
+			*p++ = 0x80 | ((c >> 12) & 0x3f);
+			*p++ = 0x80 | ((c >> 6) & 0x3f);
+			*p++ = 0x80 | (c & 0x3f);
+		return p;
 	}
 	    if(c <= 0x3ffffff) {
-			*uni_p++ = 0xf8 | ((c >> 24) & 3);
-			*uni_p++ = 0x80 | ((c >> 18) & 0x3f);
-			*uni_p++ = 0x80 | ((c >> 12) & 0x3f);
-			*uni_p++ = 0x80 | ((c >> 6) & 0x3f);
-			*uni_p++ = 0x80 | (c & 0x3f);
-		return 5;
+			*p++ = 0xf8 | ((c >> 24) & 3);
+			*p++ = 0x80 | ((c >> 18) & 0x3f);
+			*p++ = 0x80 | ((c >> 12) & 0x3f);
+			*p++ = 0x80 | ((c >> 6) & 0x3f);
+			*p++ = 0x80 | (c & 0x3f);
+		return p;
 	}
 	    if(c <= 0x7fffffff) {
-			*uni_p++ = 0xfc | ((c >> 30) & 1);
-			*uni_p++ = 0x80 | ((c >> 24) & 0x3f);
-			*uni_p++ = 0x80 | ((c >> 18) & 0x3f);
-			*uni_p++ = 0x80 | ((c >> 12) & 0x3f);
-			*uni_p++ = 0x80 | ((c >> 6) & 0x3f);
-			*uni_p++ = 0x80 | (c & 0x3f);
-		return 6;
+			*p++ = 0xfc | ((c >> 30) & 1);
+			*p++ = 0x80 | ((c >> 24) & 0x3f);
+			*p++ = 0x80 | ((c >> 18) & 0x3f);
+			*p++ = 0x80 | ((c >> 12) & 0x3f);
+			*p++ = 0x80 | ((c >> 6) & 0x3f);
+			*p++ = 0x80 | (c & 0x3f);
 	}
+	return p;
+}
+
+static int uni_len(unsigned int c)
+{
+	if(c <= 0x7f) return 1;
+	if(c <= 0x7ff) return 2;
+	if(c <= 0xffff) return 3;
+	if(c <= 0x1fffff) return 4;
+	if(c <= 0x3ffffff) return 5;
+	if(c <= 0x7fffffff) return 6;
 	return 0;
 }
 
-static unsigned int utf8_1(void)
+/*********************************************************************
+Decode one character at *pp, and push *pp past it.
+Anything that isn't proper utf8 comes back as a question mark:
+a stray continuation byte, a sequence cut short,
+an overlong encoding, a surrogate, or anything past 0x10ffff.
+A sequence that is cut short gives up at the byte that doesn't belong,
+so that byte starts the next character,
+which is what you want when it is the terminating null.
+*********************************************************************/
+
+static unsigned int utf8_1(const unsigned char **pp)
 {
+	static const unsigned int least[5] = {0, 0, 0x80, 0x800, 0x10000};
+	const unsigned char *p = *pp;
 	unsigned int c;
-	int j;
+	int j, k;
 	unsigned char mask;
-	unsigned char base = *uni_p++;
-	if(base <= 0x7f) return base;
+	unsigned char base = *p++;
+	if(base <= 0x7f) {
+		*pp = p;
+		return base;
+	}
 	mask = 0x80;
 	j = 0;
 	while(mask&base) {
@@ -79,59 +105,102 @@ static unsigned int utf8_1(void)
 		base &= ~mask;
 		mask >>= 1;
 	}
-	if(j == 1 || j > 6) return '?'; /* malformed */
+	*pp = p;
+	if(j == 1 || j > 4) return '?'; /* malformed */
 	c = base;
-	for(--j; j; --j) {
-		c <<= 6;
-		base = *uni_p;
-		if((base & 0xc0) != 0x80) return '?';
-		c |= (base&0x3f);
-		++uni_p;
+	for(k=1; k<j; ++k) {
+		base = *p;
+		if((base & 0xc0) != 0x80) {
+			*pp = p;
+			return '?';
+		}
+		c = (c << 6) | (base&0x3f);
+		++p;
 	}
-	return (c ? c : '?');
+	*pp = p;
+	if(c < least[j] || c > 0x10ffff) return '?';
+	if(c >= 0xd800 && c <= 0xdfff) return '?';
+	return c;
+}
+
+/* Convert len unicodes into utf8 at dest, which needs 6*len bytes,
+ * though that much is only used by characters that aren't real.
+ * Runs of ascii, most of what we read, go 4 at a time.
+ * Returns the number of bytes, which are not null terminated. */
+int acs_uni2utf8_n(const unsigned int *s, int len, unsigned char *dest)
+{
+	unsigned char *p = dest;
+	const unsigned int *end = s + len;
+	unsigned int c;
+
+	while(s < end) {
+		if(end - s >= 4 && (s[0] | s[1] | s[2] | s[3]) <= 0x7f) {
+			p[0] = s[0], p[1] = s[1], p[2] = s[2], p[3] = s[3];
+			p += 4, s += 4;
+			continue;
+		}
+		c = *s++;
+		if(c <= 0x7f) *p++ = c;
+		else p = uni_1(p, c);
+	}
+
+	return p - dest;
 }
 
 /* This function allocates; you need to free when done. */
 unsigned char *acs_uni2utf8(const unsigned int *ubuf)
 {
 	const unsigned int *t;
-	int l = 0;
-	unsigned char tempbuf[8];
-	char *out;
-	for(t=ubuf; *t; ++t) {
-		uni_p = tempbuf;
-		l += uni_1(*t);
-	}
+	int l = 0, n;
+	unsigned char *out;
+	for(t=ubuf; *t; ++t)
+		l += (*t <= 0x7f ? 1 : uni_len(*t));
+	n = t - ubuf;
 	out = malloc(l+1);
 	if(!out) return 0;
-	uni_p = out;
-	for(t=ubuf; *t; ++t)
-		uni_1(*t);
-	*uni_p = 0;
+	l = acs_uni2utf8_n(ubuf, n, out);
+	out[l] = 0;
 	return out;
 }
 
-/* convert to utf8 then write to a file */
+/* convert to utf8 then write to a file, in one write if we can */
 void acs_write_mix(int fd, const unsigned int *s, int len)
 {
-static unsigned char buf[256];
-uni_p = buf;
-while(len--) {
-uni_1(*s++);
-if(uni_p - buf < 250) continue;
-write(fd, buf, uni_p - buf);
-uni_p = buf;
+unsigned char buf[1024];
+unsigned char *big = 0;
+int n;
+
+if(len > (int)sizeof(buf)/6)
+big = malloc(len*6);
+if(big) {
+n = acs_uni2utf8_n(s, len, big);
+write(fd, big, n);
+free(big);
+return;
+}
+
+/* short, or out of memory; go through the stack buffer */
+while(len) {
+n = sizeof(buf)/6;
+if(n > len) n = len;
+write(fd, buf, acs_uni2utf8_n(s, n, buf));
+s += n, len -= n;
 }
-if(uni_p > buf)
-write(fd, buf, uni_p - buf);
 }
 
 /* dest has to have enough room */
 int acs_utf82uni(const unsigned char *ubuf, unsigned int *dest)
 {
 int l = 0;
-	uni_p = (unsigned char *)ubuf;
-	while(*dest++ = utf8_1()) ++l;
+unsigned int c;
+while(1) {
+/* a run of ascii, without the function call */
+while((c = *ubuf) && c <= 0x7f)
+dest[l++] = c, ++ubuf;
+if(!c) break;
+dest[l++] = utf8_1(&ubuf);
+}
+dest[l] = 0;
 return l;
 }
 
@@ -292,9 +361,9 @@ int acs_substring_mix(const char *s, const unsigned int *t)
 {
 int n = 0;
 unsigned int c, d;
-uni_p = (unsigned char *)s;
-while(*uni_p) {
-c = utf8_1();
+const unsigned char *p = (const unsigned char *)s;
+while(*p) {
+c = utf8_1(&p);
 d = *t++;
 // if c is a letter it is lower case by assumption.
 if(acs_isalpha(d)) d = acs_tolower(d);
@@ -962,6 +1031,9 @@ slovak_uc,
 
 static struct uc_name *uc_loaded;
 
+/* bumped whenever a pronunciation changes */
+unsigned int acs_pron_serial;
+
 void acs_clearpunc(unsigned int c)
 {
 struct uc_name *u, *s = 0;
@@ -973,6 +1045,7 @@ if(!u) return;
 if(s) s->next = u->next;
 else uc_loaded = u->next;
 free(u);
+++acs_pron_serial;
 }
 
 const char *acs_getpunc(unsigned int c)
@@ -995,6 +1068,7 @@ u->name = malloc(strlen(s) + 1);
 strcpy((char*)u->name, s);
 u->next = uc_loaded;
 uc_loaded = u;
+++acs_pron_serial;
 }
 
 /* The replacement dictionary, in utf8 */
@@ -1003,25 +1077,22 @@ static char *dict1[NUMDICTWORDS];
 static char *dict2[NUMDICTWORDS];
 static int numdictwords;
 // Build the lower case word, in utf8 or in unicode.
-static char lw_utf8[WORDLEN+8];
+static __thread char lw_utf8[WORDLEN+8];
 
 static int lowerword(const char *w)
 {
-	char *lp = lw_utf8; // lower case word pointer
+	unsigned char *lp = (unsigned char *)lw_utf8; // lower case word pointer
+	const unsigned char *wp = (const unsigned char *)w;
 	unsigned int uc; // unicode of each letter
 
-	while(*w) {
-		uni_p = (unsigned char *)w;
-		uc = utf8_1(); // convert utf8 to unicode
+	while(*wp) {
+		uc = utf8_1(&wp); // convert utf8 to unicode, and push wp along
 		if(!acs_isalpha(uc)) return -1; // not a letter in your language
-		w = (char *)uni_p; // prior call pushes uni_p along
 		
 uc = acs_tolower(uc);
 // back to utf8
-		uni_p = (unsigned char *)lp;
-		uni_1(uc);
-		lp = (char *)uni_p;
-		if(lp > lw_utf8 + WORDLEN) return -6; // too long
+		lp = uni_1(lp, uc);
+		if(lp > (unsigned char *)lw_utf8 + WORDLEN) return -6; // too long
 	}
 
 	*lp = 0;
@@ -1050,8 +1121,9 @@ int j, rc;
 if(rc = lowerword(word1)) return rc;
 if(word2 && strlen(word2) > WORDLEN) return -6;
 j = inDictionary(lw_utf8);
+if(j < 0 && !word2) return 0;
+++acs_pron_serial;
 if(j < 0) {
-if(!word2) return 0;
 // new entry
 j = numdictwords;
 if(j == NUMDICTWORDS) return -7; // no room
@@ -1093,13 +1165,13 @@ by appending the designated suffix; the suffix that was removed by mkroot().
 To be international, this is all done in unicode.
 *********************************************************************/
 
-static unsigned int rootword[WORDLEN+16];
+static __thread unsigned int rootword[WORDLEN+16];
 
 static unsigned int *inline_uni(char *t)
 {
 int i = 0;
-uni_p = (unsigned char *)t;
-while(rootword[i] = utf8_1())
+const unsigned char *p = (const unsigned char *)t;
+while(rootword[i] = utf8_1(&p))
 ++i;
 return rootword;
 }
@@ -1235,19 +1307,20 @@ int i, root;
 char *t;
 unsigned int c;
 root_fn f;
+unsigned char *p;
 
-uni_p = (unsigned char *)lw_utf8;
+p = (unsigned char *)lw_utf8;
 for(i=0; i<len; ++i, ++s) {
-if((char *)uni_p - lw_utf8 > WORDLEN) return 0;
+if((char *)p - lw_utf8 > WORDLEN) return 0;
 c = *s;
 // This should already be a letter, but let's recheck.
 if(!acs_isalpha(c)) return 0;
 c = acs_tolower(c);
 rootword[i] = c;
-uni_1(c);
+p = uni_1(p, c);
 }
 rootword[i] = 0;
-*uni_p = 0;
+*p = 0;
 
 t = fromDictionary(lw_utf8);
 if(t) return inline_uni(t);
@@ -1259,10 +1332,10 @@ root = (*f)(i);
 if(!root) return 0;
 
 /* have to go back to utf8 to do the lookup */
-uni_p = (unsigned char *)lw_utf8;
+p = (unsigned char *)lw_utf8;
 for(i=0; c = rootword[i]; ++i)
-uni_1(c);
-*uni_p = 0;
+p = uni_1(p, c);
+*p = 0;
 t = fromDictionary(lw_utf8);
 if(!t) return 0;
 // and back to unicode
@@ -1290,6 +1363,7 @@ char *t, *u;
 char save, c;
 char teebit = 0;
 unsigned int p_uc; // punctuation unicode
+const unsigned char *up;
 
 // leading whitespace doesn't matter
 skipWhite(&s);
@@ -1409,9 +1483,9 @@ if(!c) return 0; // empty line
 t = strpbrk(s, " \t");
 if(t) { save = *t; *t = 0; }
 
-uni_p = (unsigned char *)s;
-p_uc = utf8_1();
-if(*uni_p == 0 || uni_p == (unsigned char *)t) {
+up = (const unsigned char *)s;
+p_uc = utf8_1(&up);
+if(*up == 0 || up == (unsigned char *)t) {
 punc:
 // cannot leave it with no pronunciation
 if(!t) return -8;
@@ -1466,6 +1540,7 @@ free(dict2[i]);
 dict2[i] = 0;
 }
 numdictwords = 0;
+++acs_pron_serial;
 
 while(uc_loaded) acs_clearpunc(uc_loaded->unicode);
 
@@ -1486,7 +1561,7 @@ void acs_suspendkeys(const char *except)
 int key, ss, mkcode;
 const char *t;
 
-acs_log("suspend keys\n");
+acs_trace(ACS_TR_SUSPEND, 0, 0, 0);
 acs_clearkeys();
 if(!except) return;
 
@@ -1513,7 +1588,7 @@ void acs_resumekeys(void)
 {
 int key, ss, teebit, mkcode;
 
-acs_log("resume keys\n");
+acs_trace(ACS_TR_RESUME, 0, 0, 0);
 
 acs_clearkeys();
 
@@ -15,8 +15,12 @@ and declared in acsbridge.h.
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <time.h>
+#include <regex.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <linux/vt.h>
 
@@ -35,6 +39,16 @@ and declared in acsbridge.h.
 #define ATTRIBOFFSET SCREENCELLS
 #define VCREADOFFSET (2*SCREENCELLS)
 
+/* states of the escape sequence parser in postprocess() */
+#define PP_GROUND 0
+#define PP_ESC 1
+#define PP_CSI 2
+#define PP_STRING 3
+#define PP_STRING_ESC 4
+// Give up on a sequence that never ends, and let the text through.
+#define PP_CSIMAX 64
+#define PP_STRINGMAX 4096
+
 int acs_fd = -1; /* file descriptor for /dev/acsint */
 static int vcs_fd; /* file descriptor for /dev/vcsa */
 
@@ -75,6 +89,241 @@ va_end(args);
 return 0;
 }
 
+/*********************************************************************
+The trace ring, described in section 16 of acsbridge.h.
+A writer claims the next slot with an atomic increment,
+marks the slot as being written, fills it in,
+and then stores its sequence number, which says the record is whole.
+The ring is read only when it is saved, and a record that is
+overwritten or half written at that moment is left out.
+*********************************************************************/
+
+int acs_tracing = 1;
+static struct acs_trace_rec trace_ring[ACS_TRACE_RECS];
+static unsigned int trace_head; // records claimed so far
+#define TRACE_BUSY 0xffffffff
+
+static const char *const trace_formats[ACS_TR_BRIDGE] = {
+"none",
+"acsint read %d bytes",
+"key %d,%d",
+"fg %d",
+"output echo %d 0x%x",
+"get refresh",
+"ack refresh",
+"new %d",
+"reprint %d",
+"changed %d of %d",
+"unknown command %d",
+"synth read %d bytes",
+"index %d",
+"unknown byte %d",
+"imark %d cursor now base+%d",
+"sentence spoken",
+"sent %d markers, last offset %d",
+"shutup",
+"suspend keys",
+"resume keys",
+"allocate %d",
+};
+
+void acs_trace_text(const struct acs_trace_rec *r, char *buf, int buflen)
+{
+char chars[12];
+int j, n;
+unsigned int d;
+
+if(r->event >= ACS_TR_BRIDGE) {
+snprintf(buf, buflen, "event %d: %d %d %d", r->event, r->a, r->b, r->c);
+return;
+}
+
+if(r->event != ACS_TR_NEWCHARS) {
+snprintf(buf, buflen, trace_formats[r->event], r->a, r->b, r->c);
+return;
+}
+
+/* the first 8 characters of new output ride along, a byte each */
+n = (r->a < 8 ? r->a : 8);
+for(j=0; j<n; ++j) {
+d = (j < 4 ? r->b : r->c) >> (8*(j&3)) & 0xff;
+chars[j] = (d >= ' ' && d < 0x7f ? d : '.');
+}
+chars[n] = 0;
+snprintf(buf, buflen, "new %d \"%s\"", r->a, chars);
+}
+
+void acs_trace(int event, int a, int b, int c)
+{
+struct acs_trace_rec rec, *r = &rec;
+struct timespec ts;
+unsigned int n = 0;
+char line[100];
+
+if(!acs_tracing && !acs_debug) return;
+
+if(acs_tracing) {
+n = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+r = trace_ring + (n & (ACS_TRACE_RECS-1));
+__atomic_store_n(&r->seq, TRACE_BUSY, __ATOMIC_RELAXED);
+__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+clock_gettime(CLOCK_MONOTONIC, &ts);
+r->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+r->event = event;
+r->pad = 0;
+r->a = a, r->b = b, r->c = c;
+
+/* publish the slot we claimed, even if tracing was turned off meanwhile */
+if(r != &rec)
+__atomic_store_n(&r->seq, n, __ATOMIC_RELEASE);
+
+if(acs_debug) {
+acs_trace_text(r, line, sizeof(line));
+acs_log("%s\n", line);
+}
+}
+
+int acs_trace_save(const char *filename)
+{
+struct acs_trace_hdr hdr;
+struct acs_trace_rec *recs, *r;
+unsigned int head, n, count = 0;
+FILE *f;
+int rc = 0, e;
+
+recs = malloc(ACS_TRACE_RECS * sizeof(struct acs_trace_rec));
+if(!recs) {
+errno = ENOMEM;
+return -1;
+}
+
+head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+n = (head > ACS_TRACE_RECS ? head - ACS_TRACE_RECS : 0);
+for(; n != head; ++n) {
+r = trace_ring + (n & (ACS_TRACE_RECS-1));
+if(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != n) continue;
+recs[count] = *r;
+__atomic_thread_fence(__ATOMIC_ACQUIRE);
+// overwritten while we were copying it
+if(__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != n) continue;
+++count;
+}
+
+memset(&hdr, 0, sizeof(hdr));
+memcpy(hdr.magic, "ACSTRACE", 8);
+hdr.version = 1;
+hdr.recsize = sizeof(struct acs_trace_rec);
+hdr.count = count;
+
+f = fopen(filename, "w");
+if(!f) {
+e = errno;
+free(recs);
+errno = e;
+return -1;
+}
+if(fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+(count && fwrite(recs, sizeof(struct acs_trace_rec), count, f) != count))
+rc = -1;
+e = errno;
+if(fclose(f)) rc = -1, e = errno;
+free(recs);
+errno = e;
+return rc;
+}
+
+/*********************************************************************
+Capture the reads from acsint, and profile acs_events().
+See Section 18 in acsbridge.h.
+*********************************************************************/
+
+static FILE *capture_f;
+int acs_profiling;
+struct acs_profile acs_prof;
+
+static unsigned long long prof_now(void)
+{
+struct timespec ts;
+if(!acs_profiling) return 0;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int acs_capture(const char *filename)
+{
+struct acs_capture_hdr hdr;
+int fd, rc = 0;
+
+if(capture_f) {
+if(fclose(capture_f)) rc = -1;
+capture_f = 0;
+}
+if(!filename) return rc;
+
+/* The capture holds every key you type, passwords included,
+ * so it is yours alone, and I won't follow a symlink to write it. */
+fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW|O_CLOEXEC, 0600);
+if(fd < 0) return -1;
+capture_f = fdopen(fd, "w");
+if(!capture_f) {
+close(fd);
+return -1;
+}
+memset(&hdr, 0, sizeof(hdr));
+memcpy(hdr.magic, "ACSCAPT1", 8);
+hdr.version = 1;
+if(fwrite(&hdr, sizeof(hdr), 1, capture_f) != 1) {
+fclose(capture_f);
+capture_f = 0;
+return -1;
+}
+return 0;
+}
+
+int acs_profile_save(const char *filename)
+{
+const struct acs_profile *p = &acs_prof;
+double secs = p->ns_events / 1e9;
+FILE *f;
+int rc = 0, e;
+
+f = fopen(filename, "w");
+if(!f) return -1;
+fprintf(f, "%lu reads, %lu events, %llu bytes, %.3f seconds in acs_events",
+p->reads, p->events, p->bytes, secs);
+if(secs > 0)
+fprintf(f, ", %.0f events a second", p->events / secs);
+fprintf(f, "\n");
+fprintf(f, "postprocess %.3f seconds, overflow memmove %.3f seconds, handlers %.3f seconds\n",
+p->ns_postprocess / 1e9, p->ns_memmove / 1e9, p->ns_handlers / 1e9);
+if(ferror(f)) rc = -1;
+e = errno;
+if(fclose(f)) rc = -1, e = errno;
+errno = e;
+return rc;
+}
+
+static void captureRead(const unsigned char *buf, int len)
+{
+struct acs_capture_rec rec;
+struct timespec ts;
+
+clock_gettime(CLOCK_MONOTONIC, &ts);
+rec.ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+rec.len = len;
+rec.pad = 0;
+/* flush each read, so the file is whole up to the moment we crash */
+if(fwrite(&rec, sizeof(rec), 1, capture_f) != 1 ||
+fwrite(buf, 1, len, capture_f) != (size_t)len ||
+fflush(capture_f)) {
+acs_log("capture failed, errno %d, capture stopped\n", errno);
+fclose(capture_f);
+capture_f = 0;
+}
+}
+
 key_handler_t acs_key_h;
 acs_more_handler_t acs_more_h;
 acs_fgc_handler_t acs_fgc_h;
@@ -95,6 +344,152 @@ struct acs_readingBuffer *acs_mb; /* manipulation buffer */
 struct acs_readingBuffer *acs_tb; /* tty buffer */
 struct acs_readingBuffer *acs_rb; /* current reading buffer */
 
+/*********************************************************************
+Indexes that shadow a reading buffer: the folded text for searching,
+the newline ring for line navigation, and the token runs for words.
+These are derived from the text, and brought up to date by indexsync(),
+except for the token runs, which wait for toksync().
+indexcut() says the text is about to change at p and beyond,
+indexshift() says diff cells have been pulled off the front,
+and indexreset() throws it all away.
+*********************************************************************/
+
+/* Where a cell lives in the folded shadow of its reading buffer */
+#define foldof(b, p) ((unsigned char *)(b)->fold + ((p) - (b)->area))
+/* number of newlines in the ring, and the offset of the ith one */
+#define nl_count(b) ((unsigned short)((b)->nl_tail - (b)->nl_head))
+#define nl_at(b, i) ((unsigned short)((b)->nl[(unsigned short)((b)->nl_head + (i))] - (b)->nl_base))
+
+static void indexreset(struct acs_readingBuffer *b)
+{
+b->foldend = b->nlend = b->tokend = b->start;
+b->nl_head = b->nl_tail = b->nl_base = 0;
+}
+
+static void indexcut(struct acs_readingBuffer *b, const unsigned int *p)
+{
+if(b->foldend > p) b->foldend = (unsigned int *)p;
+if(b->tokend > p) b->tokend = (unsigned int *)p;
+if(b->nlend > p) {
+b->nlend = (unsigned int *)p;
+while(nl_count(b) && nl_at(b, nl_count(b)-1) >= p - b->start)
+--b->nl_tail;
+}
+}
+
+static void indexshift(struct acs_readingBuffer *b, int diff)
+{
+int j;
+
+/* slide the folded shadow along with the text */
+j = b->foldend - b->start - diff;
+if(j > 0) {
+memmove(foldof(b, b->start), foldof(b, b->start+diff), j);
+b->foldend -= diff;
+} else b->foldend = b->start;
+
+/* The token runs are distances, and move as is.
+ * A run cut off at the front is clamped by runstart(). */
+j = b->tokend - b->start - diff;
+if(j > 0) {
+memmove(b->tok_back + 1, b->tok_back + 1 + diff, j*sizeof(unsigned short));
+memmove(b->tok_fwd + 1, b->tok_fwd + 1 + diff, j*sizeof(unsigned short));
+b->tokend -= diff;
+} else b->tokend = b->start;
+
+/* drop the newlines that fell off, and rebase the rest */
+if(b->nlend - b->start <= diff) {
+b->nlend = b->start;
+b->nl_head = b->nl_tail;
+return;
+}
+while(nl_count(b) && nl_at(b, 0) < diff)
+++b->nl_head;
+b->nl_base += diff;
+b->nlend -= diff;
+}
+
+static void indexsync(struct acs_readingBuffer *b)
+{
+unsigned int *s;
+unsigned char *f;
+
+if(!b->foldend || b->foldend < b->start || b->foldend > b->end ||
+!b->nlend || b->nlend < b->start || b->nlend > b->end)
+indexreset(b);
+
+s = b->foldend;
+f = foldof(b, s);
+while(s < b->end) *f++ = acs_unaccent(*s++);
+*f = 0;
+b->foldend = s;
+
+for(s=b->nlend; s<b->end; ++s)
+if(*s == '\n')
+b->nl[b->nl_tail++] = (unsigned short)(s - b->start + b->nl_base);
+b->nlend = s;
+}
+
+/* Bring the token runs up to date.
+ * The last run we indexed may have grown, so start over with that run. */
+static void toksync(struct acs_readingBuffer *b)
+{
+unsigned int *s, *r;
+int k, len;
+
+s = b->tokend;
+if(!s || s < b->start || s > b->end) s = b->start;
+if(s == b->end) {
+b->tokend = s;
+return;
+}
+if(s > b->start) {
+s = s - 1 - b->tok_back[s - 1 - b->area];
+if(s < b->start) s = b->start;
+}
+
+for(; s<b->end; s=r) {
+r = s + 1;
+if(acs_isalnum(*s))
+while(r < b->end && acs_isalnum(*r)) ++r;
+else
+while(r < b->end && *r == *s) ++r;
+len = r - s;
+for(k=0; k<len; ++k) {
+b->tok_back[s + k - b->area] = k;
+b->tok_fwd[s + k - b->area] = len - 1 - k;
+}
+}
+b->tokend = s;
+}
+
+/* start and end of the run containing p, after toksync() */
+static unsigned int *runstart(struct acs_readingBuffer *b, const unsigned int *p)
+{
+const unsigned int *s = p - b->tok_back[p - b->area];
+if(s < b->start) s = b->start;
+return (unsigned int *)s;
+}
+
+static unsigned int *runend(struct acs_readingBuffer *b, const unsigned int *p)
+{
+return (unsigned int *)p + b->tok_fwd[p - b->area];
+}
+
+/* How many newlines lie strictly before p?  A binary search. */
+static int nl_before(struct acs_readingBuffer *b, const unsigned int *p)
+{
+int lo = 0, hi = nl_count(b), mid;
+int ofs = p - b->start;
+
+while(lo < hi) {
+mid = (lo + hi) / 2;
+if(nl_at(b, mid) < ofs) lo = mid + 1;
+else hi = mid;
+}
+return lo;
+}
+
 // cp437 code page, for English.
 static const unsigned int cp437[] = {
 0x0000,0x263a,0x263b,0x2665,0x2666,0x2663,0x2660,0x2022,0x25d8,0x25cb,0x25d9,0x2642,0x2640,0x266a,0x266b,0x263c,
@@ -196,6 +591,7 @@ for(j=0; j<acs_vc_ncols; ++j) {
 }
 *t = 0;
 screenBuf.end = t;
+indexreset(&screenBuf);
 }
 
 static void screenBlank(void)
@@ -216,6 +612,390 @@ for(j=0; j<acs_vc_ncols; ++j) *s++ = ' ';
 }
 *s = 0;
 screenBuf.end = s;
+indexreset(&screenBuf);
+}
+
+/*********************************************************************
+A virtual terminal, fed by the tty output stream.
+This is how I tell a redraw from new output in screen mode.
+Readline, vi, top, and friends repaint whole lines or whole screens,
+and most of what they paint is already there.
+I keep my own copy of the screen, run every batch of output through it,
+and watch for cells whose contents actually change.
+Only those cells, in row order, find their way into the tty log,
+and a batch that changes nothing is a reprint and is discarded.
+The model is seeded from /dev/vcsa when you enter screen mode,
+or switch consoles in screen mode, and after that it runs on the stream alone.
+I understand cursor motion, erase, insert, delete, and scrolling,
+which is what the linux console and the curses programs actually use.
+Anything else is skipped; at worst the model drifts,
+and the drift makes me speak too much, not too little.
+*********************************************************************/
+
+static int vt_rows, vt_cols; // 0 means there is no model
+static unsigned int vt_cell[SCREENCELLS];
+static unsigned char vt_dirty[SCREENCELLS];
+static int vt_row, vt_col, vt_top, vt_bot;
+static int vt_saverow, vt_savecol;
+static char vt_wrap; // wrap pending, after writing the last column
+static int vt_state;
+#define VT_CHARSET 5 // the byte that names a character set
+#define VT_NPAR 16
+static int vt_par[VT_NPAR], vt_npar;
+static char vt_priv;
+// the changed text, for the tty log
+static unsigned int *vt_out;
+static int vt_outlen, vt_outmax;
+// where the last span ended, so the next one can continue it
+static int vt_lastrow = -1, vt_lastcol;
+static unsigned int vt_outbuf[TTYLOGSIZE];
+
+#define vt_at(r, c) ((r)*vt_cols + (c))
+
+static void vt_seed(void)
+{
+int i, j;
+const unsigned int *s;
+
+vt_rows = vt_cols = 0;
+if(!screenmode) return;
+acs_screensnap();
+if(acs_vc_nrows * acs_vc_ncols > SCREENCELLS) return;
+vt_rows = acs_vc_nrows;
+vt_cols = acs_vc_ncols;
+s = screenBuf.start;
+for(i=0; i<vt_rows; ++i) {
+for(j=0; j<vt_cols; ++j)
+vt_cell[vt_at(i, j)] = *s++;
+++s; // newline
+}
+memset(vt_dirty, 0, vt_rows*vt_cols);
+vt_row = acs_vc_row, vt_col = acs_vc_col;
+if(vt_row >= vt_rows) vt_row = vt_rows-1;
+if(vt_col >= vt_cols) vt_col = vt_cols-1;
+vt_top = 0, vt_bot = vt_rows-1;
+vt_saverow = vt_savecol = 0;
+vt_wrap = 0;
+vt_state = PP_GROUND;
+vt_lastrow = -1;
+}
+
+/* Send the changed span of a row to the output, and clean the row.
+ * The span runs from the first changed cell to the last,
+ * with a newline in front unless it picks up where the last span left off,
+ * further along the same line, or wrapping onto the next. */
+static void vt_span(int r)
+{
+int c0, c1;
+unsigned char *d = vt_dirty + vt_at(r, 0);
+
+for(c0=0; c0<vt_cols; ++c0)
+if(d[c0]) break;
+if(c0 == vt_cols) return;
+for(c1=vt_cols-1; !d[c1]; --c1)  ;
+memset(d, 0, vt_cols);
+
+if(r == vt_lastrow && c0 >= vt_lastcol) {
+// same line, further along; a space if there's a gap
+if(c0 > vt_lastcol && vt_outlen < vt_outmax)
+vt_out[vt_outlen++] = ' ';
+} else if(r == vt_lastrow+1 && !c0 && vt_lastcol == vt_cols) {
+// the last span wrapped onto this line
+} else if(vt_outlen < vt_outmax) {
+vt_out[vt_outlen++] = '\n';
+}
+vt_lastrow = r, vt_lastcol = c1 + 1;
+for(; c0<=c1; ++c0) {
+if(vt_outlen == vt_outmax) break;
+vt_out[vt_outlen++] = vt_cell[vt_at(r, c0)];
+}
+}
+
+static void vt_blank(int r, int c0, int c1)
+{
+int j;
+for(j=c0; j<c1; ++j) {
+vt_cell[vt_at(r, j)] = ' ';
+vt_dirty[vt_at(r, j)] = 0;
+}
+}
+
+/* Scroll rows top through bot up n lines.
+ * Whatever changed on a row that leaves the screen is sent along first. */
+static void vt_scrollup(int top, int bot, int n)
+{
+for(; n; --n) {
+vt_span(top);
+if(vt_lastrow == top) vt_lastrow = -1;
+else if(vt_lastrow > top && vt_lastrow <= bot) --vt_lastrow;
+memmove(vt_cell + vt_at(top, 0), vt_cell + vt_at(top+1, 0),
+(bot-top) * vt_cols * sizeof(unsigned int));
+memmove(vt_dirty + vt_at(top, 0), vt_dirty + vt_at(top+1, 0),
+(bot-top) * vt_cols);
+vt_blank(bot, 0, vt_cols);
+}
+}
+
+static void vt_scrolldown(int top, int bot, int n)
+{
+for(; n; --n) {
+vt_span(bot);
+if(vt_lastrow == bot) vt_lastrow = -1;
+else if(vt_lastrow >= top && vt_lastrow < bot) ++vt_lastrow;
+memmove(vt_cell + vt_at(top+1, 0), vt_cell + vt_at(top, 0),
+(bot-top) * vt_cols * sizeof(unsigned int));
+memmove(vt_dirty + vt_at(top+1, 0), vt_dirty + vt_at(top, 0),
+(bot-top) * vt_cols);
+vt_blank(top, 0, vt_cols);
+}
+}
+
+static void vt_linefeed(void)
+{
+if(vt_row == vt_bot) vt_scrollup(vt_top, vt_bot, 1);
+else if(vt_row < vt_rows-1) ++vt_row;
+}
+
+static void vt_put(unsigned int d)
+{
+int k;
+if(vt_wrap) {
+vt_wrap = 0;
+vt_col = 0;
+vt_linefeed();
+}
+k = vt_at(vt_row, vt_col);
+if(vt_cell[k] != d) {
+vt_cell[k] = d;
+vt_dirty[k] = 1;
+}
+if(++vt_col == vt_cols) --vt_col, vt_wrap = 1;
+}
+
+static void vt_clamp(void)
+{
+if(vt_row < 0) vt_row = 0;
+if(vt_row >= vt_rows) vt_row = vt_rows-1;
+if(vt_col < 0) vt_col = 0;
+if(vt_col >= vt_cols) vt_col = vt_cols-1;
+vt_wrap = 0;
+}
+
+static void vt_csi(unsigned int d)
+{
+int p0 = vt_par[0], p1 = vt_par[1];
+int n = (p0 ? p0 : 1);
+int i, k;
+
+if(vt_priv) return; // modes and such, nothing to do with the cells
+
+switch(d) {
+case 'A': vt_row -= n; break;
+case 'B': case 'e': vt_row += n; break;
+case 'C': case 'a': vt_col += n; break;
+case 'D': vt_col -= n; break;
+case 'E': vt_row += n, vt_col = 0; break;
+case 'F': vt_row -= n, vt_col = 0; break;
+case 'G': case '`': vt_col = n-1; break;
+case 'd': vt_row = n-1; break;
+case 'H': case 'f':
+vt_row = (p0 ? p0 : 1) - 1;
+vt_col = (p1 ? p1 : 1) - 1;
+break;
+
+case 'J':
+if(p0 == 0) {
+vt_blank(vt_row, vt_col, vt_cols);
+for(i=vt_row+1; i<vt_rows; ++i) vt_blank(i, 0, vt_cols);
+} else if(p0 == 1) {
+for(i=0; i<vt_row; ++i) vt_blank(i, 0, vt_cols);
+vt_blank(vt_row, 0, vt_col+1);
+} else {
+for(i=0; i<vt_rows; ++i) vt_blank(i, 0, vt_cols);
+}
+break;
+
+case 'K':
+if(p0 == 0) vt_blank(vt_row, vt_col, vt_cols);
+else if(p0 == 1) vt_blank(vt_row, 0, vt_col+1);
+else vt_blank(vt_row, 0, vt_cols);
+break;
+
+case 'X':
+if(n > vt_cols - vt_col) n = vt_cols - vt_col;
+vt_blank(vt_row, vt_col, vt_col+n);
+break;
+
+case 'P':
+if(n > vt_cols - vt_col) n = vt_cols - vt_col;
+k = vt_at(vt_row, vt_col);
+memmove(vt_cell + k, vt_cell + k + n, (vt_cols - vt_col - n) * sizeof(unsigned int));
+memmove(vt_dirty + k, vt_dirty + k + n, vt_cols - vt_col - n);
+vt_blank(vt_row, vt_cols - n, vt_cols);
+break;
+
+case '@':
+if(n > vt_cols - vt_col) n = vt_cols - vt_col;
+k = vt_at(vt_row, vt_col);
+memmove(vt_cell + k + n, vt_cell + k, (vt_cols - vt_col - n) * sizeof(unsigned int));
+memmove(vt_dirty + k + n, vt_dirty + k, vt_cols - vt_col - n);
+vt_blank(vt_row, vt_col, vt_col + n);
+break;
+
+case 'L':
+if(vt_row < vt_top || vt_row > vt_bot) break;
+if(n > vt_bot - vt_row + 1) n = vt_bot - vt_row + 1;
+vt_scrolldown(vt_row, vt_bot, n);
+break;
+
+case 'M':
+if(vt_row < vt_top || vt_row > vt_bot) break;
+if(n > vt_bot - vt_row + 1) n = vt_bot - vt_row + 1;
+vt_scrollup(vt_row, vt_bot, n);
+break;
+
+case 'S': case 'T':
+if(n > vt_bot - vt_top + 1) n = vt_bot - vt_top + 1;
+if(d == 'S') vt_scrollup(vt_top, vt_bot, n);
+else vt_scrolldown(vt_top, vt_bot, n);
+break;
+
+case 'r':
+p0 = (p0 ? p0 : 1) - 1;
+p1 = (p1 ? p1 : vt_rows) - 1;
+if(p1 >= vt_rows) p1 = vt_rows-1;
+if(p0 >= p1) break;
+vt_top = p0, vt_bot = p1;
+vt_row = vt_col = 0;
+break;
+
+case 's': vt_saverow = vt_row, vt_savecol = vt_col; break;
+case 'u': vt_row = vt_saverow, vt_col = vt_savecol; break;
+
+default: return; // colors, modes, reports, cursor unchanged
+}
+
+vt_clamp();
+}
+
+static void vt_esc(unsigned int d)
+{
+int i;
+switch(d) {
+case '7': vt_saverow = vt_row, vt_savecol = vt_col; break;
+case '8': vt_row = vt_saverow, vt_col = vt_savecol; break;
+case 'D': vt_linefeed(); break;
+case 'E': vt_col = 0; vt_linefeed(); break;
+case 'M':
+if(vt_row == vt_top) vt_scrolldown(vt_top, vt_bot, 1);
+else if(vt_row) --vt_row;
+break;
+case 'c':
+for(i=0; i<vt_rows; ++i) vt_blank(i, 0, vt_cols);
+vt_row = vt_col = 0;
+vt_top = 0, vt_bot = vt_rows-1;
+break;
+default: return;
+}
+vt_clamp();
+}
+
+/* Run a batch of output through the model.
+ * Returns the number of unicodes of changed text placed in out,
+ * and 0 means the batch was a reprint. */
+static int vt_batch(const unsigned int *s, int len, unsigned int *out, int outmax)
+{
+int i;
+unsigned int d;
+
+vt_out = out, vt_outlen = 0, vt_outmax = outmax;
+
+for(i=0; i<len; ++i) {
+d = s[i];
+
+switch(vt_state) {
+case PP_ESC:
+vt_state = PP_GROUND;
+if(d == '[') {
+vt_state = PP_CSI;
+vt_npar = 0, vt_priv = 0;
+memset(vt_par, 0, sizeof(vt_par));
+} else if(d == ']' || d == 'P' || d == 'X' || d == '^' || d == '_') {
+vt_state = PP_STRING;
+} else if(d == '(' || d == ')' || d == '#' || d == '%') {
+// one more character names the charset; skip it
+vt_state = VT_CHARSET;
+} else vt_esc(d);
+continue;
+
+case PP_CSI:
+if(d >= '0' && d <= '9') {
+if(!vt_npar) vt_npar = 1;
+if(vt_npar <= VT_NPAR && vt_par[vt_npar-1] < 10000)
+vt_par[vt_npar-1] = 10*vt_par[vt_npar-1] + d - '0';
+continue;
+}
+if(d == ';') {
+if(!vt_npar) vt_npar = 1;
+++vt_npar;
+continue;
+}
+if(d == '?' || d == '>' || d == '=' || d == '!' || d == '[') {
+vt_priv = 1;
+continue;
+}
+if(d >= 0x20 && d < 0x40) continue; // intermediates
+vt_state = PP_GROUND;
+if(d == 0x18 || d == 0x1a) continue;
+if(d == '\33') { vt_state = PP_ESC; continue; }
+vt_csi(d);
+continue;
+
+case PP_STRING:
+if(d == 7 || d == 0x9c || d == 0x18 || d == 0x1a) vt_state = PP_GROUND;
+if(d == '\33') vt_state = PP_ESC;
+continue;
+
+case VT_CHARSET:
+vt_state = PP_GROUND;
+continue;
+}
+
+if(d == '\33') { vt_state = PP_ESC; continue; }
+if(d == 0x9b) {
+vt_state = PP_CSI;
+vt_npar = 0, vt_priv = 0;
+memset(vt_par, 0, sizeof(vt_par));
+continue;
+}
+if(d >= 0x80 && d < 0xa0) continue;
+
+if(d >= ' ' && d != 0x7f) {
+vt_put(d);
+continue;
+}
+
+switch(d) {
+case '\b':
+if(vt_col) --vt_col;
+vt_wrap = 0;
+break;
+case '\r':
+vt_col = 0, vt_wrap = 0;
+break;
+case '\n': case '\13': case '\f':
+vt_wrap = 0;
+vt_linefeed();
+break;
+case '\t':
+vt_col = (vt_col | 7) + 1;
+vt_clamp();
+break;
+} // other controls don't touch the screen
+}
+
+for(i=0; i<vt_rows; ++i) vt_span(i);
+return vt_outlen;
 }
 
 /* check to see if a tty reading buffer has been allocated */
@@ -227,7 +1007,7 @@ if(acs_tb && acs_tb != &tty_nomem)
 return; /* already allocated */
 
 acs_tb = malloc(sizeof(struct acs_readingBuffer));
-if(acs_tb) acs_log("allocate %d\n", acs_fgc);
+if(acs_tb) acs_trace(ACS_TR_ALLOC, acs_fgc, 0, 0);
 else acs_tb = &tty_nomem;
 tty_log[acs_fgc-1] = acs_mb = acs_tb;
 
@@ -245,23 +1025,36 @@ acs_tb->area[1] = 0;
 }
 
 acs_tb->cursor = acs_tb->start;
+acs_tb->pp_state = PP_GROUND;
+indexreset(acs_tb);
 acs_tb->v_cursor = 0;
 acs_tb->attribs = 0;
 }
 
+static int filterSync(void);
+
 int
 acs_screenmode(int enabled)
 {
 acs_imark_start = 0;
 screenmode = 0;
 checkAlloc();
-if(!enabled) return 0;
+vt_rows = 0;
+if(!enabled) {
+filterSync();
+return 0;
+}
 acs_vc();
-if(acs_vc_nrows * (acs_vc_ncols + 1) > SCREENCELLS) return -1;
+if(acs_vc_nrows * (acs_vc_ncols + 1) > SCREENCELLS) {
+filterSync();
+return -1;
+}
 screenmode = 1;
 acs_mb = &screenBuf;
+vt_seed();
 screenBlank();
 memset(acs_mb->marks, 0, sizeof(acs_mb->marks));
+filterSync();
 return 0;
 }
 
@@ -269,10 +1062,52 @@ return 0;
 // Open and close the device.
 
 static int acs_bufsize(int n);
+static int filter_sent;
+
+/* A unix socket in place of the device is the fake acsint, tests/acsfake,
+ * so the bridge can run without the kernel module.
+ * It speaks the same protocol, one event batch per packet,
+ * and keeps its screen in devname.vcsa, in place of /dev/vcsa. */
+static int fake_open(const char *devname)
+{
+struct sockaddr_un sa;
+char vcsname[sizeof(sa.sun_path) + 8];
+int e;
+
+if(strlen(devname) >= sizeof(sa.sun_path)) {
+errno = ENAMETOOLONG;
+return -1;
+}
+sprintf(vcsname, "%s.vcsa", devname);
+vcs_fd = open(vcsname, O_RDONLY | O_CLOEXEC);
+if(vcs_fd < 0)
+return -1;
+
+acs_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+if(acs_fd < 0)
+goto fail;
+memset(&sa, 0, sizeof(sa));
+sa.sun_family = AF_UNIX;
+strcpy(sa.sun_path, devname);
+if(connect(acs_fd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+return 0;
+
+e = errno;
+close(acs_fd);
+acs_fd = -1;
+errno = e;
+fail:
+e = errno;
+close(vcs_fd);
+errno = e;
+return -1;
+}
 
 int
 acs_open(const char *devname)
 {
+struct stat st;
+
 if(acs_fd >= 0) {
 // already open
 errno = EEXIST;
@@ -281,6 +1116,12 @@ return -1;
 
 if(acs_debug) unlink(debuglog);
 
+if(!stat(devname, &st) && S_ISSOCK(st.st_mode)) {
+if(fake_open(devname))
+return -1;
+goto opened;
+}
+
 vcs_fd = open("/dev/vcsa", O_RDONLY | O_CLOEXEC);
 if(vcs_fd < 0)
 return -1;
@@ -291,9 +1132,11 @@ close(vcs_fd);
 return -1;
 }
 
+opened:
 errno = 0;
 acs_reset_configure();
 acs_bufsize(TTYLOGSIZE);
+filter_sent = 0; // the driver starts with its filter off
 
 return acs_fd;
 }
@@ -311,6 +1154,21 @@ acs_fd = -1;
 return rc;
 }
 
+int
+acs_nonblock(int enabled)
+{
+int flags;
+if(acs_fd < 0) {
+errno = ENXIO;
+return -1;
+}
+flags = fcntl(acs_fd, F_GETFL);
+if(flags < 0) return -1;
+if(enabled) flags |= O_NONBLOCK;
+else flags &= ~O_NONBLOCK;
+return fcntl(acs_fd, F_SETFL, flags) < 0 ? -1 : 0;
+}
+
 void
 acs_nodecheck(const char *devname)
 {
@@ -336,6 +1194,7 @@ close(fd);
 
 /* if stat fails I'm going to assume it's not there and create it */
 if(stat(devname, &buf)) goto create;
+if(S_ISSOCK(buf.st_mode)) return; /* the fake acsint */
 if(major(buf.st_rdev) == m1 && minor(buf.st_rdev) == m2) return;
 unlink(devname);
 
@@ -506,6 +1365,41 @@ outbuf[1] = gap;
 return acs_write(2);
 }
 
+int acs_stamps(int enabled)
+{
+outbuf[0] = ACS_STAMPS;
+outbuf[1] = enabled;
+return acs_write(2);
+}
+
+/* Once it is on, the driver's filter follows acs_postprocess,
+ * which the adapter can change at any time. */
+static int filter_on;
+
+static int filterSync(void)
+{
+int flags = 0;
+if(filter_on)
+flags = acs_postprocess & (ACS_FILTER_BELL|ACS_FILTER_CRLF|ACS_FILTER_ESC);
+/* The screen model needs the cursor motion, and the cr of cr lf,
+ * to tell a repaint from new text. */
+if(screenmode && vt_rows)
+flags &= ~(ACS_FILTER_ESC|ACS_FILTER_CRLF);
+if(flags == filter_sent) return 0;
+outbuf[0] = ACS_FILTER;
+outbuf[1] = 0; // every console
+outbuf[2] = flags;
+if(acs_write(3)) return -1;
+filter_sent = flags;
+return 0;
+}
+
+int acs_filter(int enabled)
+{
+filter_on = enabled;
+return filterSync();
+}
+
 /* Use divert to swallow a string.
  * This is not unicode at present. */
 static char *swallow_string;
@@ -681,41 +1575,140 @@ outbuf[0] = ACS_CLEAR_KEYS;
 return acs_write(1);
 }
 
+/*********************************************************************
+Postprocess new text in the tty log.
+This runs over each new character exactly once.
+An escape sequence can be split across two batches of output,
+especially a long one, like the window title in an OSC sequence,
+so the state of the escape parser is kept with the console's buffer
+and picks up where it left off.
+The states follow ECMA-48: ESC, then CSI parameters up to a final byte,
+or a control string - OSC DCS SOS PM APC - up to BEL or ST.
+CAN or SUB cancels a sequence.
+*********************************************************************/
+
 static void
 postprocess(unsigned int *s)
 {
 unsigned int *t, *u;
+unsigned int c;
 int j;
 
 if(!acs_postprocess) return;
 
-// in case we had part of an ansi escape code
-s -= 100;
-if(s < tl->start) s = tl->start;
 t = s;
+indexcut(tl, s);
 
-while(*s) {
+for(; (c = *s); ++s) {
 
-// crlf
-if(*s == '\r' && s[1] == '\n' &&
-acs_postprocess&ACS_PP_CRLF) {
-++s;
+if(tl->pp_state != PP_GROUND) {
+if(c == 0x18 || c == 0x1a) { // cancel
+tl->pp_state = PP_GROUND;
 continue;
 }
 
-if(s[0] == '\7' && acs_postprocess&ACS_PP_CTRL_G) {
-++s;
+switch(tl->pp_state) {
+case PP_ESC:
+if(c == '\33') continue;
+if(c == '[') {
+tl->pp_state = PP_CSI;
+tl->pp_count = 0;
+continue;
+}
+if(c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_') {
+tl->pp_state = PP_STRING;
+tl->pp_count = 0;
+continue;
+}
+// intermediate bytes, as in esc ( B
+if(c >= 0x20 && c <= 0x2f) continue;
+// final byte, as in esc 7 or esc M
+if(c >= 0x30 && c <= 0x7e) {
+tl->pp_state = PP_GROUND;
 continue;
 }
+break;
+
+case PP_CSI:
+if(c >= 0x20 && c <= 0x3f) {
+if(++tl->pp_count == PP_CSIMAX) tl->pp_state = PP_GROUND;
+continue;
+}
+if(c >= 0x40 && c <= 0x7e) {
+tl->pp_state = PP_GROUND;
+continue;
+}
+if(c == '\33') {
+tl->pp_state = PP_ESC;
+continue;
+}
+break;
+
+case PP_STRING:
+if(c == '\7' || c == 0x9c) {
+tl->pp_state = PP_GROUND;
+continue;
+}
+if(c == '\33') tl->pp_state = PP_STRING_ESC;
+else if(++tl->pp_count == PP_STRINGMAX) tl->pp_state = PP_GROUND;
+continue;
+
+case PP_STRING_ESC:
+if(c == '\\') { // string terminator
+tl->pp_state = PP_GROUND;
+continue;
+}
+// Some other escape sequence ends the string; look at c again.
+tl->pp_state = PP_ESC;
+--s;
+continue;
+} // switch
+
+/* Something that doesn't belong in the sequence.
+ * A control character is acted on, as a terminal would,
+ * and the sequence continues; anything else ends the sequence. */
+if(c >= ' ') tl->pp_state = PP_GROUND;
+}
+
+/* ansi escape sequences, and their 8 bit forms */
+if(acs_postprocess&ACS_PP_ESCB) {
+if(c == '\33') {
+tl->pp_state = PP_ESC;
+continue;
+}
+if(c == 0x9b) {
+tl->pp_state = PP_CSI;
+tl->pp_count = 0;
+continue;
+}
+if(c == 0x90 || c == 0x98 || c == 0x9d || c == 0x9e || c == 0x9f) {
+tl->pp_state = PP_STRING;
+tl->pp_count = 0;
+continue;
+}
+}
+
+/* crlf, which may have straddled the last batch.
+ * The newline takes the place of the carriage return,
+ * so the cursor or a mark on the cr lands on the newline. */
+if(c == '\n' && acs_postprocess&ACS_PP_CRLF &&
+t > tl->start && t[-1] == '\r') {
+indexcut(tl, t-1);
+t[-1] = c;
+continue;
+}
+
+if(c == '\7' && acs_postprocess&ACS_PP_CTRL_G)
+continue;
 
 /* ^h is backspace.
  * Check to see if we have backed over the reading cursor or the marks.
  * Because of the way Jupiter reads, a mark could be at end of buffer.
  * In that case keep it at end of buffer. */
-if(s[0] == '\b' && acs_postprocess&ACS_PP_CTRL_H) {
-++s;
+if(c == '\b' && acs_postprocess&ACS_PP_CTRL_H) {
 if(t[-1] == 0) continue; /* buffer was empty */
 --t;
+indexcut(tl, t);
 /* Now check the cursor and the marks */
 if(tl->cursor && tl->cursor >= t)
 tl->cursor = (t > tl->start ? t-1 : t);
@@ -730,36 +1723,12 @@ tl->marks[27] = t;
 continue;
 }
 
-/* ansi escape sequences */
-if(*s == '\33' &&ACS_PP_ESCB) {
-for(++s; *s == '\33'; ++s)  ;
---s;
-j = 1;
-if(!s[j]) goto advance;
-if(s[j] != '[') {
-cut_j:
-s += j+1;
-// Could the cursor have read into the escape sequence, then we pulled it back?
-// I assume you didn't have time to set a mark in the middle of the sequence.
-if(tl->cursor && tl->cursor >= t)
-tl->cursor = (t > tl->start ? t-1 : t);
-continue;
-		}
-// escape [ stuff letter
-for(++j; s[j] && j<20; ++j)
-if(s[j] < 256 && isalpha(s[j])) goto cut_j;
-goto advance;
-}
-
 // control chars
-if(*s < ' ' && !strchr("\t\b\r\n\7", *s) &&
-acs_postprocess&ACS_PP_CTRL_OTHER) {
-++s;
+if(c < ' ' && !strchr("\t\b\r\n\7", c) &&
+acs_postprocess&ACS_PP_CTRL_OTHER)
 continue;
-}
 
-advance:
-*t++ = *s++;
+*t++ = c;
 }
 
 tl->end = t;
@@ -772,6 +1741,7 @@ if(screenmode) return;
 acs_imark_start = 0;
 if(acs_mb && acs_mb != &tty_nomem) {
 acs_mb->end = acs_mb->start;
+indexreset(acs_mb);
 memset(acs_mb->marks, 0, sizeof(acs_mb->marks));
 }
 acs_mb->cursor = acs_mb->start;
@@ -793,13 +1763,16 @@ int nr; // number of bytes read
 int i, j;
 int culen; /* catch up length */
 unsigned int *custart; // where does catch up start
-unsigned int *sp; // screen pointer
+const unsigned int *src; // the new text
+int srclen;
 int nlen; // length of new area
 int diff;
 int m2;
 char refreshed = 0;
 unsigned int d;
-int lastrow = acs_vc_row, lastcol = acs_vc_col;
+unsigned int a, b; // characters packed into a trace record
+unsigned long long stamp = 0; // from the driver, for the next event
+unsigned long long t0, t1; // for the profile
 
 errno = 0;
 if(acs_fd < 0) {
@@ -807,16 +1780,44 @@ errno = ENXIO;
 return -1;
 }
 
+/* in case acs_postprocess changed since the last read */
+filterSync();
+
 nr = read(acs_fd, inbuf, INBUFSIZE);
-acs_log("acsint read %d bytes\n", nr);
-if(nr < 0)
+acs_trace(ACS_TR_READ, nr, 0, 0);
+if(nr < 0) {
+/* nonblocking, and nothing to read */
+if(errno == EAGAIN) {
+errno = 0;
+return 0;
+}
 return -1;
+}
+if(capture_f && nr > 0)
+captureRead(inbuf, nr);
+t0 = prof_now();
+if(acs_profiling) {
+++acs_prof.reads;
+acs_prof.bytes += nr;
+}
 
 i = 0;
 while(i <= nr-4) {
+if(acs_profiling && inbuf[i] != ACS_STAMP) ++acs_prof.events;
 switch(inbuf[i]) {
+case ACS_STAMP:
+if(i > nr-12) {
+i = nr;
+break;
+}
+memcpy(&stamp, inbuf+i+4, 8);
+i += 12;
+break;
+
 case ACS_KEYSTROKE:
-acs_log("key %d,%d\n", inbuf[i+1], inbuf[i+2]);
+acs_trace(ACS_TR_KEY, inbuf[i+1], inbuf[i+2], 0);
+acs_latency_start(ACS_LAT_KEY, stamp);
+stamp = 0;
 // keystroke refreshes automatically in line mode;
 // we have to do it here for screen mode.
 if(screenmode && !refreshed) {
@@ -840,37 +1841,49 @@ i += 4;
 break;
 }
 }
-if(acs_key_h) acs_key_h(inbuf[i+1], inbuf[i + 2], inbuf[i+3]);
+if(acs_key_h) {
+t1 = prof_now();
+acs_key_h(inbuf[i+1], inbuf[i + 2], inbuf[i+3]);
+acs_prof.ns_handlers += prof_now() - t1;
+}
 i += 4;
 break;
 
 case ACS_FGC:
-acs_log("fg %d\n", inbuf[i+1]);
+acs_trace(ACS_TR_FGC, inbuf[i+1], 0, 0);
 acs_fgc = inbuf[i+1];
 checkAlloc();
 if(screenmode) {
 /* Oops, the checkAlloc function changed acs_mb out from under us. */
 acs_mb = &screenBuf;
+// a new console, a new screen to model
+vt_seed();
 screenBlank();
 memset(acs_mb->marks, 0, sizeof(acs_mb->marks));
 }
-if(acs_fgc_h) acs_fgc_h();
+if(acs_fgc_h) {
+t1 = prof_now();
+acs_fgc_h();
+acs_prof.ns_handlers += prof_now() - t1;
+}
 i += 4;
 break;
 
 case ACS_TTY_MORECHARS:
 if(i > nr-8) break;
 d = *(unsigned int *) (inbuf+i+4);
-acs_log("output echo %d", inbuf[i+1]);
-if(d >= ' ' && d < 0x7f) acs_log("/%c\n", d);
-else acs_log(";%x\n", d);
+acs_trace(ACS_TR_ECHO, inbuf[i+1], d, 0);
 /* If echo is nonzero, then the refresh has already been done. */
-if(acs_more_h) acs_more_h(inbuf[i+1], d);
+if(acs_more_h) {
+t1 = prof_now();
+acs_more_h(inbuf[i+1], d);
+acs_prof.ns_handlers += prof_now() - t1;
+}
 i += 8;
 break;
 
 case ACS_REFRESH:
-acs_log("ack refresh\n");
+acs_trace(ACS_TR_REFRESHED, 0, 0, 0);
 i += 4;
 break;
 
@@ -879,8 +1892,17 @@ case ACS_TTY_NEWCHARS:
  * m2 is always the foreground console; we could probably discard it. */
 m2 = inbuf[i+1];
 culen = inbuf[i+2] | ((unsigned short)inbuf[i+3]<<8);
-acs_log("new %d\n", culen);
 i += 4;
+/* the first few characters go into the trace */
+a = b = 0;
+for(j=0; j<8 && j<culen && i+4*j+4 <= nr; ++j) {
+d = * (unsigned int*) (inbuf + i + 4*j) & 0xff;
+if(j < 4) a |= d << 8*j;
+else b |= d << 8*(j-4);
+}
+acs_trace(ACS_TR_NEWCHARS, culen, a, b);
+acs_latency_start(ACS_LAT_TTY, stamp);
+stamp = 0;
 if(!culen) break;
 if(acs_debug) {
 for(j=0; j<culen; ++j) {
@@ -894,71 +1916,34 @@ acs_log("\n");
 }
 if(nr-i < culen*4) break;
 
-// The reprint detector
-if(screenmode && culen <= 10 &&
+src = (const unsigned int *) (inbuf+i);
+srclen = culen;
+
+/* The reprint detector.
+ * In screen mode, run the output through the virtual terminal,
+ * and keep only the text that changed something on the screen. */
+if(screenmode && vt_rows && m2 == acs_fgc &&
 acs_postprocess&ACS_PP_CTRL_OTHER) {
-sp = screenBuf.start + lastrow * (acs_vc_ncols+1) + lastcol;
-for(j=0; j<culen; ++j) {
-d = * (int*) (inbuf + i + 4*j);
-if(d == '\b') {
-if(lastcol) --lastcol, --sp;
-continue;
-}
-if(d == '\r') {
-sp -= lastcol, lastcol = 0;
-continue;
-}
-if(d != '\33') break;
-// only 2 or 3 escape sequences do I recognize here.
-// Only the really short ones would be used anyways.
-// esc[A and esc[8d
-if(++j == culen) goto inbuffer;
-d = * (int*) (inbuf + i + 4*j);
-if(d != '[') goto inbuffer;
-if(++j == culen) goto inbuffer;
-d = * (int*) (inbuf + i + 4*j);
-if(d == 'A') {
-if(lastrow) --lastrow, sp -= (acs_vc_ncols+1);
-continue;
-}
-if(d >= 0x80) goto inbuffer;
-if(!isdigit(d)) goto inbuffer;
-diff = d - '0';
-if(++j == culen) goto inbuffer;
-d = * (int*) (inbuf + i + 4*j);
-if(d < 0x80 && isdigit(d)) {
-diff = 10*diff + d - '0';
-if(++j == culen) goto inbuffer;
-d = * (int*) (inbuf + i + 4*j);
-}
-if(d == 'd') {
-lastrow = diff - 1;
-sp = screenBuf.start + lastrow * (acs_vc_ncols+1) + lastcol;
-continue;
-}
-goto inbuffer; // unknown escape sequence
-}
-// little cursor motions are done
-for(; j<culen; ++j) {
-d = * (int*) (inbuf + i + 4*j);
-if(d != *sp++) break;
-}
-if(j == culen) {
-acs_log("reprint %d\n", culen );
+srclen = vt_batch(src, culen, vt_outbuf, TTYLOGSIZE);
+if(!srclen) {
+acs_trace(ACS_TR_REPRINT, culen, 0, 0);
 i += culen*4;
 break;
 }
+acs_trace(ACS_TR_CHANGED, srclen, culen, 0);
+src = vt_outbuf;
 }
 
-inbuffer:
 tl = tty_log[m2 - 1];
 if(!tl || tl == &tty_nomem) {
 /* not allocated; no room for this data */
 i += culen*4;
 break;
 }
+// the virtual terminal hands me plain text, no escapes
+if(src == vt_outbuf) tl->pp_state = PP_GROUND;
 
-nlen = tl->end - tl->start + culen;
+nlen = tl->end - tl->start + srclen;
 diff = nlen - TTYLOGSIZE;
 
 if(diff >= tl->end-tl->start) {
@@ -966,17 +1951,23 @@ if(diff >= tl->end-tl->start) {
  * should never be greater; diff = tl->end - tl->start
  * copy the new stuff */
 custart = tl->start;
-memcpy(custart, inbuf+i, TTYLOGSIZE*4);
+memcpy(custart, src + srclen - TTYLOGSIZE, TTYLOGSIZE*4);
 tl->end = tl->start + TTYLOGSIZE;
 tl->end[0] = 0;
+indexreset(tl);
+// output was lost, don't try to finish an escape sequence
+tl->pp_state = PP_GROUND;
 tl->cursor = 0;
 memset(tl->marks, 0, sizeof(tl->marks));
 if(!screenmode) acs_imark_start = 0;
 } else {
 if(diff > 0) {
 // partial replacement
+t1 = prof_now();
 memmove(tl->start, tl->start+diff, (tl->end-tl->start - diff)*4);
 tl->end -= diff;
+indexshift(tl, diff);
+acs_prof.ns_memmove += prof_now() - t1;
 if(tl->cursor) {
 tl->cursor -= diff;
 if(tl->cursor < tl->start) tl->cursor = 0;
@@ -993,12 +1984,15 @@ if(tl->marks[j] < tl->start) tl->marks[j] = 0;
 }
 /* copy the new stuff */
 custart = tl->end;
-memcpy(custart, inbuf+i, culen*4);
-tl->end += culen;
+memcpy(custart, src, srclen*4);
+tl->end += srclen;
 tl->end[0] = 0;
 }
 
+t1 = prof_now();
 postprocess(custart);
+indexsync(tl);
+acs_prof.ns_postprocess += prof_now() - t1;
 
 /* If you're in screen mode, I haven't moved your reading cursor,
  * or imark _start, or the pointers in marks[], appropriately.
@@ -1011,258 +2005,435 @@ default:
 /* Perhaps a phase error.
  * Not sure what to do here.
  * Just give up. */
-acs_log("unknown command %d\n", inbuf[i]);
+acs_trace(ACS_TR_BADCMD, inbuf[i], 0, 0);
 i += 4;
 } // switch
 } // looping through events
 
+acs_prof.ns_events += prof_now() - t0;
 return 0;
 }
 
 int acs_refresh(void)
 {
-acs_log("get refresh\n");
+acs_trace(ACS_TR_REFRESH, 0, 0, 0);
 outbuf[0] = ACS_REFRESH;
 if(acs_write(1)) return -1;
 return acs_events();
 }
 
 
-// cursor commands.
-static unsigned int *tc; // temp cursor
+/*********************************************************************
+Cursor commands.
+Everything works on an acs_cursor_t handle, a buffer and a position.
+The classic functions below, acs_forward() and friends,
+are wrappers around a default handle that follows acs_mb.
+*********************************************************************/
 
-void acs_cursorset(void)
+void acs_cursor_init(acs_cursor_t *c, struct acs_readingBuffer *b)
 {
-tc = acs_mb->cursor;
+c->buf = b;
+c->pos = (b ? b->cursor : 0);
+c->searchlen = 0;
 }
 
-void acs_cursorsync(void)
+void acs_cursor_load(acs_cursor_t *c)
 {
-acs_mb->cursor = tc;
+c->pos = c->buf->cursor;
 }
 
-int acs_cursorvalid(void)
+void acs_cursor_store(const acs_cursor_t *c)
 {
-return tc != 0;
+c->buf->cursor = c->pos;
 }
 
-unsigned int acs_getc(void)
+unsigned int acs_cursor_getc(const acs_cursor_t *c)
 {
-return (tc ? *tc : 0);
+return (c->pos ? *c->pos : 0);
 }
 
-int acs_forward(void)
+int acs_cursor_forward(acs_cursor_t *c)
 {
-if(acs_mb->end == acs_mb->start) return 0;
-if(!tc) return 0;
-if(++tc == acs_mb->end) return 0;
+struct acs_readingBuffer *b = c->buf;
+if(b->end == b->start) return 0;
+if(!c->pos) return 0;
+if(++c->pos == b->end) return 0;
 return 1;
 }
 
-int acs_back(void)
+int acs_cursor_back(acs_cursor_t *c)
 {
-if(acs_mb->end == acs_mb->start) return 0;
-if(!tc) return 0;
-if(tc-- == acs_mb->start) return 0;
+struct acs_readingBuffer *b = c->buf;
+if(b->end == b->start) return 0;
+if(!c->pos) return 0;
+if(c->pos-- == b->start) return 0;
 return 1;
 }
 
-int acs_startline(void)
+/* start of line n, counting from 0, which must be in range */
+static unsigned int *linestart(struct acs_readingBuffer *b, int n)
 {
-int colno = 0;
-if(acs_mb->end == acs_mb->start) return 0;
-if(!tc) return 0;
-do ++colno;
-while(acs_back() && acs_getc() != '\n');
-acs_forward();
+return n ? b->start + nl_at(b, n-1) + 1 : b->start;
+}
+
+/* the newline that ends line n, or the last character in the buffer */
+static unsigned int *lineend(struct acs_readingBuffer *b, int n)
+{
+return n < nl_count(b) ? b->start + nl_at(b, n) : b->end - 1;
+}
+
+int acs_cursor_startline(acs_cursor_t *c)
+{
+struct acs_readingBuffer *b = c->buf;
+unsigned int *s;
+int colno;
+if(b->end == b->start) return 0;
+if(!c->pos) return 0;
+indexsync(b);
+s = linestart(b, nl_before(b, c->pos));
+colno = c->pos - s + 1;
+c->pos = s;
 return colno;
 }
 
-int acs_endline(void)
+int acs_cursor_endline(acs_cursor_t *c)
 {
-if(acs_mb->end == acs_mb->start) return 0;
-if(!tc) return 0;
-while(acs_getc() != '\n') {
-if(acs_forward()) continue;
-acs_back();
-break;
+struct acs_readingBuffer *b = c->buf;
+if(b->end == b->start) return 0;
+if(!c->pos) return 0;
+indexsync(b);
+c->pos = lineend(b, nl_before(b, c->pos));
+return 1;
+}
+
+int acs_cursor_lineno(const acs_cursor_t *c)
+{
+struct acs_readingBuffer *b = c->buf;
+if(b->end == b->start) return 0;
+if(!c->pos) return 0;
+indexsync(b);
+return nl_before(b, c->pos) + 1;
+}
+
+int acs_cursor_linecount(const acs_cursor_t *c)
+{
+struct acs_readingBuffer *b = c->buf;
+if(b->end == b->start) return 0;
+indexsync(b);
+return nl_count(b) + (b->end[-1] != '\n');
 }
+
+int acs_cursor_gotoline(acs_cursor_t *c, int n)
+{
+if(n < 1 || n > acs_cursor_linecount(c)) return 0;
+c->pos = linestart(c->buf, n-1);
 return 1;
 }
 
-// put the cursor back to a known location.
-// Internal use only.
-static void putback(int n)
+int acs_cursor_gotocol(acs_cursor_t *c, int n)
 {
-	if(!n) return;
-	if(n > 0) {
-		while(n--) acs_forward();
-	} else {
-		while(n++) acs_back();
-	}
+struct acs_readingBuffer *b = c->buf;
+int line;
+unsigned int *s;
+if(b->end == b->start) return 0;
+if(!c->pos) return 0;
+if(n < 1) return 0;
+indexsync(b);
+line = nl_before(b, c->pos);
+s = linestart(b, line) + n - 1;
+if(s > lineend(b, line)) return 0;
+c->pos = s;
+return 1;
 }
 
+/*********************************************************************
+Start and end of word, on top of the token runs.
+A word is a run of letters and digits,
+or two such runs joined by one apostrophe, as in don't.
+But the apostrophe only joins in one direction from the cursor;
+from the t in o'don't, the word starts at the second d.
+A run of five or more identical punctuation marks is a linear token;
+fewer than that and each mark is a token unto itself.
+*********************************************************************/
+
 // start of word (actually token/symbol)
-int acs_startword(void)
-{
-	int forward, backward;
-	char apos, apos1;
-	unsigned int c = acs_getc();
-
-if(!c) return 0;
-
-	if(!acs_isalnum(c)) {
-		if(c == '\n' || c == ' ' || c == '\7') return 1;
-		// a punctuation mark, an atomic token.
-		// But wait, if there are more than four in a row,
-		// we have a linear token.  Pull back to the start.
-		for(forward=0; acs_forward(); ++forward)
-			if(c != acs_getc()) break;
-		putback(-(forward+1));
-		for(backward=0; acs_back(); ++backward)
-			if(c != acs_getc()) break;
-		acs_forward();
-		if(forward+backward < 4) putback(backward);
+int acs_cursor_startword(acs_cursor_t *c)
+{
+	struct acs_readingBuffer *b = c->buf;
+	unsigned int *s;
+	unsigned int ch = acs_cursor_getc(c);
+
+if(!ch) return 0;
+toksync(b);
+
+	if(!acs_isalnum(ch)) {
+		if(ch == '\n' || ch == ' ' || ch == '\7') return 1;
+		s = runstart(b, c->pos);
+		if(runend(b, c->pos) - s >= 4) c->pos = s;
 		return 1;
 } // punctuation
 
-	apos = apos1 = 0;
-	do {
-		c = acs_getc();
-		if(c == '\'') {
-			if(apos1) break;
-			apos = apos1 = 1;
-			continue;
-		}
-		if(!acs_isalnum(c)) break;
-		apos = 0;
-	} while(acs_back());
-	acs_forward();
-	if(apos) acs_forward();
+	s = runstart(b, c->pos);
+	if(s-2 >= b->start && s[-1] == '\'' && acs_isalnum(s[-2]))
+		s = runstart(b, s-2);
+	c->pos = s;
 
 return 1;
 }
 
 // end of word
-int acs_endword(void)
-{
-	int forward, backward;
-	char apos, apos1;
-	unsigned int c = acs_getc();
-
-if(!c) return 0;
-
-	if(!acs_isalnum(c)) {
-		if(c == '\n' || c == ' ' || c == '\7') return 1;
-		for(backward=0; acs_back(); ++backward)
-			if(c != acs_getc()) break;
-		putback(backward+1);
-		for(forward=0; acs_forward(); ++forward)
-			if(c != acs_getc()) break;
-		acs_back();
-		if(forward+backward < 4) putback(-forward);
+int acs_cursor_endword(acs_cursor_t *c)
+{
+	struct acs_readingBuffer *b = c->buf;
+	unsigned int *s;
+	unsigned int ch = acs_cursor_getc(c);
+
+if(!ch) return 0;
+toksync(b);
+
+	if(!acs_isalnum(ch)) {
+		if(ch == '\n' || ch == ' ' || ch == '\7') return 1;
+		s = runend(b, c->pos);
+		if(s - runstart(b, c->pos) >= 4) c->pos = s;
 		return 1;
 } // punctuation
 
-	apos = apos1 = 0;
-	do {
-		c = acs_getc();
-		if(c == '\'') {
-			if(apos1) break;
-			 apos = apos1 = 1;
-			continue;
-		}
-		if(!acs_isalnum(c)) break;
-		apos = 0;
-	} while(acs_forward());
-	acs_back();
-	if(apos) acs_back();
+	s = runend(b, c->pos);
+	if(s+2 < b->end && s[1] == '\'' && acs_isalnum(s[2]))
+		s = runend(b, s+2);
+	c->pos = s;
 
 return 1;
 }
 
-void acs_startbuf(void)
+void acs_cursor_startbuf(acs_cursor_t *c)
 {
-tc = acs_mb->start;
+c->pos = c->buf->start;
 }
 
-void acs_endbuf(void)
+void acs_cursor_endbuf(acs_cursor_t *c)
 {
-tc = acs_mb->end;
-if(tc != acs_mb->start) --tc;
+c->pos = c->buf->end;
+if(c->pos != c->buf->start) --c->pos;
 }
 
 // skip past left spaces
-void acs_lspc(void)
+void acs_cursor_lspc(acs_cursor_t *c)
 {
-if(acs_mb->end == acs_mb->start) return;
-if(!tc) return;
-	if(!acs_back()) goto done;
-	while(acs_getc() == ' ')
-		if(!acs_back()) break;
-done:
-	acs_forward();
+struct acs_readingBuffer *b = c->buf;
+if(b->end == b->start) return;
+if(!c->pos) return;
+if(c->pos == b->start || c->pos[-1] != ' ') return;
+toksync(b);
+c->pos = runstart(b, c->pos-1);
 }
 
 // skip past right spaces
-void acs_rspc(void)
+void acs_cursor_rspc(acs_cursor_t *c)
+{
+struct acs_readingBuffer *b = c->buf;
+if(b->end == b->start) return;
+if(!c->pos) return;
+if(c->pos+1 >= b->end || c->pos[1] != ' ') return;
+toksync(b);
+c->pos = runend(b, c->pos+1);
+}
+
+/*********************************************************************
+Find the search window in the folded shadow.
+Apply the newline rule, step off the current character,
+and return the index where the scan begins, or -1 if there is nowhere to go.
+Forward scans run from there to the end of the buffer,
+backward scans consider matches that start at or before that index.
+*********************************************************************/
+
+static int searchFrom(acs_cursor_t *c, int back, int newline)
 {
-if(acs_mb->end == acs_mb->start) return;
-if(!tc) return;
-	if(!acs_forward()) goto done;
-	while(acs_getc() == ' ')
-		if(!acs_forward()) break;
-done:
-	acs_back();
+struct acs_readingBuffer *b = c->buf;
+int from, n;
+
+if(b->end == b->start) return -1;
+if(!c->pos) return -1;
+
+if(newline) {
+if(back) acs_cursor_startline(c); else acs_cursor_endline(c);
+}
+
+indexsync(b);
+n = b->end - b->start;
+from = c->pos - b->start + (back ? -1 : 1);
+if(from < 0 || from >= n) return -1;
+return from;
 }
 
-/* Case insensitive match.  Assumes the first letters already match.
- * This is an ascii match on the unaccented letters. */
-static int stringmatch(const char *s)
+/* Case insensitive match on the unaccented letters.
+ * Boyer-Moore-Horspool, forward or backward. */
+int acs_cursor_search(acs_cursor_t *c, const char *string, int back, int newline)
 {
-	char x, y;
-	short count = 0;
+struct acs_readingBuffer *b = c->buf;
+unsigned char pat[256];
+int shift[256];
+const unsigned char *f;
+int from, n, m, i, k;
 
-	if(!(y = *++s)) return 1;
-	y = tolower(y);
+for(m=0; string[m] && m < (int)sizeof(pat); ++m)
+pat[m] = tolower((unsigned char)string[m]);
+if(!m || string[m]) return 0;
 
-	while(++count, acs_forward()) {
-		x = acs_unaccent(acs_getc());
-if(x != y) break;
-		if(!(y = (unsigned char)*++s)) return 1;
-y = tolower(y);
-	} /* while matches */
+if((from = searchFrom(c, back, newline)) < 0) return 0;
+f = foldof(b, b->start);
+n = b->end - b->start;
+if(m > n) return 0;
 
-	// put the cursor back
-	putback(-count);
-	return 0;
+for(i=0; i<256; ++i) shift[i] = m;
+
+if(!back) {
+for(i=0; i<m-1; ++i) shift[pat[i]] = m-1-i;
+for(k=from; k <= n-m; k += shift[f[k+m-1]]) {
+for(i=m-1; i>=0 && f[k+i] == pat[i]; --i)  ;
+if(i < 0) goto found;
+}
+return 0;
 }
 
-int acs_bufsearch(const char *string, int back, int newline)
+// mirror image, the table keys on the first character of the window
+for(i=m-1; i>0; --i) shift[pat[i]] = i;
+k = from;
+if(k > n-m) k = n-m;
+for(; k >= 0; k -= shift[f[k]]) {
+for(i=0; i<m && f[k+i] == pat[i]; ++i)  ;
+if(i == m) goto found;
+}
+return 0;
+
+found:
+// leave the cursor on the last character, as the old stringmatch() did
+c->pos = b->start + k + m - 1;
+c->searchlen = m;
+return 1;
+}
+
+/* The compiled form of the last regular expression */
+static regex_t search_re;
+static char *search_re_source;
+
+int acs_cursor_search_re(acs_cursor_t *c, const char *pattern, int back, int newline)
 {
-	int ok;
-	unsigned int c, first;
+struct acs_readingBuffer *b = c->buf;
+unsigned char *f;
+regmatch_t rm;
+int from, n, k, ls, le, best, bestlen, rc;
+unsigned char save;
+
+if(!search_re_source || !stringEqual(pattern, search_re_source)) {
+if(search_re_source) {
+regfree(&search_re);
+free(search_re_source);
+search_re_source = 0;
+}
+if(regcomp(&search_re, pattern, REG_EXTENDED|REG_ICASE|REG_NEWLINE)) {
+errno = EINVAL;
+return 0;
+}
+search_re_source = strdup(pattern);
+if(!search_re_source) {
+regfree(&search_re);
+errno = ENOMEM;
+return 0;
+}
+}
 
-if(acs_mb->end == acs_mb->start) return 0;
-if(!tc) return 0;
+if((from = searchFrom(c, back, newline)) < 0) return 0;
+f = foldof(b, b->start);
+n = b->end - b->start;
+
+/* Work a line at a time, so the matcher never looks past the line.
+ * For each line, temporarily terminate the shadow at its newline. */
+ls = from;
+while(ls && f[ls-1] != '\n') --ls;
+
+while(1) {
+for(le=from; le<n && f[le] != '\n'; ++le)  ;
+save = f[le];
+f[le] = 0;
+best = -1, bestlen = 0;
+k = (back ? ls : from);
+while(k <= le) {
+rc = regexec(&search_re, (char*)f+k, 1, &rm,
+(k == ls ? 0 : REG_NOTBOL));
+if(rc) break;
+if(!back || k + rm.rm_so > from) {
+if(!back) best = k + rm.rm_so, bestlen = rm.rm_eo - rm.rm_so;
+break;
+}
+best = k + rm.rm_so, bestlen = rm.rm_eo - rm.rm_so;
+k = best + 1;
+}
+f[le] = save;
+if(best >= 0) break;
+if(back) {
+if(!ls) return 0;
+from = --ls;
+while(ls && f[ls-1] != '\n') --ls;
+} else {
+if(le >= n-1) return 0;
+from = ls = le + 1;
+}
+}
 
-	if(newline) {
-		if(back) acs_startline(); else acs_endline();
-	}
+c->pos = b->start + best + (bestlen ? bestlen-1 : 0);
+if(c->pos == b->end) --c->pos; // empty match at the very end
+c->searchlen = bestlen;
+return 1;
+}
+
+/*********************************************************************
+The classic cursor interface, a default handle on acs_mb.
+The handle follows acs_mb, which changes with the foreground console
+and with screen mode, just as the old temp cursor did.
+*********************************************************************/
 
-	ok = back ? acs_back() : acs_forward();
-	if(!ok) return 0;
+static acs_cursor_t tcur; // temp cursor
 
-first = (unsigned char) *string;
-first = tolower(first);
+static acs_cursor_t *tempc(void)
+{
+tcur.buf = acs_mb;
+return &tcur;
+}
+
+int acs_searchlen;
+
+void acs_cursorset(void) { acs_cursor_load(tempc()); }
+void acs_cursorsync(void) { acs_cursor_store(tempc()); }
+int acs_cursorvalid(void) { return tcur.pos != 0; }
+unsigned int acs_getc(void) { return acs_cursor_getc(tempc()); }
+int acs_forward(void) { return acs_cursor_forward(tempc()); }
+int acs_back(void) { return acs_cursor_back(tempc()); }
+int acs_startline(void) { return acs_cursor_startline(tempc()); }
+int acs_endline(void) { return acs_cursor_endline(tempc()); }
+int acs_lineno(void) { return acs_cursor_lineno(tempc()); }
+int acs_linecount(void) { return acs_cursor_linecount(tempc()); }
+int acs_gotoline(int n) { return acs_cursor_gotoline(tempc(), n); }
+int acs_gotocol(int n) { return acs_cursor_gotocol(tempc(), n); }
+int acs_startword(void) { return acs_cursor_startword(tempc()); }
+int acs_endword(void) { return acs_cursor_endword(tempc()); }
+void acs_startbuf(void) { acs_cursor_startbuf(tempc()); }
+void acs_endbuf(void) { acs_cursor_endbuf(tempc()); }
+void acs_lspc(void) { acs_cursor_lspc(tempc()); }
+void acs_rspc(void) { acs_cursor_rspc(tempc()); }
 
-	do {
-		c = acs_unaccent(acs_getc());
-if(c == first && stringmatch(string)) return 1;
-		ok = back ? acs_back() : acs_forward();
-	} while(ok);
+int acs_bufsearch(const char *string, int back, int newline)
+{
+int rc = acs_cursor_search(tempc(), string, back, newline);
+if(rc) acs_searchlen = tcur.searchlen;
+return rc;
+}
 
-	return 0;
+int acs_bufsearch_re(const char *pattern, int back, int newline)
+{
+int rc = acs_cursor_search_re(tempc(), pattern, back, newline);
+if(rc) acs_searchlen = tcur.searchlen;
+return rc;
 }
 
 // inject chars into the stream
@@ -1292,6 +2463,27 @@ static const char *lengthword[] = {
 
 int acs_getsentence(unsigned int *dest, int destlen, acs_ofs_type *offsets, int prop)
 {
+acs_cursor_t c;
+
+if(!acs_rb) {
+errno = EFAULT;
+return -1;
+}
+acs_cursor_init(&c, acs_rb);
+return acs_cursor_getsentence(&c, dest, destlen, offsets, prop);
+}
+
+int acs_cursor_getsentence(const acs_cursor_t *cp, unsigned int *dest, int destlen, acs_ofs_type *offsets, int prop)
+{
+if(!cp->buf) {
+errno = EFAULT;
+return -1;
+}
+return acs_getsentence_uc(cp->pos, dest, destlen, offsets, prop);
+}
+
+int acs_getsentence_uc(const unsigned int *base, unsigned int *dest, int destlen, acs_ofs_type *offsets, int prop)
+{
 const unsigned int *s;
 unsigned int *t, *destend;
 acs_ofs_type *o;
@@ -1300,7 +2492,7 @@ unsigned int c;
 char c1; /* cut c down to 1 byte */
 char spaces = 1, alnum = 0; // flags
 
-if(!dest || !acs_rb || !(s = acs_rb->cursor)) {
+if(!dest || !(s = base)) {
 errno = EFAULT;
 return -1;
 }
@@ -1351,7 +2543,7 @@ if(prop&ACS_GS_ONEWORD) {
 if(t == dest) *t++ = c, ++s;
 break;
 }
-if(o) o[t-dest] = s-acs_rb->cursor;
+if(o) o[t-dest] = s-base;
 *t++ = c;
 ++s;
 if(prop&ACS_GS_STOPLINE) break;
@@ -1363,7 +2555,7 @@ spaces = 0;
 
 if(acs_isalnum(c)) {
 if(!alnum) { // new word
-if(o) o[t-dest] = s-acs_rb->cursor;
+if(o) o[t-dest] = s-base;
 }
 // building our word
 *t++ = c;
@@ -1398,7 +2590,7 @@ continue;
 punc:
 alnum = 0;
 if(t > dest && prop&ACS_GS_ONEWORD) break;
-if(o) o[t-dest] = s-acs_rb->cursor;
+if(o) o[t-dest] = s-base;
 
 // check for repeat
 if(prop&ACS_GS_REPEAT &&
@@ -1438,7 +2630,7 @@ if(prop & ACS_GS_ONEWORD) break;
 } // loop over characters in the tty buffer
 
 *t = 0;
-if(o) o[t-dest] = s-acs_rb->cursor;
+if(o) o[t-dest] = s-base;
 
 return 0;
 }
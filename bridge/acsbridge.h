@@ -33,6 +33,9 @@ Section 12: synthesizer communications.
 Section 13: synthesizer speed, volume, pitch, etc.
 Section 14: messages from other processes.
 Section 15: international support.
+Section 16: the trace ring.
+Section 17: latency histograms.
+Section 18: capture and profile.
 *********************************************************************/
 
 #ifndef ACSBRIDGE_H
@@ -70,16 +73,26 @@ rather than reimplementing the select logic yourself.
 
 extern int acs_fd; // file descriptor
 extern int acs_debug; // set to 1 for acs debugging
-/* This writes a message to the log if debugging is on */
+/* This writes a message to the log if debugging is on.
+ * The bridge's own events go to the trace ring, section 16,
+ * and are copied here, as text, if debugging is on. */
 int acs_log(const char *msg, ...);
 
 // Returns the file descriptor, which is also stored in acs_fd.
 // Also opens /dev/vcsa, so you need permission for that.
+// If devname is a unix socket, it is the fake acsint in tests/acsfake,
+// and its screen is devname.vcsa.
 int acs_open(const char *devname);
 
 // Free the AccessBridge, closing the associated device.
 int acs_close(void);
 
+/* Read the device without waiting, for an epoll loop or the like.
+ * acs_events() then returns 0 if there is nothing to read,
+ * and brings the buffer up to date whenever there is new output,
+ * even between events.  See Nonblocking reads in acsint.txt. */
+int acs_nonblock(int enabled);
+
 /* Fix up the major and minor number of /dev/acsint - Linux only.
  * You should call this before acs_open().
  * This is a fallback in case udev is not configured properly,
@@ -227,6 +240,31 @@ In screen mode these marks are transient,
 and go away if you switch consoles, or switch back to line mode.
 They also do not move with scrolling text.  Not implemented yet.
 
+fold[] is a shadow copy of the text, one byte per character,
+lower case and without accents, as returned by acs_unaccent().
+This is what acs_bufsearch() scans, so it doesn't have to fold
+50,000 unicodes every time you look for a word that isn't there.
+Cells from start up to foldend are current.
+I bring the rest up to date as new output arrives,
+or just before a search in screen mode.
+Don't write into this array.
+
+nl[] is a ring holding the offsets of the newline characters,
+so that start of line, end of line, line number, and goto line
+are binary searches, rather than a walk through the buffer.
+Offsets are relative to nl_base, and wrap around at 64K,
+so when old text scrolls off the back of the buffer
+I only need to drop the newlines that went with it.
+Again, this is maintained for you, up to nlend, and you shouldn't touch it.
+
+tok_back[] and tok_fwd[] break the text into runs,
+a run of letters and digits, or a run of the same punctuation mark,
+and hold the distance from each character back to the start of its run,
+and forward to the end of its run.
+The word functions in section 10 are built on these runs.
+This index is built lazily, the first time you move by words
+after new output arrives.
+
 When in screen mode, v_cursor points to the visual cursor on screen.
 The reading cursor is set to the visual cursor when
 you switch to screen mode, or switch back to that console.
@@ -255,6 +293,8 @@ This is just one more reason you should run in line mode whenever possible.
 
 /* linear log buffer, has to be between 30K and 64K */
 #define TTYLOGSIZE 50000
+/* Must be 64K, the ring indexes are unsigned short and wrap around. */
+#define ACS_NLRING 65536
 
 struct acs_readingBuffer {
 	unsigned int area[TTYLOGSIZE + 2];
@@ -263,6 +303,18 @@ struct acs_readingBuffer {
 	unsigned int *cursor;
 	unsigned int *v_cursor;
 	unsigned int *marks[27+1];
+/* folded shadow of area[], for searching, valid from start up to foldend */
+	char fold[TTYLOGSIZE + 2];
+	unsigned int *foldend;
+/* ring of newline offsets, for line navigation, valid up to nlend */
+	unsigned short nl[ACS_NLRING];
+	unsigned short nl_head, nl_tail, nl_base;
+	unsigned int *nlend;
+/* token runs, for word navigation, valid up to tokend */
+	unsigned short tok_back[TTYLOGSIZE + 2], tok_fwd[TTYLOGSIZE + 2];
+	unsigned int *tokend;
+/* where the escape sequence filter left off, line mode only */
+	unsigned short pp_state, pp_count;
 };
 
 /*********************************************************************
@@ -295,6 +347,10 @@ CRLF - Turn cr lf into lf.
 Other - removes other control characters.
 ESCB - Remove the ANSI escape codes that move the cursor, set attributes, etc.
 These are not text, and can be confusing if mixed into the tty log.
+This includes the control strings, OSC DCS APC and so on,
+that set window titles, hyperlinks, and the like.
+The filter remembers where it is from one batch of output to the next,
+so a sequence that is split across two batches is still removed.
 *********************************************************************/
 
 #define ACS_PP_CTRL_H 0x1
@@ -305,6 +361,18 @@ These are not text, and can be confusing if mixed into the tty log.
 
 extern int acs_postprocess;
 
+/* Ask the driver to do some of this work for you, before the text is logged.
+ * With acs_filter(1), escape sequences, bells, and the cr of cr lf,
+ * as selected by ACS_PP_ESCB, ACS_PP_CTRL_G, and ACS_PP_CRLF,
+ * never reach the driver's buffer, so it holds more history,
+ * and less is copied down to you.
+ * The driver follows acs_postprocess from then on, as you change it;
+ * but what it has thrown away is gone.
+ * The other bits are always done here.
+ * In screen mode the escape sequences and the cr of cr lf are left alone,
+ * because the reprint detector runs them through its model of the screen. */
+int acs_filter(int enabled);
+
 // Clear the buffer, line mode only.
 void acs_clearbuf(void);
 
@@ -325,6 +393,11 @@ Switch between linear and screen mode.
 Linear is the default at startup.
 Returns -1 only if the screen is too big to fit in the static buffer
 that I have set aside for it.
+In screen mode the tty output runs through a virtual terminal in the bridge,
+seeded from screen memory when you enter screen mode or switch consoles.
+Only the cells that actually change are added to the tty log,
+so a shell, an editor, or top, redrawing what is already there,
+does not trigger your more-characters handler again.
 *********************************************************************/
 
 int acs_screenmode(int enabled);
@@ -362,6 +435,10 @@ extern acs_more_handler_t acs_more_h;
 
 int acs_obreak(int gap);
 
+/* Ask the driver to timestamp keystrokes and new output.
+ * See Section 17. */
+int acs_stamps(int enabled);
+
 
 /*********************************************************************
 Section 4: capturing keystrokes.
@@ -737,6 +814,11 @@ void acs_setpunc(unsigned int c, const char *s);
 const char *acs_getpunc(unsigned int c);
 void acs_clearpunc(unsigned int c);
 
+/* This counts up each time a punctuation pronunciation,
+ * or a word in the replacement dictionary below, changes.
+ * If you cache translated text, and I do, flush the cache when it moves. */
+extern unsigned int acs_pron_serial;
+
 /*********************************************************************
 Replace one word with another for improved pronunciation.
 Some synthesizers have on board dictionaries to do this,
@@ -770,6 +852,10 @@ It is of course English centered;
 folks from other countries will need to reimplement this for their locale.
 Note that I require the root word to be replaced with one or more words,
 not punctuation marks etc, so that we can meaningfully put the suffix back on.
+The returned string is scratch space belonging to the calling thread,
+good until that thread calls acs_replace again.
+Replacement, and the utf8 conversions, can run in several threads at once,
+as long as nobody is changing the dictionary at the time.
 *********************************************************************/
 
 unsigned int *acs_replace(const unsigned int *word1, int len);
@@ -968,6 +1054,22 @@ int acs_back(void);
 int acs_startline(void);
 int acs_endline(void);
 
+/*********************************************************************
+Line numbers.  The first line is 1.
+acs_lineno() returns the line containing the temp cursor,
+and acs_linecount() returns the number of lines in the buffer;
+either is 0 if the buffer is empty.
+acs_gotoline() moves the temp cursor to the start of line n,
+and acs_gotocol() moves it to column n of the current line.
+These fail, returning 0, if the line or column does not exist.
+A newline belongs to the line it ends,
+so the last column of a line is its newline character.
+*********************************************************************/
+int acs_lineno(void);
+int acs_linecount(void);
+int acs_gotoline(int n);
+int acs_gotocol(int n);
+
 /*********************************************************************
 Start and end of word.  But word is more like a token.
 don't is a word, even though it contains an apostrophe.
@@ -1001,9 +1103,77 @@ so could be set to work in Spanish, French, etc.
 The second parameter causes the search to run backward or forward.
 The third parameter causes the search to begin on the previous or next line.
 Return 1 if the string is found,
-whereupon the temp cursor points to the start of the string.
+whereupon the temp cursor points to the last character of the string.
+Back up strlen-1 characters to get to the start.
+
+This runs a Boyer-Moore-Horspool scan over the folded shadow buffer
+described in section 3, rather than walking the cursor
+one character at a time.
+
+acs_bufsearch_re() is the same, but the string is an extended
+regular expression, as in egrep.
+It is matched against the folded text, lower case without accents,
+and a match does not span lines.
+^ and $ match at the start and end of each line.
+Again the temp cursor is left on the last character of the match,
+and acs_searchlen holds the length of the match,
+so you can back up to the start.
+Return 0 if the pattern is not found, or is not a valid regular expression,
+in which case errno is set to EINVAL.
 *********************************************************************/
 int acs_bufsearch(const char *string, int back, int newline);
+int acs_bufsearch_re(const char *pattern, int back, int newline);
+extern int acs_searchlen;
+
+/*********************************************************************
+Cursor handles.
+Everything above works on one temp cursor, hidden in the bridge,
+that roams about acs_mb.
+That's fine for the user's reading cursor, but you may want a second reader,
+perhaps a background search, or a prefetch of the next sentence,
+that doesn't disturb the temp cursor.
+So each of these functions is also available on a cursor handle,
+which names its own buffer and position.
+Initialize the handle on a buffer, whence it starts at that buffer's
+reading cursor, then move it about as above.
+The return conventions are the same.
+load and store copy the position from and to the buffer's reading cursor,
+like acs_cursorset() and acs_cursorsync().
+After a successful search, searchlen is the length of the match.
+The functions above are simply these, applied to a default handle
+that follows acs_mb wherever it goes.
+
+A handle doesn't lock anything.
+If new output arrives and the text shifts, your handle does not move with it;
+reload it from the reading cursor or a mark.
+*********************************************************************/
+
+typedef struct acs_cursor {
+	struct acs_readingBuffer *buf;
+	unsigned int *pos;
+	int searchlen;
+} acs_cursor_t;
+
+void acs_cursor_init(acs_cursor_t *c, struct acs_readingBuffer *b);
+void acs_cursor_load(acs_cursor_t *c);
+void acs_cursor_store(const acs_cursor_t *c);
+unsigned int acs_cursor_getc(const acs_cursor_t *c);
+int acs_cursor_forward(acs_cursor_t *c);
+int acs_cursor_back(acs_cursor_t *c);
+int acs_cursor_startline(acs_cursor_t *c);
+int acs_cursor_endline(acs_cursor_t *c);
+int acs_cursor_lineno(const acs_cursor_t *c);
+int acs_cursor_linecount(const acs_cursor_t *c);
+int acs_cursor_gotoline(acs_cursor_t *c, int n);
+int acs_cursor_gotocol(acs_cursor_t *c, int n);
+int acs_cursor_startword(acs_cursor_t *c);
+int acs_cursor_endword(acs_cursor_t *c);
+void acs_cursor_startbuf(acs_cursor_t *c);
+void acs_cursor_endbuf(acs_cursor_t *c);
+void acs_cursor_lspc(acs_cursor_t *c);
+void acs_cursor_rspc(acs_cursor_t *c);
+int acs_cursor_search(acs_cursor_t *c, const char *string, int back, int newline);
+int acs_cursor_search_re(acs_cursor_t *c, const char *pattern, int back, int newline);
 
 
 /*********************************************************************
@@ -1118,6 +1288,19 @@ typedef unsigned short acs_ofs_type;
 int acs_getsentence(unsigned int *dest, int destlen,
 		acs_ofs_type *offsets, int properties);
 
+/* The same, but starting at a cursor handle; see section 10. */
+int acs_cursor_getsentence(const acs_cursor_t *c,
+		unsigned int *dest, int destlen,
+		acs_ofs_type *offsets, int properties);
+
+/* The same, but from any null terminated unicode string,
+ * not a reading buffer at all.
+ * This is how you would gather sentences from a document;
+ * it is reentrant, so threads can gather sentences in parallel. */
+int acs_getsentence_uc(const unsigned int *s,
+		unsigned int *dest, int destlen,
+		acs_ofs_type *offsets, int properties);
+
 #define ACS_GS_ONEWORD 0x1
 #define ACS_GS_STOPLINE 0x2
 #define ACS_GS_REPEAT 0x4
@@ -1476,10 +1659,13 @@ Then add new words or cases or code for the new language.
 
 int acs_unilen(const unsigned int *u); // like strlen but for unicodes
 unsigned char *acs_uni2utf8(const unsigned int *unicode_buf); // allocates
+// len unicodes into dest, room for 6*len; returns bytes, not null terminated
+int acs_uni2utf8_n(const unsigned int *s, int len, unsigned char *dest);
+// Malformed utf8, overlong, surrogate, or past 0x10ffff, becomes '?'
 int acs_utf82uni(const unsigned char *utf8_buf, unsigned int *dest);
 // First argument lower utf8, second argument unicode
 int acs_substring_mix(const char *s, const unsigned int *t);
-// convert to utf8 then write to a file
+// convert to utf8 then write to a file, in one system call
 void acs_write_mix(int fd, const unsigned int *s, int len);
 
 int acs_isalpha(unsigned int uc);
@@ -1502,4 +1688,173 @@ void acs_vc(void);
 void acs_screensnap(void);
 
 
+/*********************************************************************
+Section 16: the trace ring.
+The bridge records its events, keystrokes, tty output, index markers,
+reads from the synth, and so on, in a ring of small binary records,
+each with a timestamp and up to three numbers.
+A record costs a clock read and a few stores, no formatting and no io,
+so the ring is on all the time, even when acs_debug is off,
+and it holds the last ACS_TRACE_RECS events when something goes wrong.
+Save it to a file on demand, perhaps from a signal or a fifo command,
+and decode it later with acstrace, in the bridge directory.
+Adapters can record their own events, numbered from ACS_TR_ADAPTER up;
+acstrace prints those as numbers.
+Records are claimed with an atomic increment, so there are no locks,
+and any thread can trace.
+*********************************************************************/
+
+#define ACS_TRACE_RECS 8192 // must be a power of 2
+
+enum {
+ACS_TR_NONE,
+ACS_TR_READ, // bytes read from acsint
+ACS_TR_KEY, // key, shift state
+ACS_TR_FGC, // new foreground console
+ACS_TR_ECHO, // echo, character
+ACS_TR_REFRESH, // refresh requested
+ACS_TR_REFRESHED, // refresh acknowledged
+ACS_TR_NEWCHARS, // count, then the first 8 characters, a byte each
+ACS_TR_REPRINT, // count of characters discarded as a reprint
+ACS_TR_CHANGED, // characters kept, out of how many
+ACS_TR_BADCMD, // unknown command from acsint
+ACS_TR_SYREAD, // bytes read from the synth
+ACS_TR_INDEX, // index marker from the synth
+ACS_TR_SYBYTE, // unknown byte from the synth
+ACS_TR_IMARK, // index marker, offset of the cursor
+ACS_TR_SPOKEN, // last index marker, sentence finished
+ACS_TR_SENT, // sentence sent, markers, last offset
+ACS_TR_SHUTUP,
+ACS_TR_SUSPEND, // keys suspended
+ACS_TR_RESUME, // keys resumed
+ACS_TR_ALLOC, // tty log allocated for this console
+ACS_TR_BRIDGE, // the number of bridge events
+ACS_TR_ADAPTER = 64, // yours start here
+};
+
+struct acs_trace_rec {
+	unsigned long long ns; // CLOCK_MONOTONIC, in nanoseconds
+	unsigned int seq; // records since the program started
+	unsigned short event;
+	unsigned short pad;
+	int a, b, c;
+};
+
+/* a saved trace file is this header, then the records, oldest first */
+struct acs_trace_hdr {
+	char magic[8]; // ACSTRACE
+	unsigned int version; // 1
+	unsigned int recsize; // sizeof(struct acs_trace_rec)
+	unsigned int count;
+	unsigned int pad;
+};
+
+extern int acs_tracing; // 1 by default; set to 0 to stop recording
+void acs_trace(int event, int a, int b, int c);
+// Save the ring to a file, return 0 or -1 with errno set.
+int acs_trace_save(const char *filename);
+// Describe a record in text, without a newline.
+void acs_trace_text(const struct acs_trace_rec *r, char *buf, int buflen);
+
+
+/*********************************************************************
+Section 17: latency histograms.
+How long does it take, from the time you hit a key, or the time
+a program writes to the console, to the time the synthesizer hears about it?
+Turn on timestamps with acs_stamps(1), and the driver tells us
+when each key was struck, and when new output arrived.
+The bridge notes the time again when it acts on the event,
+the adapter calls acs_latency(ACS_LAT_PREP) when its text is ready
+to speak, and the bridge notes the first write to the synth.
+Each stage, measured from the key or the output, goes into a histogram.
+The last key or batch of output is the one being measured;
+if the bridge goes back to waiting for events and nothing was said,
+the measurement is dropped.
+Without timestamps, the event stages are left out,
+and the other stages are measured from the time the bridge saw the event.
+Histogram buckets are powers of 2, in microseconds.
+*********************************************************************/
+
+enum {
+ACS_LAT_KEY, // a keystroke
+ACS_LAT_TTY, // new output on the console
+ACS_LAT_ORIGINS
+};
+
+enum {
+ACS_LAT_EVENT, // the bridge acts on the event
+ACS_LAT_PREP, // the text to speak is ready
+ACS_LAT_SYNTH, // the first byte goes to the synth
+ACS_LAT_STAGES
+};
+
+#define ACS_LAT_BUCKETS 24 // up to 8 seconds
+
+struct acs_latency_hist {
+	unsigned long count;
+	unsigned long long sum; // microseconds
+	unsigned int max;
+	unsigned long bucket[ACS_LAT_BUCKETS]; // bucket k is under 2^k microseconds
+};
+
+extern struct acs_latency_hist acs_lat[ACS_LAT_ORIGINS][ACS_LAT_STAGES];
+
+// The current key or output has reached this stage.
+void acs_latency(int stage);
+// Start timing a key or output; stamp is from the driver, or 0.
+void acs_latency_start(int origin, unsigned long long stamp);
+void acs_latency_reset(void);
+// Write the histograms to a file, as text; return 0 or -1 with errno set.
+int acs_latency_save(const char *filename);
+
+
+/*********************************************************************
+Section 18: capture and profile.
+acs_capture() writes every read from acsint, as it comes,
+with the time it arrived, to a file.
+Play it back with tests/acsreplay, through the bridge alone,
+or through the whole adapter via a socket, as fast as it will go,
+or at the speed it was recorded.
+That way a problem seen once, slow reading after a huge dmesg perhaps,
+can be run again, and profiled, somewhere else.
+Only the events are captured, not /dev/vcsa, so screen mode
+won't see the same screen.
+
+Set acs_profiling and acs_events() adds up the time it spends
+in its parts, in acs_prof.  It costs a few clock reads per event,
+so it is off by default.
+*********************************************************************/
+
+struct acs_capture_hdr {
+	char magic[8]; // ACSCAPT1
+	unsigned int version; // 1
+	unsigned int pad;
+};
+
+/* each read is this record, then len bytes */
+struct acs_capture_rec {
+	unsigned long long ns; // CLOCK_MONOTONIC, in nanoseconds
+	unsigned int len;
+	unsigned int pad;
+};
+
+// Start writing reads to this file, or stop if filename is null.
+// Return 0 or -1 with errno set.
+int acs_capture(const char *filename);
+
+struct acs_profile {
+	unsigned long reads, events;
+	unsigned long long bytes;
+	unsigned long long ns_events; // all of acs_events()
+	unsigned long long ns_postprocess; // cleaning up new output
+	unsigned long long ns_memmove; // sliding the tty log when it overflows
+	unsigned long long ns_handlers; // your key, fgc, and more handlers
+};
+
+extern int acs_profiling;
+extern struct acs_profile acs_prof;
+// Write the profile to a file, as text; return 0 or -1 with errno set.
+int acs_profile_save(const char *filename);
+
+
 #endif
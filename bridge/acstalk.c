@@ -15,6 +15,8 @@ Description: communicate with a synthesizer over a serial port, socket, or pipe.
 #include <unistd.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #include "acsbridge.h"
 
@@ -77,6 +79,75 @@ write(acs_sy_fd1, &kbyte, 1);
 write(acs_sy_fd1, &crbyte, 1);
 }
 
+/*********************************************************************
+Text to be spoken, and its index markers, are gathered here,
+then sent to the synth, along with the return that starts it talking,
+in one system call.
+That is one write instead of one per word, or one per marker.
+The buffer grows as needed, and is kept for the next utterance.
+If it can't grow, what we have is written straight away,
+and so is the piece that didn't fit,
+so the sentence goes out in several writes, as it used to.
+*********************************************************************/
+
+static unsigned char *ut_buf;
+static int ut_len, ut_room;
+
+static int ut_grow(int n)
+{
+unsigned char *p;
+int room;
+if(ut_len + n <= ut_room) return 0;
+room = (ut_len + n) * 2;
+if(room < 256) room = 256;
+p = realloc(ut_buf, room);
+if(!p) return -1;
+ut_buf = p;
+ut_room = room;
+return 0;
+}
+
+static void ut_add(const char *s, int n)
+{
+if(ut_grow(n)) {
+if(ut_len) write(acs_sy_fd1, ut_buf, ut_len);
+ut_len = 0;
+write(acs_sy_fd1, s, n);
+return;
+}
+memcpy(ut_buf + ut_len, s, n);
+ut_len += n;
+}
+
+static void ut_add_uc(const unsigned int *s, int n)
+{
+if(ut_grow(n*6)) {
+if(ut_len) write(acs_sy_fd1, ut_buf, ut_len);
+ut_len = 0;
+acs_write_mix(acs_sy_fd1, s, n);
+return;
+}
+ut_len += acs_uni2utf8_n(s, n, ut_buf + ut_len);
+}
+
+/* Send text, then return, as ss_cr() would, in one writev. */
+static void ss_send(const void *text, int len)
+{
+static const char deccr[] = "\13\r";
+struct iovec iov[2];
+int n = 0;
+if(len) {
+iov[n].iov_base = (void *)text;
+iov[n++].iov_len = len;
+}
+if(acs_style == ACS_SY_STYLE_DECEXP || acs_style == ACS_SY_STYLE_DECPC)
+iov[n].iov_base = (void *)deccr, iov[n++].iov_len = 2;
+else
+iov[n].iov_base = (void *)&crbyte, iov[n++].iov_len = 1;
+acs_latency(ACS_LAT_SYNTH);
+writev(acs_sy_fd1, iov, n);
+}
+
 /* The start of the sentence that is sent with index markers. */
 unsigned int *acs_imark_start;
 
@@ -100,7 +171,7 @@ if(!acs_rb) return;
 if(n < 0 || n >= imark_end) return;
 
 acs_rb->cursor = acs_imark_start + imark_loc[n];
-acs_log("imark %d cursor now base+%d\n", n, imark_loc[n]);
+acs_trace(ACS_TR_IMARK, n, imark_loc[n], 0);
 
 /* should never be past the end of buffer, but let's check */
 if(acs_rb->cursor >= acs_rb->end) {
@@ -112,7 +183,7 @@ acs_log("cursor ran past the end of buffer\n");
 
 if(n == imark_end - 1) {
 /* last index marker, sentence is finished */
-acs_log("sentence spoken\n");
+acs_trace(ACS_TR_SPOKEN, 0, 0, 0);
 acs_imark_start = 0;
 }
 
@@ -244,6 +315,137 @@ close(acs_sy_fd1);
 acs_sy_fd0 = acs_sy_fd1 = -1;
 }
 
+/*********************************************************************
+Latency histograms, see Section 17 in acsbridge.h.
+One key, or one batch of output, is followed at a time.
+lat_t0 is when it happened, by the driver's clock if we have a stamp,
+lat_done says which stages have been recorded,
+and lat_origin is -1 when nothing is being followed.
+*********************************************************************/
+
+struct acs_latency_hist acs_lat[ACS_LAT_ORIGINS][ACS_LAT_STAGES];
+static int lat_origin = -1;
+static unsigned long long lat_t0;
+static char lat_done[ACS_LAT_STAGES];
+
+static const char *const lat_names[ACS_LAT_ORIGINS][ACS_LAT_STAGES] = {
+{"key event", "key prep", "key synth"},
+{"tty event", "tty prep", "tty synth"},
+};
+
+static unsigned long long lat_now(void)
+{
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void lat_record(int stage, unsigned long long now)
+{
+struct acs_latency_hist *h = &acs_lat[lat_origin][stage];
+unsigned int us;
+int k;
+
+lat_done[stage] = 1;
+// a clock from the future, perhaps a suspended laptop; leave it out
+if(now < lat_t0) return;
+now = (now - lat_t0) / 1000;
+us = (now > 0xffffffff ? 0xffffffff : now);
+for(k=0; k<ACS_LAT_BUCKETS-1; ++k)
+if(us < (1u<<k)) break;
+++h->bucket[k];
+++h->count;
+h->sum += us;
+if(us > h->max) h->max = us;
+}
+
+void acs_latency_start(int origin, unsigned long long stamp)
+{
+unsigned long long now = lat_now();
+lat_origin = origin;
+memset(lat_done, 0, sizeof(lat_done));
+lat_t0 = (stamp ? stamp : now);
+if(stamp) lat_record(ACS_LAT_EVENT, now);
+}
+
+void acs_latency(int stage)
+{
+if(lat_origin < 0 || lat_done[stage]) return;
+lat_record(stage, lat_now());
+if(stage == ACS_LAT_SYNTH) lat_origin = -1;
+}
+
+void acs_latency_reset(void)
+{
+memset(acs_lat, 0, sizeof(acs_lat));
+lat_origin = -1;
+}
+
+/* the upper bound of the bucket that holds this fraction of the samples */
+static unsigned int lat_percentile(const struct acs_latency_hist *h, int percent)
+{
+unsigned long want = (h->count * percent + 99) / 100, sum = 0;
+int k;
+for(k=0; k<ACS_LAT_BUCKETS-1; ++k) {
+sum += h->bucket[k];
+if(sum >= want) break;
+}
+if(k == ACS_LAT_BUCKETS-1 || (1u<<k) > h->max) return h->max;
+return 1u<<k;
+}
+
+int acs_latency_save(const char *filename)
+{
+FILE *f;
+const struct acs_latency_hist *h;
+int i, j, k, rc = 0, e;
+
+f = fopen(filename, "w");
+if(!f) return -1;
+
+fprintf(f, "latency in microseconds, percentiles are bucket bounds\n");
+fprintf(f, "from the key or output to the bridge, the preprocessor, and the synth\n");
+fprintf(f, "%-10s %8s %8s %8s %8s %8s %8s\n",
+"", "count", "mean", "50%", "90%", "99%", "max");
+for(i=0; i<ACS_LAT_ORIGINS; ++i)
+for(j=0; j<ACS_LAT_STAGES; ++j) {
+h = &acs_lat[i][j];
+if(!h->count) {
+fprintf(f, "%-10s %8d\n", lat_names[i][j], 0);
+continue;
+}
+fprintf(f, "%-10s %8lu %8llu %8u %8u %8u %8u\n",
+lat_names[i][j], h->count, h->sum / h->count,
+lat_percentile(h, 50), lat_percentile(h, 90),
+lat_percentile(h, 99), h->max);
+}
+
+fprintf(f, "\n%-8s", "under");
+for(i=0; i<ACS_LAT_ORIGINS; ++i)
+for(j=0; j<ACS_LAT_STAGES; ++j)
+fprintf(f, " %9s", lat_names[i][j]);
+fprintf(f, "\n");
+for(k=0; k<ACS_LAT_BUCKETS; ++k) {
+for(i=0; i<ACS_LAT_ORIGINS; ++i)
+for(j=0; j<ACS_LAT_STAGES; ++j)
+if(acs_lat[i][j].bucket[k]) goto print;
+continue;
+print:
+if(k < ACS_LAT_BUCKETS-1) fprintf(f, "%-8u", 1u<<k);
+else fprintf(f, "%-8s", "more");
+for(i=0; i<ACS_LAT_ORIGINS; ++i)
+for(j=0; j<ACS_LAT_STAGES; ++j)
+fprintf(f, " %9lu", acs_lat[i][j].bucket[k]);
+fprintf(f, "\n");
+}
+
+if(ferror(f)) rc = -1;
+e = errno;
+if(fclose(f)) rc = -1, e = errno;
+errno = e;
+return rc;
+}
+
 static fd_set channels;
 
 /*********************************************************************
@@ -268,6 +470,9 @@ int rc;
 int nfds;
 struct timeval now;
 
+/* Going back to sleep; whatever we were timing didn't speak. */
+lat_origin = -1;
+
 memset(&channels, 0, sizeof(channels));
 FD_SET(acs_fd, &channels);
 if(acs_sy_fd0 >= 0)
@@ -304,7 +509,7 @@ return -1;
 }
 
 nr = read(acs_sy_fd0, ss_inbuf+leftover, SSBUFSIZE-leftover);
-acs_log("synth read %d bytes\n", nr);
+acs_trace(ACS_TR_SYREAD, nr, 0, 0);
 if(nr < 0) return -1;
 
 i = 0;
@@ -316,12 +521,12 @@ switch(acs_style) {
 case ACS_SY_STYLE_DOUBLE:
 case ACS_SY_STYLE_ESPEAKUP:
 if(c >= 1 && c <= 99) {
-acs_log("index %d\n", c);
+acs_trace(ACS_TR_INDEX, c, 0, 0);
 indexSet(c);
 ++i;
 continue;
 }
-acs_log("unknown byte %d\n", c);
+acs_trace(ACS_TR_SYBYTE, c, 0, 0);
 ++i;
 break;
 
@@ -331,7 +536,7 @@ if(c == '\33') {
 if(nr-i < 8) break;
 if(!strncmp(ss_inbuf+i, "\33P0;32;", 7)) {
 if(ss_inbuf[i+7] == 'z') {
-acs_log("index %d\n", 0);
+acs_trace(ACS_TR_INDEX, 0, 0, 0);
 indexSet(0);
 i += 8;
 continue;
@@ -339,7 +544,7 @@ continue;
 if(nr-i < 9) break;
 if(ss_inbuf[i+8] == 'z' && isdigit((unsigned char)ss_inbuf[i+7])) {
 c = ss_inbuf[i+7] - '0';
-acs_log("index %d\n", c);
+acs_trace(ACS_TR_INDEX, c, 0, 0);
 indexSet(c);
 i += 9;
 continue;
@@ -348,26 +553,26 @@ if(nr-i < 10) break;
 if(ss_inbuf[i+9] == 'z' && isdigit((unsigned char)ss_inbuf[i+7]) && isdigit((unsigned char)ss_inbuf[i+8])) {
 c = ss_inbuf[i+7] - '0';
 c = 10*c + ss_inbuf[i+8] - '0';
-acs_log("index %d\n", c);
+acs_trace(ACS_TR_INDEX, c, 0, 0);
 indexSet(c);
 i += 10;
 continue;
 }
 }
 }
-acs_log("unknown byte %d\n", c);
+acs_trace(ACS_TR_SYBYTE, c, 0, 0);
 ++i;
 break;
 
 case ACS_SY_STYLE_BNS:
 case ACS_SY_STYLE_ACE:
 if(c == 6) {
-acs_log("index f\n", 0);
+acs_trace(ACS_TR_INDEX, 0, 0, 0);
 indexSet(0);
 ++i;
 continue;
 }
-acs_log("unknown byte %d\n", c);
+acs_trace(ACS_TR_SYBYTE, c, 0, 0);
 ++i;
 break;
 
@@ -398,31 +603,31 @@ if(source&1) acs_events();
 /* string has to be ascii or utf8 */
 void acs_say_string(const char *s)
 {
-int l = strlen(s);
-if(l) write(acs_sy_fd1, s, l);
-ss_cr();
+ss_send(s, strlen(s));
 }
 
 void acs_say_string_n(const char *s)
 {
 int l = strlen(s);
-if(l) write(acs_sy_fd1, s, l);
+if(l) {
+acs_latency(ACS_LAT_SYNTH);
+write(acs_sy_fd1, s, l);
+}
 }
 
 void acs_say_char(unsigned int c)
 {
+unsigned char buf[8];
 const char *s = acs_getpunc(c);
-if(s) acs_say_string_n(s);
-else
-acs_write_mix(acs_sy_fd1, &c, 1);
-ss_cr();
+if(s) ss_send(s, strlen(s));
+else ss_send(buf, acs_uni2utf8_n(&c, 1, buf));
 }
 
 void acs_say_string_uc(const unsigned int *s)
 {
-int l = acs_unilen(s);
-if(l) acs_write_mix(acs_sy_fd1, s, l);
-ss_cr();
+ut_len = 0;
+ut_add_uc(s, acs_unilen(s));
+ss_send(ut_buf, ut_len);
 }
 
 void acs_say_indexed(const unsigned int *s, const acs_ofs_type *o, int mark)
@@ -438,12 +643,13 @@ imark_end = 0;
 if(acs_style == ACS_SY_STYLE_BNS || acs_style == ACS_SY_STYLE_ACE) mark = 0;
 imark_first = mark;
 
+ut_len = 0;
 t = s;
 while(1) {
 if(*o && mark >= 0 && mark <= 100) { // mark here
 // have to send the prior word
 if(s > t)
-acs_write_mix(acs_sy_fd1, t, s-t);
+ut_add_uc(t, s-t);
 t = s;
 // set the index marker
 imark_loc[imark_end++] = *o;
@@ -473,7 +679,7 @@ sprintf(ibuf, "[:i r %d]", mark);
 break;
 } // switch
 if(ibuf[0])
-write(acs_sy_fd1, ibuf, strlen(ibuf));
+ut_add(ibuf, strlen(ibuf));
 ++mark;
 }
 if(!*s) break;
@@ -484,10 +690,10 @@ if(!*s) break;
  * so there should be nothing else to send.
  * But just in case ... */
 if(s > t)
-acs_write_mix(acs_sy_fd1, t, s-t);
+ut_add_uc(t, s-t);
 
-ss_cr();
-acs_log("sent %d markers, last offset %d\n", imark_end, imark_loc[imark_end-1]);
+ss_send(ut_buf, ut_len);
+acs_trace(ACS_TR_SENT, imark_end, (imark_end ? imark_loc[imark_end-1] : 0), 0);
 }
 
 void acs_shutup(void)
@@ -510,7 +716,7 @@ write(acs_sy_fd1, &ibyte, 1);
 
 acs_imark_start = 0;
 bnsf = 0;
-acs_log("shutup\n");
+acs_trace(ACS_TR_SHUTUP, 0, 0, 0);
 }
 
 static void
@@ -0,0 +1,66 @@
+/*********************************************************************
+File: acstrace.c
+Description: decode a trace saved by acs_trace_save().
+Each record is printed on a line: seconds since the first record,
+seconds since the one before it, and what happened.
+
+	acstrace /var/log/acstrace
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acsbridge.h"
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	struct acs_trace_hdr hdr;
+	struct acs_trace_rec r;
+	unsigned long long first = 0, last = 0;
+	unsigned int i, lastseq = 0;
+	char line[120];
+
+	if(argc != 2) {
+		fprintf(stderr, "usage: acstrace tracefile\n");
+		exit(1);
+	}
+
+	f = fopen(argv[1], "r");
+	if(!f) {
+		perror(argv[1]);
+		exit(1);
+	}
+
+	if(fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	memcmp(hdr.magic, "ACSTRACE", 8) || hdr.version != 1) {
+		fprintf(stderr, "%s is not an acsint trace\n", argv[1]);
+		exit(1);
+	}
+	if(hdr.recsize != sizeof(r)) {
+		fprintf(stderr, "%s was written by a different build, records of %u bytes\n",
+			argv[1], hdr.recsize);
+		exit(1);
+	}
+
+	for(i=0; i<hdr.count; ++i) {
+		if(fread(&r, sizeof(r), 1, f) != 1) {
+			fprintf(stderr, "%s is cut short, %u of %u records\n",
+				argv[1], i, hdr.count);
+			exit(1);
+		}
+		if(!i)
+			first = last = r.ns;
+		else if(r.seq != lastseq + 1)
+			printf("... %u records lost\n", r.seq - lastseq - 1);
+		acs_trace_text(&r, line, sizeof(line));
+		printf("%12.6f %+10.6f %s\n",
+		       (r.ns - first) / 1e9, (r.ns - last) / 1e9, line);
+		last = r.ns;
+		lastseq = r.seq;
+	}
+
+	fclose(f);
+	return 0;
+}
@@ -15,14 +15,21 @@
 #include <linux/interrupt.h>
 #include <linux/sched.h>
 #include <linux/wait.h>
+#include <linux/mutex.h>
 #include <linux/tty_flip.h>
 #include <linux/miscdevice.h>
 #include <linux/version.h>
 #include <linux/poll.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "ttyclicks.h"
 #include "acsint.h"
 
+#define CREATE_TRACE_POINTS
+#include "acsint_trace.h"
+
 #define ACS_DEVICE "/dev/acsint"
 
 MODULE_LICENSE("GPL");
@@ -38,15 +45,13 @@ MODULE_PARM_DESC(major,
 /* For various critical sections of code. */
 static DEFINE_SPINLOCK(acslock);
 
-/* circular buffer of output characters received from the tty */
+/* circular buffer of output characters received from the tty.
+ * There is one per console, no matter how many processes are reading;
+ * each reader keeps its own place in it, see struct reader below. */
 struct cbuf {
 	unsigned int area[65536];
 	unsigned int *start, *end;
 	unsigned int *head, *tail;
-/* mark the place where we last copied data to user space */
-	unsigned int *mark;
-/* Mark the point where we last saw an echo character */
-	unsigned int *echopoint;
 };
 
 /* These are allocated, one per console, as needed. */
@@ -56,18 +61,63 @@ static struct cbuf *cbuf_tty[MAX_NR_CONSOLES];
 static const char cb_nomem_message[] =
     "Kernel cannot allocate space for this console";
 
-/* set to 1 if you have sent the above nomem message down to the user */
-static unsigned char cb_nomem_refresh[MAX_NR_CONSOLES];
-
 /* set to 1 if you have tried to allocate */
 static unsigned char cb_nomem_alloc[MAX_NR_CONSOLES];
 
 /* Staging area to copy tty data down to user space */
 /* This is a snapshot of the circular buffer. */
+/* It is too big for the stack, so the readers take turns with it. */
 static unsigned int cb_staging[65536];
+static DEFINE_MUTEX(staging_mutex);
 
+/* The array "rbuf" is used for passing key/tty events to user space.
+ * A reading buffer of sorts.  See device_read() below.
+ * Despite the names head and tail, it's not a true circular buffer.
+ * The process has to read the data before rbuf_head reaches the end,
+ * or data is lost.
+ * That's not a problem, because you just can't type faster
+ * than the daemon can gather up those keystrokes.
+ * Every event is 4 bytes, except echo, which is 8.
+ * Thus everything stays 4 byte aligned.
+ * This is necessary to pass down unicodes.
+ */
+
+#define RBUF_LEN 400
+
+/* Several processes can have the device open at once,
+ * a speech adapter, a braille driver, a logger.
+ * Each one has its own events, and its own place in each console's output.
+ * The output itself is logged once, in struct cbuf, and shared.
+ * The first to open, when nobody else owns the keys, is the primary reader.
+ * It captures keys, and sets the keyboard and sound modes.
+ * The others see the output, and console switches, and keys that are
+ * echoed back, but they can't take keys away from the console. */
+#define ACS_MAX_READERS 8
+
+struct reader {
+	char rbuf[RBUF_LEN];	/* first, so it stays 4 byte aligned */
+	char *rbuf_tail, *rbuf_head;
+/* Wait until this reader has some data to read. */
+	wait_queue_head_t wq;
+/* mark the place where we last copied data to user space */
+	unsigned int *mark[MAX_NR_CONSOLES];
+/* Mark the point where we last saw an echo character */
+	unsigned int *echopoint[MAX_NR_CONSOLES];
+/* set to 1 if you have sent the nomem message down to this reader */
+	unsigned char nomem_refresh[MAX_NR_CONSOLES];
 /* size of userland buffer; characters will copy from staging to this buffer */
-static int user_bufsize = 256;
+	int bufsize;
+/* Timestamps for latency measurements, see ACS_STAMPS.
+ * tty_stamp is the time of the oldest output on that console
+ * that has not been passed down, 0 if there is none. */
+	bool stamps;
+	u64 tty_stamp[MAX_NR_CONSOLES];
+};
+
+/* The readers, in no particular order; changed under acslock. */
+static struct reader *readers[ACS_MAX_READERS];
+static int nreaders;
+static struct reader *primary;	/* owns the keys, or 0 if nobody does */
 
 /* jiffies value for the last output character. */
 /* This is reset if the last output character is echo. */
@@ -75,6 +125,27 @@ static unsigned long last_oj;
 /* How many tenths of a second separate one burst of output from the next? */
 static int outputbreak = 5;
 
+/* Counters, since the module was loaded, for sizing the buffers and
+ * outputbreak, and for noticing when data is lost.
+ * They are read through debugfs, see acsint.txt.
+ * Most are bumped under acslock; an odd miscount in a statistic is harmless. */
+static struct {
+	unsigned long reads;		/* calls to device_read */
+	unsigned long wakeups;		/* wakes of the reader */
+	unsigned long rbuf_drops;	/* events lost, rbuf was full */
+	unsigned long keys;		/* keystrokes passed to user space */
+	unsigned long catchup_bytes;	/* tty text copied to user space */
+	unsigned long catchup_trimmed;	/* characters over bufsize, not passed */
+	unsigned long echo_match;	/* output characters that were echo */
+	unsigned long echo_miss;	/* keys pending, but the output didn't match */
+	unsigned long echo_expired;	/* keys that never came back */
+	unsigned long tty_chars[MAX_NR_CONSOLES];	/* characters logged */
+	unsigned long tty_drops[MAX_NR_CONSOLES];	/* pushed off the back of cbuf */
+	unsigned long filtered;		/* kept out of cbuf by the output filter */
+} stats;
+
+static struct dentry *debug_dir;
+
 /* Initialize / reset the variables in the circular buffer. */
 static void cb_reset(struct cbuf *cb)
 {
@@ -84,8 +155,6 @@ static void cb_reset(struct cbuf *cb)
 	cb->end = cb->area + 65536;
 	cb->head = cb->start;
 	cb->tail = cb->start;
-	cb->mark = cb->start;
-	cb->echopoint = 0;
 }
 
 /* check to see if the circular buffer was allocated. */
@@ -110,27 +179,205 @@ static void checkAlloc(int mino, bool from_vt)
 }
 
 /* Put a character on the end of the circular buffer.
- * Drop the oldest character if the buffer is full.
- * This is called under a spinlock, so we don't have to worry about the reader
+ * Drop the oldest character if the buffer is full, and return true.
+ * This is called under a spinlock, so we don't have to worry about the readers
  * draining characters while this routine adds characters on. */
-static void cb_append(struct cbuf *cb, unsigned int c)
+static bool cb_append(struct cbuf *cb, int mino, unsigned int c)
 {
+	struct reader *r;
+	int j;
+
 	if (!cb)
-		return;		/* should never happen */
+		return false;		/* should never happen */
 	*cb->head = c;
 	++cb->head;
 	if (cb->head == cb->end)
 		cb->head = cb->start;
 	if (cb->head == cb->tail) {
 		/* buffer full, drop the last character */
-		if (cb->tail == cb->mark)
-			cb->mark = 0;
-		if (cb->tail == cb->echopoint)
-			cb->echopoint = 0;
+		for (j = 0; j < ACS_MAX_READERS; ++j) {
+			r = readers[j];
+			if (!r)
+				continue;
+			if (r->mark[mino] == cb->tail)
+				r->mark[mino] = 0;
+			if (r->echopoint[mino] == cb->tail)
+				r->echopoint[mino] = 0;
+		}
 		++cb->tail;
 		if (cb->tail == cb->end)
 			cb->tail = cb->start;
+		return true;
+	}
+	return false;
+}
+
+/* The output filter, see ACS_FILTER in acsint.txt.
+ * It throws away what postprocess() in the bridge would throw away,
+ * escape sequences, bells, the cr of cr lf,
+ * before it takes up room in the buffer, or is copied down to user space.
+ * The parser state is per console, because a sequence can be cut off
+ * by a switch to another console, and resume when you switch back. */
+#define FILT_GROUND 0
+#define FILT_ESC 1
+#define FILT_CSI 2
+#define FILT_STRING 3
+#define FILT_STRING_ESC 4
+/* Give up on a sequence that never ends, and let the text through. */
+#define FILT_CSIMAX 64
+#define FILT_STRINGMAX 4096
+
+struct filter {
+	unsigned char flags;	/* ACS_FILTER bits, 0 for no filtering */
+	unsigned char state;
+	unsigned short count;	/* length of the sequence so far */
+};
+static struct filter filters[MAX_NR_CONSOLES];
+
+/* Does the filter keep this character out of the log?
+ * This is called under acslock. */
+static bool filter_out(int mino, unsigned int c)
+{
+	struct filter *f = filters + mino;
+
+	if (!f->flags)
+		return false;
+
+again:
+	if (f->state != FILT_GROUND) {
+		if (c == 0x18 || c == 0x1a) {	/* cancel */
+			f->state = FILT_GROUND;
+			return true;
+		}
+
+		switch (f->state) {
+		case FILT_ESC:
+			if (c == '\033')
+				return true;
+			if (c == '[') {
+				f->state = FILT_CSI;
+				f->count = 0;
+				return true;
+			}
+			if (c == ']' || c == 'P' || c == 'X' || c == '^' ||
+			    c == '_') {
+				f->state = FILT_STRING;
+				f->count = 0;
+				return true;
+			}
+			/* intermediate bytes, as in esc ( B */
+			if (c >= 0x20 && c <= 0x2f)
+				return true;
+			/* final byte, as in esc 7 or esc M */
+			if (c >= 0x30 && c <= 0x7e) {
+				f->state = FILT_GROUND;
+				return true;
+			}
+			break;
+
+		case FILT_CSI:
+			if (c >= 0x20 && c <= 0x3f) {
+				if (++f->count == FILT_CSIMAX)
+					f->state = FILT_GROUND;
+				return true;
+			}
+			if (c >= 0x40 && c <= 0x7e) {
+				f->state = FILT_GROUND;
+				return true;
+			}
+			if (c == '\033') {
+				f->state = FILT_ESC;
+				return true;
+			}
+			break;
+
+		case FILT_STRING:
+			if (c == '\007' || c == 0x9c) {
+				f->state = FILT_GROUND;
+				return true;
+			}
+			if (c == '\033')
+				f->state = FILT_STRING_ESC;
+			else if (++f->count == FILT_STRINGMAX)
+				f->state = FILT_GROUND;
+			return true;
+
+		case FILT_STRING_ESC:
+			if (c == '\\') {	/* string terminator */
+				f->state = FILT_GROUND;
+				return true;
+			}
+			/* Some other escape sequence ends the string. */
+			f->state = FILT_ESC;
+			goto again;
+		}
+
+/* Something that doesn't belong in the sequence.
+ * A control character is logged, as a terminal would act on it,
+ * and the sequence continues; anything else ends the sequence. */
+		if (c >= ' ')
+			f->state = FILT_GROUND;
+	}
+
+/* ansi escape sequences, and their 8 bit forms */
+	if (f->flags & ACS_FILTER_ESC) {
+		if (c == '\033') {
+			f->state = FILT_ESC;
+			return true;
+		}
+		if (c == 0x9b) {
+			f->state = FILT_CSI;
+			f->count = 0;
+			return true;
+		}
+		if (c == 0x90 || c == 0x98 || c == 0x9d || c == 0x9e ||
+		    c == 0x9f) {
+			f->state = FILT_STRING;
+			f->count = 0;
+			return true;
+		}
 	}
+
+	if (c == '\007' && f->flags & ACS_FILTER_BELL)
+		return true;
+
+	return false;
+}				/* filter_out */
+
+/* Set the filter on one console, by minor number, or on all of them if 0.
+ * A sequence in progress is forgotten. */
+static void set_filter(int minor, int flags)
+{
+	int j;
+
+	spin_lock_irq(&acslock);
+	for (j = 0; j < MAX_NR_CONSOLES; ++j) {
+		if (minor && j != minor - 1)
+			continue;
+		filters[j].flags = flags;
+		filters[j].state = FILT_GROUND;
+	}
+	spin_unlock_irq(&acslock);
+}
+
+/* The filter turns cr lf into lf by writing the lf over the cr,
+ * if the cr is still in the buffer and no reader has copied it down.
+ * Return true if it did.  This is called under acslock. */
+static bool cb_crlf(struct cbuf *cb, int mino)
+{
+	unsigned int *last;
+	int j;
+
+	if (cb->head == cb->tail)
+		return false;
+	last = (cb->head == cb->start ? cb->end : cb->head) - 1;
+	if (*last != '\r')
+		return false;
+	for (j = 0; j < ACS_MAX_READERS; ++j)
+		if (readers[j] && readers[j]->mark[mino] == cb->head)
+			return false;
+	*last = '\n';
+	return true;
 }
 
 /* Indicate which keys, by key code, are meta.  For example,
@@ -200,29 +447,50 @@ static bool key_monitor;
 /* pass the next key through to the console. */
 static bool key_bypass;
 
-/* The array "rbuf" is used for passing key/tty events to user space.
- * A reading buffer of sorts.  See device_read() below.
- * Despite the names head and tail, it's not a true circular buffer.
- * The process has to read the data before rbuf_head reaches rbuf_end,
- * or data is lost.
- * That's not a problem, because you just can't type faster
- * than the daemon can gather up those keystrokes.
- * Every event is 4 bytes, except echo, which is 8.
- * Thus everything stays 4 byte aligned.
- * This is necessary to pass down unicodes.
- */
+/* Is there room in this reader's rbuf for n more bytes? */
+static bool rbuf_room(struct reader *r, int n)
+{
+	return r->rbuf_head <= r->rbuf + RBUF_LEN - n;
+}
 
-#define RBUF_LEN 400
-static char rbuf[RBUF_LEN];
-static const char *rbuf_end = rbuf + RBUF_LEN;
-static char *rbuf_tail, *rbuf_head;
+/* Wake the reader, when rbuf goes from empty to not empty. */
+static void rbuf_wake(struct reader *r)
+{
+	++stats.wakeups;
+	wake_up_interruptible(&r->wq);
+}
 
-/* Wait until this driver has some data to read. */
-DECLARE_WAIT_QUEUE_HEAD(wq);
+/* Put a 4 byte event, such as FGC or REFRESH, in a reader's rbuf.
+ * This is called under acslock. */
+static void rbuf_post(struct reader *r, char cmd, char arg)
+{
+	bool wake;
+
+	if (!rbuf_room(r, 4)) {
+		++stats.rbuf_drops;
+		return;
+	}
+	wake = (r->rbuf_head == r->rbuf_tail);
+	r->rbuf_head[0] = cmd;
+	r->rbuf_head[1] = arg;
+	r->rbuf_head[2] = r->rbuf_head[3] = 0;
+	r->rbuf_head += 4;
+	if (wake)
+		rbuf_wake(r);
+}
 
-static bool in_use;		/* only one process opens this device at a time */
 static int last_fgc;		/* last fg_console */
 
+/* Write a 12 byte ACS_STAMP event, the time in nanoseconds,
+ * on the monotonic clock, as a native u64 after the 4 byte header.
+ * It goes just before the event it belongs to. */
+static void put_stamp(char *where, u64 ns)
+{
+	where[0] = ACS_STAMP;
+	where[1] = where[2] = where[3] = 0;
+	memcpy(where + 4, &ns, 8);
+}
+
 /* Push characters onto the input queue of the foreground tty.
  * This is for macros, or cut&paste. */
 static void tty_pushstring(const char *cp, int len)
@@ -243,49 +511,111 @@ static void tty_pushstring(const char *cp, int len)
 
 /* File operations for /dev/acsint. */
 
+/* The keyboard belongs to the console again, as though nobody were reading. */
+static void reset_keys(void)
+{
+	reset_meta();
+	clear_keys();
+	key_divert = false;
+	key_monitor = false;
+	key_bypass = false;
+}
+
 static int device_open(struct inode *inode, struct file *file)
 {
-	int j;
+	struct reader *r;
+	struct cbuf *cb;
+	int j, slot;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+	init_waitqueue_head(&r->wq);
+	r->bufsize = 256;
 
-/* A theoretical race condition here; too unlikely for me to worry about. */
-	if (in_use)
+	spin_lock_irq(&acslock);
+
+	for (slot = 0; slot < ACS_MAX_READERS; ++slot)
+		if (!readers[slot])
+			break;
+	if (slot == ACS_MAX_READERS) {
+		spin_unlock_irq(&acslock);
+		kfree(r);
 		return -EBUSY;
+	}
 
+/* The first reader starts with empty buffers, and another try at
+ * allocating them; the others join in where the output is now. */
+	if (!nreaders) {
+		for (j = 0; j < MAX_NR_CONSOLES; ++j) {
+			cb_reset(cbuf_tty[j]);
+			cb_nomem_alloc[j] = 0;
+			filters[j].flags = 0;
+			filters[j].state = FILT_GROUND;
+		}
+		last_fgc = fg_console;
+	}
 	for (j = 0; j < MAX_NR_CONSOLES; ++j) {
-		cb_reset(cbuf_tty[j]);
-		cb_nomem_refresh[j] = 0;
-		cb_nomem_alloc[j] = 0;
+		cb = cbuf_tty[j];
+		r->mark[j] = (cb ? cb->head : 0);
 	}
 
-	reset_meta();
-	clear_keys();
-	key_divert = false;
-	key_monitor = false;
-	key_bypass = false;
+	if (!primary) {
+		primary = r;
+		reset_keys();
+	}
 
 /* At startup we tell the process which virtual console it is on.
  * Place this directive in rbuf to be read. */
-	rbuf[0] = ACS_FGC;
-	rbuf[1] = fg_console + 1;	/* minor number */
-	rbuf_tail = rbuf;
-	rbuf_head = rbuf + 4;
-	last_fgc = fg_console;
-	checkAlloc(fg_console, false);
+	r->rbuf_tail = r->rbuf_head = r->rbuf;
+	rbuf_post(r, ACS_FGC, fg_console + 1);	/* minor number */
 
-	in_use = true;
+	readers[slot] = r;
+	++nreaders;
+	spin_unlock_irq(&acslock);
+
+	file->private_data = r;
+	checkAlloc(fg_console, false);
 	return 0;
 }
 
+/* Is there output on the foreground console that hasn't been passed down
+ * to this reader, or a nomem message that hasn't been sent?
+ * A nonblocking reader can pick it up without waiting for an event. */
+static bool catchup_pending(struct reader *r)
+{
+	struct cbuf *cb = cbuf_tty[fg_console];
+
+	if (!cb)
+		return !r->nomem_refresh[fg_console];
+	return cb->head != r->mark[fg_console];
+}
+
 static int device_close(struct inode *inode, struct file *file)
 {
-	in_use = false;
-	rbuf_head = rbuf_tail = rbuf;
+	struct reader *r = file->private_data;
+	int j;
+
+	spin_lock_irq(&acslock);
+	for (j = 0; j < ACS_MAX_READERS; ++j)
+		if (readers[j] == r)
+			readers[j] = 0;
+	--nreaders;
+/* The keys go back to the console; the next reader to open takes them. */
+	if (primary == r) {
+		primary = 0;
+		reset_keys();
+	}
+	spin_unlock_irq(&acslock);
+
+	kfree(r);
 	return 0;
 }
 
 static ssize_t device_read(struct file *file, char *buf, size_t len,
 			   loff_t * offset)
 {
+	struct reader *r = file->private_data;
 	int bytes_read = 0;
 	struct cbuf *cb;
 	bool catchup;
@@ -293,33 +623,51 @@ static ssize_t device_read(struct file *file, char *buf, size_t len,
 /* catch up length - how many characters to copy down to user space */
 	int culen = 0;
 	unsigned int *cup = 0;	/* the catchup poin */
+	unsigned int *mark;
 	char *temp_head, *temp_tail, *t;
 	int j, j2;
 	int retval;
-
-	if (!in_use)
-		return 0;	/* should never happen */
+	bool nonblock = (file->f_flags & O_NONBLOCK) != 0;
+	u64 stamp = 0;		/* when the catch up text arrived */
+	u64 copy_start = 0;	/* for the catchup tracepoint */
+	int trimmed = 0;
 
 // Some day: use wait_event_interruptible_locked_irq and wake_up_locked
 
-	retval = wait_event_interruptible(wq, (rbuf_head > rbuf_tail));
-	if (retval)
-		return retval;
+/* A nonblocking reader gets the new output even if there is no event,
+ * since it asked for it; a blocking reader waits for an event as always. */
+	if (nonblock) {
+		if (r->rbuf_head == r->rbuf_tail && !catchup_pending(r))
+			return -EAGAIN;
+	} else {
+		retval = wait_event_interruptible(r->wq,
+						  (r->rbuf_head > r->rbuf_tail));
+		if (retval)
+			return retval;
+	}
+	++stats.reads;
+
+/* Only one reader at a time can use the staging area. */
+	mutex_lock(&staging_mutex);
 
 /* you can only read on behalf of the foreground console */
 	cb = cbuf_tty[fg_console];
 
 /* Use temp pointers, more keystrokes could be appended while
  * we're doing this; that's ok. */
-	temp_head = rbuf_head;
-	temp_tail = rbuf_tail;
+	temp_head = r->rbuf_head;
+	temp_tail = r->rbuf_tail;
 
-/* Skip ahead to the last FGC event if present. */
+/* Skip ahead to the last FGC event if present.
+ * Step over the payload of the longer events;
+ * the character after MORECHARS could look like a command. */
 	for (t = temp_tail; t < temp_head; t += 4) {
 		if (*t == ACS_FGC)
 			temp_tail = t;
-		if (*t == ACS_TTY_MORECHARS)
+		else if (*t == ACS_TTY_MORECHARS)
 			t += 4;
+		else if (*t == ACS_STAMP)
+			t += 8;
 	}
 
 	spin_lock_irq(&acslock);
@@ -328,8 +676,7 @@ static ssize_t device_read(struct file *file, char *buf, size_t len,
 	catchup_head = false;
 	catchup_echo = false;
 
-	if ((!cb && !cb_nomem_refresh[fg_console]) ||
-	    (cb && cb->head != cb->mark)) {
+	if (catchup_pending(r)) {
 		/* MORECHARS echo 0 doesn't force us to catch up,
 		 * but anything else does.
 		 * echo forces a catch up to the echopoint.
@@ -341,49 +688,60 @@ static ssize_t device_read(struct file *file, char *buf, size_t len,
 					catchup_echo = true;
 				continue;
 			}
+			/* a stamp goes with the event after it */
+			if (*t == ACS_STAMP) {
+				t += 8;
+				continue;
+			}
 			catchup_head = true;
 			break;
 		}
+		/* a nonblocking reader wants everything that is there */
+		if (nonblock)
+			catchup_head = true;
 	}
 
-	if (catchup_echo && cb->echopoint)
-		catchup = true, cup = cb->echopoint;
+	if (catchup_echo && cb && r->echopoint[fg_console])
+		catchup = true, cup = r->echopoint[fg_console];
 
 	if (catchup_head)
-		catchup = true, cup = cb->head;
+		catchup = true, cup = (cb ? cb->head : 0);
 
 	if (catchup) {
+		copy_start = ktime_to_ns(ktime_get());
+		mark = r->mark[fg_console];
 		if (cb) {
-			if (cb->mark == 0)
-				cb->mark = cb->tail;
-			if (cup >= cb->mark)
-				culen = cup - cb->mark;
+			if (mark == 0)
+				mark = cb->tail;
+			if (cup >= mark)
+				culen = cup - mark;
 			else
-				culen =
-				    (cb->end - cb->mark) + (cup - cb->start);
+				culen = (cb->end - mark) + (cup - cb->start);
 		} else {
 			culen = sizeof(cb_nomem_message) - 1;
 		}
 
 		if (cb) {
 			/* One chunk or two. */
-			if (cup >= cb->mark) {
+			if (cup >= mark) {
 				if (culen)
-					memcpy(cb_staging, cb->mark, culen * 4);
+					memcpy(cb_staging, mark, culen * 4);
 			} else {
-				j = cb->end - cb->mark;
-				memcpy(cb_staging, cb->mark, j * 4);
+				j = cb->end - mark;
+				memcpy(cb_staging, mark, j * 4);
 				j2 = cup - cb->start;
 				if (j2)
 					memcpy(cb_staging + j, cb->start,
 					       j2 * 4);
 			}
-			cb->mark = cup;
-			cb->echopoint = 0;
+			r->mark[fg_console] = cup;
+			r->echopoint[fg_console] = 0;
+			stamp = r->tty_stamp[fg_console];
+			r->tty_stamp[fg_console] = 0;
 		} else {
 			for (j = 0; j < culen; ++j)
 				cb_staging[j] = cb_nomem_message[j];
-			cb_nomem_refresh[fg_console] = 1;
+			r->nomem_refresh[fg_console] = 1;
 		}
 	}
 
@@ -391,9 +749,9 @@ static ssize_t device_read(struct file *file, char *buf, size_t len,
 
 /* Now pass down the events. */
 /* First fgc, then catch up, then the rest. */
-	if (*temp_tail == ACS_FGC && len >= 4) {
+	if (temp_tail < temp_head && *temp_tail == ACS_FGC && len >= 4) {
 		if (copy_to_user(buf, temp_tail, 4))
-			return -EFAULT;
+			goto fault;
 		temp_tail += 4;
 		bytes_read += 4;
 		buf += 4;
@@ -403,24 +761,41 @@ static ssize_t device_read(struct file *file, char *buf, size_t len,
 	if (catchup) {
 		cup = cb_staging;
 /* ratchet culen down to the size of the userland buffer */
-		if (culen > user_bufsize) {
-			j = culen - user_bufsize;
+		if (culen > r->bufsize) {
+			j = culen - r->bufsize;
 			cup += j, culen -= j;
+			stats.catchup_trimmed += j;
+			trimmed = j;
 		}
 	}
 
-	if (catchup && len >= (culen + 1) * 4) {
+	if (!r->stamps)
+		stamp = 0;
+
+	if (catchup && len >= (culen + 1) * 4 + (stamp ? 12 : 0)) {
 		char cu_cmd[4];	/* the catch up command */
+		if (stamp) {
+			char st_cmd[12];
+			put_stamp(st_cmd, stamp);
+			if (copy_to_user(buf, st_cmd, 12))
+				goto fault;
+			bytes_read += 12;
+			buf += 12;
+			len -= 12;
+		}
 		cu_cmd[0] = ACS_TTY_NEWCHARS;
 /* Put in the minor number here, though I don't think we need it. */
 		cu_cmd[1] = fg_console + 1;
 		cu_cmd[2] = culen;
 		cu_cmd[3] = (culen >> 8);
 		if (copy_to_user(buf, cu_cmd, 4))
-			return -EFAULT;
+			goto fault;
 
 		if (culen && copy_to_user(buf + 4, cup, culen * 4))
-			return -EFAULT;
+			goto fault;
+		stats.catchup_bytes += culen * 4;
+		trace_acsint_catchup(fg_console, culen, trimmed,
+				     ktime_to_ns(ktime_get()) - copy_start);
 		bytes_read += (culen + 1) * 4;
 		buf += (culen + 1) * 4;
 		len -= (culen + 1) * 4;
@@ -432,45 +807,59 @@ static ssize_t device_read(struct file *file, char *buf, size_t len,
 		j = len;	/* should never happen */
 	if (j) {
 		if (copy_to_user(buf, temp_tail, j))
-			return -EFAULT;
+			goto fault;
 		temp_tail += j;
 		buf += j;
 		bytes_read += j;
 		len -= j;
 	}
 
+	mutex_unlock(&staging_mutex);
+
 /* Pull the pointers back to start. */
 /* This should happen almost every time. */
 	spin_lock_irq(&acslock);
-	rbuf_tail = temp_tail;
-	if (rbuf_head == rbuf_tail)
-		rbuf_head = rbuf_tail = rbuf;
+	r->rbuf_tail = temp_tail;
+	if (r->rbuf_head == r->rbuf_tail)
+		r->rbuf_head = r->rbuf_tail = r->rbuf;
 	spin_unlock_irq(&acslock);
 
 	*offset += bytes_read;
 	return bytes_read;
+
+fault:
+	mutex_unlock(&staging_mutex);
+	return -EFAULT;
 }				/* device_read */
 
 static ssize_t device_write(struct file *file, const char *buf, size_t len,
 			    loff_t * offset)
 {
+	struct reader *r = file->private_data;
+	bool owner;		/* this is the primary reader */
 	char c;
 	const char *p = buf;
 	int j, key, shiftstate, teebit, bytes_write;
 	int nn;			/* number of notes */
 	short notes[2 * (10 + 1)];
 	int isize;		/* size of input to inject */
+	int minor;
 	int f1, f2, step, duration;	/* for kd_mksteps */
 
-	if (!in_use)
-		return 0;	/* should never happen */
+/* The keyboard and sound modes belong to the primary reader.
+ * Other readers can send those commands, and we step over them,
+ * but nothing changes. */
+	owner = (r == primary);
 
 	while (len) {
 		get_user(c, p++);
 		len--;
+		trace_acsint_command(c, len);
 
 		switch (c) {
 		case ACS_CLEAR_KEYS:
+			if (!owner)
+				break;
 			clear_keys();
 			reset_meta();
 			break;
@@ -483,7 +872,7 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 			len--;
 			get_user(shiftstate, p++);
 			len--;
-			if (key < ACS_NUM_KEYS) {
+			if (owner && key < ACS_NUM_KEYS) {
 				teebit = (shiftstate & ACS_KEY_T);
 				shiftstate &= 0xf;
 				capture[key] |=
@@ -505,7 +894,7 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 			len--;
 			get_user(shiftstate, p++);
 			len--;
-			if (key < ACS_NUM_KEYS) {
+			if (owner && key < ACS_NUM_KEYS) {
 				passt[key] = 0;
 				shiftstate &= 0xf;
 				capture[key] &=
@@ -521,7 +910,7 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 			len--;
 			get_user(c, p++);
 			len--;
-			if (key < ACS_NUM_KEYS)
+			if (owner && key < ACS_NUM_KEYS)
 				ismeta[key] = (unsigned char)c;
 			break;
 
@@ -538,7 +927,8 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 				break;
 			get_user(c, p++);
 			len--;
-			ttyclicks_on = c;
+			if (owner)
+				ttyclicks_on = c;
 			break;
 
 		case ACS_SOUNDS_TTY:
@@ -546,7 +936,8 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 				break;
 			get_user(c, p++);
 			len--;
-			ttyclicks_tty = c;
+			if (owner)
+				ttyclicks_tty = c;
 			break;
 
 		case ACS_SOUNDS_KMSG:
@@ -554,7 +945,8 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 				break;
 			get_user(c, p++);
 			len--;
-			ttyclicks_kmsg = c;
+			if (owner)
+				ttyclicks_kmsg = c;
 			break;
 
 		case ACS_NOTES:
@@ -578,7 +970,8 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 			break;
 
 		case ACS_BYPASS:
-			key_bypass = true;
+			if (owner)
+				key_bypass = true;
 			break;
 
 		case ACS_DIVERT:
@@ -586,7 +979,8 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 				break;
 			get_user(c, p++);
 			len--;
-			key_divert = (c != 0);
+			if (owner)
+				key_divert = (c != 0);
 			break;
 
 		case ACS_MONITOR:
@@ -594,7 +988,8 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 				break;
 			get_user(c, p++);
 			len--;
-			key_monitor = (c != 0);
+			if (owner)
+				key_monitor = (c != 0);
 			break;
 
 		case ACS_OBREAK:
@@ -602,7 +997,16 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 				break;
 			get_user(c, p++);
 			len--;
-			outputbreak = (unsigned char)c;
+			if (owner)
+				outputbreak = (unsigned char)c;
+			break;
+
+		case ACS_STAMPS:
+			if (len < 1)
+				break;
+			get_user(c, p++);
+			len--;
+			r->stamps = (c != 0);
 			break;
 
 		case ACS_SWOOP:
@@ -637,13 +1041,7 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 
 		case ACS_REFRESH:
 			spin_lock_irq(&acslock);
-			if (rbuf_head <= rbuf_end - 4) {
-				bool wake = (rbuf_head == rbuf_tail);
-				*rbuf_head = ACS_REFRESH;
-				rbuf_head += 4;
-				if (wake)
-					wake_up_interruptible(&wq);
-			}
+			rbuf_post(r, ACS_REFRESH, 0);
 			spin_unlock_irq(&acslock);
 			break;
 
@@ -673,7 +1071,18 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 				isize = 256;
 			if (isize >= 65536)
 				isize = 65535;
-			user_bufsize = isize;
+			r->bufsize = isize;
+			break;
+
+		case ACS_FILTER:
+			if (len < 2)
+				break;
+			get_user(c, p++);
+			minor = (unsigned char)c;
+			get_user(c, p++);
+			len -= 2;
+			if (owner)
+				set_filter(minor, (unsigned char)c);
 			break;
 
 		}		/* switch */
@@ -686,13 +1095,17 @@ static ssize_t device_write(struct file *file, const char *buf, size_t len,
 
 static unsigned int device_poll(struct file *fp, poll_table * pt)
 {
-	unsigned int mask = 0;
-	if (!in_use)
-		return 0;	/* should never happen */
-/* we don't support poll writing. How to figure if the buffer is not full? */
-	if (rbuf_head > rbuf_tail)
-		mask = POLLIN | POLLRDNORM;
-	poll_wait(fp, &wq, pt);
+	struct reader *r = fp->private_data;
+	unsigned int mask;
+
+	poll_wait(fp, &r->wq, pt);
+/* Commands are carried out as they are written, so writing never blocks. */
+	mask = POLLOUT | POLLWRNORM;
+/* Pending output is readable if the read won't wait for an event,
+ * but it doesn't wake you up; that would defeat the output break. */
+	if (r->rbuf_head > r->rbuf_tail ||
+	    ((fp->f_flags & O_NONBLOCK) && catchup_pending(r)))
+		mask |= POLLIN | POLLRDNORM;
 	return mask;
 }
 
@@ -782,6 +1195,7 @@ static int isEcho(unsigned int c)
 		if ((long)jiffies - (long)keystack[j].when <= HZ * ECHOEXPIRE)
 			break;
 	if (j) {
+		stats.echo_expired += j;
 		dropKeysPending(j);
 		if (!nkeypending)
 			return 0;
@@ -815,6 +1229,7 @@ static int isEcho(unsigned int c)
 		return 1;
 	}
 
+	++stats.echo_miss;
 	flushInKeyBuffer();
 	return 0;
 }				/* isEcho */
@@ -917,12 +1332,19 @@ static void post4echo(int keytype, struct keyboard_notifier_param *param)
 }				/* post4echo */
 
 /* Push a character onto the tty log.
- * Called from the vt notifyer and from my printk console. */
+ * Called from the vt notifyer and from my printk console.
+ * The character is logged once; each reader that is waiting at the head
+ * of its output, or for echo, gets its own MORECHARS event. */
 static void pushlog(unsigned int c, int mino, bool from_vt)
 {
-	bool at_head = false;	/* output is at the head */
-	bool throw = false;	/* throw the MORECHARS event */
+	bool at_head[ACS_MAX_READERS];	/* this reader's output is at the head */
+	bool burst = false;	/* within the output break, don't throw */
+	bool thrown = false;
+	bool wake;
 	int echo = 0;
+	int j;
+	u64 now = 0;
+	struct reader *r;
 	struct cbuf *cb = cbuf_tty[mino];
 
 	if (!cb)
@@ -930,39 +1352,79 @@ static void pushlog(unsigned int c, int mino, bool from_vt)
 
 	spin_lock_irq(&acslock);
 
+	if (filter_out(mino, c)) {
+		++stats.filtered;
+		spin_unlock_irq(&acslock);
+		return;
+	}
+
+	for (j = 0; j < ACS_MAX_READERS; ++j) {
+		r = readers[j];
+		at_head[j] = (r && mino == fg_console &&
+			      (r->mark[mino] == cb->head ||
+			       r->echopoint[mino] == cb->head));
+	}
+
 	if (mino == fg_console) {
-		if (from_vt)
+		if (from_vt) {
 			echo = isEcho(c);
-		if (cb->mark == cb->head || cb->echopoint == cb->head)
-			at_head = true;
-		if (at_head || echo)
-			throw = true;
+			trace_acsint_echo(c, echo, nkeypending);
+		}
+		if (echo)
+			++stats.echo_match;
 		if (!echo) {
 			if (last_oj && outputbreak &&
 			    (long)jiffies - (long)last_oj <
 			    HZ * outputbreak / 10)
-				throw = false;
+				burst = true;
 			last_oj = jiffies;
 			if (last_oj == 0)
 				last_oj = 1;
 		}
 	}
 
-	cb_append(cb, c);
+	if (c == '\n' && filters[mino].flags & ACS_FILTER_CRLF &&
+	    cb_crlf(cb, mino)) {
+		++stats.filtered;
+	} else {
+		++stats.tty_chars[mino];
+		if (cb_append(cb, mino, c))
+			++stats.tty_drops[mino];
+	}
 
-	if (throw && rbuf_head <= rbuf_end - 8) {
+	for (j = 0; j < ACS_MAX_READERS; ++j) {
+		r = readers[j];
+		if (!r)
+			continue;
+		if (r->stamps && !r->tty_stamp[mino]) {
+			if (!now)
+				now = ktime_to_ns(ktime_get());
+			r->tty_stamp[mino] = now;
+		}
+		if (mino != fg_console)
+			continue;
+		if (!echo && (!at_head[j] || burst))
+			continue;
+		if (!rbuf_room(r, 8)) {
+			++stats.rbuf_drops;
+			continue;
+		}
 		/* throw the MORECHARS event */
-		bool wake = (rbuf_head == rbuf_tail);
-		rbuf_head[0] = ACS_TTY_MORECHARS;
-		rbuf_head[1] = echo;
-			*(unsigned int *)(rbuf_head + 4) = c;
-		rbuf_head += 8;
+		wake = (r->rbuf_head == r->rbuf_tail);
+		r->rbuf_head[0] = ACS_TTY_MORECHARS;
+		r->rbuf_head[1] = echo;
+		r->rbuf_head[2] = r->rbuf_head[3] = 0;
+		*(unsigned int *)(r->rbuf_head + 4) = c;
+		r->rbuf_head += 8;
+		thrown = true;
 		if (echo)
-			cb->echopoint = cb->head;
+			r->echopoint[mino] = cb->head;
 		if (wake)
-			wake_up_interruptible(&wq);
+			rbuf_wake(r);
 	}
 
+	trace_acsint_pushlog(c, mino, echo, thrown);
+
 	spin_unlock_irq(&acslock);
 }				/* pushlog */
 
@@ -975,7 +1437,7 @@ static void pushlog(unsigned int c, int mino, bool from_vt)
 static void my_printk(struct console *cons, const char *msg, unsigned int len)
 {
 	char c;
-	if (!in_use)
+	if (!nreaders)
 		return;
 	while (len--) {
 		c = *msg++;
@@ -998,8 +1460,9 @@ vt_out(struct notifier_block *this_nb, unsigned long type, void *data)
 	struct vc_data *vc = param->vc;
 	int mino = vc->vc_num;
 	unsigned int unicode = param->c;
+	int j;
 
-	if (!in_use)
+	if (!nreaders)
 		return NOTIFY_DONE;
 
 	if (param->vc->vc_mode == KD_GRAPHICS && type != VT_UPDATE)
@@ -1016,14 +1479,9 @@ vt_out(struct notifier_block *this_nb, unsigned long type, void *data)
 		last_oj = 0;
 		spin_lock_irq(&acslock);
 		flushInKeyBuffer();
-		if (rbuf_head <= rbuf_end - 4) {
-			bool wake = (rbuf_head == rbuf_tail);
-			rbuf_head[0] = ACS_FGC;
-			rbuf_head[1] = fg_console + 1;
-			rbuf_head += 4;
-			if (wake)
-				wake_up_interruptible(&wq);
-		}
+		for (j = 0; j < ACS_MAX_READERS; ++j)
+			if (readers[j])
+				rbuf_post(readers[j], ACS_FGC, fg_console + 1);
 		spin_unlock_irq(&acslock);
 		break;
 
@@ -1056,8 +1514,10 @@ keystroke(struct notifier_block *this_nb, unsigned long type, void *data)
 	unsigned short action;
 	bool keep = false, send = false;
 	bool divert, monitor, bypass;
+	struct reader *r;
 
-	if (!in_use)
+/* Keys are intercepted only on behalf of the primary reader. */
+	if (!primary)
 		goto done;
 
 	if (param->vc->vc_mode == KD_GRAPHICS)
@@ -1137,18 +1597,30 @@ regular:
 		send = true;
 
 event:
+	trace_acsint_keystroke(key, ss, keep, send);
 	if (keep) {
 		/* If this notifier is not called by an interrupt, then we need the spinlock */
 		spin_lock_irq(&acslock);
-		if (rbuf_head <= rbuf_end - 4) {
-			bool wake = (rbuf_head == rbuf_tail);
-			rbuf_head[0] = ACS_KEYSTROKE;
-			rbuf_head[1] = key;
-			rbuf_head[2] = ss;
-			rbuf_head[3] = param->ledstate;
-			rbuf_head += 4;
+		r = primary;	/* it could have closed in the meantime */
+		if (r && !rbuf_room(r, (r->stamps ? 16 : 4))) {
+			++stats.rbuf_drops;
+			r = 0;
+		}
+		if (r) {
+			bool wake = (r->rbuf_head == r->rbuf_tail);
+			if (r->stamps) {
+				put_stamp(r->rbuf_head,
+					  ktime_to_ns(ktime_get()));
+				r->rbuf_head += 12;
+			}
+			r->rbuf_head[0] = ACS_KEYSTROKE;
+			r->rbuf_head[1] = key;
+			r->rbuf_head[2] = ss;
+			r->rbuf_head[3] = param->ledstate;
+			r->rbuf_head += 4;
+			++stats.keys;
 			if (wake)
-				wake_up_interruptible(&wq);
+				rbuf_wake(r);
 		}
 		spin_unlock_irq(&acslock);
 	}
@@ -1168,13 +1640,56 @@ static struct notifier_block nb_key = {
 	.priority = 20
 };
 
+/* The counters, as text, in /sys/kernel/debug/acsint/stats */
+static int stats_show(struct seq_file *m, void *v)
+{
+	unsigned long chars[MAX_NR_CONSOLES], drops[MAX_NR_CONSOLES];
+	int j;
+
+	spin_lock_irq(&acslock);
+	memcpy(chars, stats.tty_chars, sizeof(chars));
+	memcpy(drops, stats.tty_drops, sizeof(drops));
+	spin_unlock_irq(&acslock);
+
+	seq_printf(m, "readers %d\n", nreaders);
+	seq_printf(m, "reads %lu\n", stats.reads);
+	seq_printf(m, "wakeups %lu\n", stats.wakeups);
+	seq_printf(m, "rbuf_drops %lu\n", stats.rbuf_drops);
+	seq_printf(m, "keys %lu\n", stats.keys);
+	seq_printf(m, "catchup_bytes %lu\n", stats.catchup_bytes);
+	seq_printf(m, "catchup_trimmed %lu\n", stats.catchup_trimmed);
+	seq_printf(m, "echo_match %lu\n", stats.echo_match);
+	seq_printf(m, "echo_miss %lu\n", stats.echo_miss);
+	seq_printf(m, "echo_expired %lu\n", stats.echo_expired);
+	seq_printf(m, "filtered %lu\n", stats.filtered);
+	for (j = 0; j < MAX_NR_CONSOLES; ++j) {
+		if (!chars[j] && !drops[j])
+			continue;
+		seq_printf(m, "tty%d chars %lu drops %lu\n",
+			   j + 1, chars[j], drops[j]);
+	}
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 /* load and unload the module */
 
 static int __init acsint_init(void)
 {
 	int rc;
 
-	in_use = false;
 	clear_keys();
 
 	if (major == 0)
@@ -1208,6 +1723,12 @@ static int __init acsint_init(void)
 
 	register_console(&acsintconsole);
 
+/* Statistics are a convenience; the driver runs without them. */
+	debug_dir = debugfs_create_dir("acsint", NULL);
+	if (!IS_ERR_OR_NULL(debug_dir))
+		debugfs_create_file("stats", 0444, debug_dir, NULL,
+				    &stats_fops);
+
 	return 0;
 }
 
@@ -1215,6 +1736,7 @@ static void __exit acsint_exit(void)
 {
 	int j;
 
+	debugfs_remove_recursive(debug_dir);
 	unregister_console(&acsintconsole);
 	unregister_keyboard_notifier(&nb_key);
 	unregister_vt_notifier(&nb_vt);
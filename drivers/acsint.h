@@ -41,8 +41,20 @@ enum acs_command {
 	ACS_TTY_MORECHARS,	/* there are more chars pending */
 	ACS_FGC,		/* foreground console */
 	ACS_PRINTK,
+/* Timestamp keystrokes and new output, for latency measurements */
+	ACS_STAMPS,		/* on or off */
+	ACS_STAMP,		/* the event that carries the time */
+/* Filter the output before it is logged */
+	ACS_FILTER,		/* console and flags */
 };
 
+/* Flags for ACS_FILTER.
+ * These have the same values as the ACS_PP bits in the bridge,
+ * so the adapter can pass its postprocess flags straight through. */
+#define ACS_FILTER_BELL 0x2	/* drop ^G */
+#define ACS_FILTER_CRLF 0x4	/* cr lf becomes lf */
+#define ACS_FILTER_ESC 0x10	/* drop escape sequences */
+
 /* Here is a bound; you can't capture keys at or beyond this point. */
 #define ACS_NUM_KEYS 128
 
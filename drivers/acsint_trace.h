@@ -0,0 +1,114 @@
+/* Tracepoints for acsint, so the driver can be watched with the
+ * standard kernel tracing tools, alongside the rest of the system.
+ * See the Tracepoints section of acsint.txt. */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM acsint
+
+#if !defined(_ACSINT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ACSINT_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* a character of output is logged, and perhaps passed down as MORECHARS */
+TRACE_EVENT(acsint_pushlog,
+	TP_PROTO(unsigned int c, int mino, int echo, bool thrown),
+	TP_ARGS(c, mino, echo, thrown),
+	TP_STRUCT__entry(
+		__field(unsigned int, c)
+		__field(int, mino)
+		__field(int, echo)
+		__field(bool, thrown)
+	),
+	TP_fast_assign(
+		__entry->c = c;
+		__entry->mino = mino;
+		__entry->echo = echo;
+		__entry->thrown = thrown;
+	),
+	TP_printk("tty%d c=0x%x echo=%d thrown=%d",
+		  __entry->mino + 1, __entry->c, __entry->echo, __entry->thrown)
+);
+
+/* a key down, kept for the adapter, sent to the console, or both */
+TRACE_EVENT(acsint_keystroke,
+	TP_PROTO(unsigned int key, int ss, bool keep, bool send),
+	TP_ARGS(key, ss, keep, send),
+	TP_STRUCT__entry(
+		__field(unsigned int, key)
+		__field(int, ss)
+		__field(bool, keep)
+		__field(bool, send)
+	),
+	TP_fast_assign(
+		__entry->key = key;
+		__entry->ss = ss;
+		__entry->keep = keep;
+		__entry->send = send;
+	),
+	TP_printk("key=%u ss=%d keep=%d send=%d",
+		  __entry->key, __entry->ss, __entry->keep, __entry->send)
+);
+
+/* isEcho() decided whether an output character echoes a key */
+TRACE_EVENT(acsint_echo,
+	TP_PROTO(unsigned int c, int echo, int pending),
+	TP_ARGS(c, echo, pending),
+	TP_STRUCT__entry(
+		__field(unsigned int, c)
+		__field(int, echo)
+		__field(int, pending)
+	),
+	TP_fast_assign(
+		__entry->c = c;
+		__entry->echo = echo;
+		__entry->pending = pending;
+	),
+	TP_printk("c=0x%x echo=%d pending=%d",
+		  __entry->c, __entry->echo, __entry->pending)
+);
+
+/* device_read() brought the adapter up to date */
+TRACE_EVENT(acsint_catchup,
+	TP_PROTO(int mino, int culen, int trimmed, u64 copy_ns),
+	TP_ARGS(mino, culen, trimmed, copy_ns),
+	TP_STRUCT__entry(
+		__field(int, mino)
+		__field(int, culen)
+		__field(int, trimmed)
+		__field(u64, copy_ns)
+	),
+	TP_fast_assign(
+		__entry->mino = mino;
+		__entry->culen = culen;
+		__entry->trimmed = trimmed;
+		__entry->copy_ns = copy_ns;
+	),
+	TP_printk("tty%d culen=%d trimmed=%d copy_ns=%llu",
+		  __entry->mino + 1, __entry->culen, __entry->trimmed,
+		  (unsigned long long)__entry->copy_ns)
+);
+
+/* device_write() runs a command from the adapter */
+TRACE_EVENT(acsint_command,
+	TP_PROTO(int cmd, size_t len),
+	TP_ARGS(cmd, len),
+	TP_STRUCT__entry(
+		__field(int, cmd)
+		__field(size_t, len)
+	),
+	TP_fast_assign(
+		__entry->cmd = cmd;
+		__entry->len = len;
+	),
+	TP_printk("cmd=%d remaining=%zu", __entry->cmd, __entry->len)
+);
+
+#endif /* _ACSINT_TRACE_H */
+
+/* This is an out of tree module; the header is here, not in include/trace. */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE acsint_trace
+#include <trace/define_trace.h>
@@ -30,6 +30,9 @@
 
 #include "ttyclicks.h"
 
+#define CREATE_TRACE_POINTS
+#include "ttyclicks_trace.h"
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Karl Dahlke - eklhad@gmail.com");
 MODULE_DESCRIPTION
@@ -353,6 +356,8 @@ static void pop_soundfifo(TimerCallbackArg notUsed)
 
 	raw_spin_unlock_irqrestore(&soundfifo_lock, flags);
 
+	trace_ttyclicks_play(freq, duration);
+
 	if (freq == 0) {
 		/* turn off singing speaker */
 		speaker_sing(0);
@@ -377,8 +382,8 @@ static void pop_soundfifo(TimerCallbackArg notUsed)
 /* Push a string of notes into the sound fifo. */
 static void my_mknotes(const short *p)
 {
-	int i;
-	bool wake = false;
+	int i, n = 0;
+	bool wake = false, full = false;
 	unsigned long flags;
 
 	if (*p == 0)
@@ -398,9 +403,11 @@ static void my_mknotes(const short *p)
 			i = 0;	/* wrap around */
 		if (i == sf_tail) {
 			/* fifo is full */
+			full = true;
 			goto done;
 		}
 		sf_head = i;
+		++n;
 	}
 
 	/* try to add on a rest, to carry the last note through */
@@ -414,6 +421,8 @@ static void my_mknotes(const short *p)
 done:
 	raw_spin_unlock_irqrestore(&soundfifo_lock, flags);
 
+	trace_ttyclicks_queue(n, full);
+
 	/* first sound,  get things started. */
 	if (wake)
 		pop_soundfifo(0);
@@ -427,8 +436,8 @@ done:
  * is based on jiffies timing, so is subject to the resolution of HZ. */
 static void my_mksteps(int f1, int f2, int step, int duration)
 {
-	int i;
-	bool wake = false;
+	int i, n = 0;
+	bool wake = false, full = false;
 	unsigned long flags;
 
 	/* are the parameters in range? */
@@ -459,9 +468,11 @@ static void my_mksteps(int f1, int f2, int step, int duration)
 			i = 0;	/* wrap around */
 		if (i == sf_tail) {
 			/* fifo is full */
+			full = true;
 			goto done;
 		}
 		sf_head = i;
+		++n;
 		f1 = f1 * (100 + step) / 100;
 		if (f1 < 50 || f1 > 8000)
 			break;
@@ -478,6 +489,8 @@ static void my_mksteps(int f1, int f2, int step, int duration)
 done:
 	raw_spin_unlock_irqrestore(&soundfifo_lock, flags);
 
+	trace_ttyclicks_queue(n, full);
+
 	/* first sound,  get things started. */
 	if (wake)
 		pop_soundfifo(0);
@@ -612,6 +625,7 @@ vt_out(struct notifier_block *this_nb, unsigned long type, void *data)
 		escState = 0;
 
 	usecs = soundFromChar(c, minor);
+	trace_ttyclicks_char(unicode, usecs);
 
 /*
  * If it's the bell, I make the beep, not the console.
@@ -0,0 +1,63 @@
+/* Tracepoints for ttyclicks, the sounds queued and played.
+ * See ttyclicks.txt. */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ttyclicks
+
+#if !defined(_TTYCLICKS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TTYCLICKS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* notes or steps went into the sound fifo; full if some didn't fit */
+TRACE_EVENT(ttyclicks_queue,
+	TP_PROTO(int notes, bool full),
+	TP_ARGS(notes, full),
+	TP_STRUCT__entry(
+		__field(int, notes)
+		__field(bool, full)
+	),
+	TP_fast_assign(
+		__entry->notes = notes;
+		__entry->full = full;
+	),
+	TP_printk("notes=%d full=%d", __entry->notes, __entry->full)
+);
+
+/* a note starts, freq -1 is a rest, freq 0 means the fifo ran dry */
+TRACE_EVENT(ttyclicks_play,
+	TP_PROTO(int freq, int duration),
+	TP_ARGS(freq, duration),
+	TP_STRUCT__entry(
+		__field(int, freq)
+		__field(int, duration)
+	),
+	TP_fast_assign(
+		__entry->freq = freq;
+		__entry->duration = duration;
+	),
+	TP_printk("freq=%d ms=%d", __entry->freq, __entry->duration)
+);
+
+/* a character of tty output, and the microseconds we pause for it */
+TRACE_EVENT(ttyclicks_char,
+	TP_PROTO(unsigned int c, int usecs),
+	TP_ARGS(c, usecs),
+	TP_STRUCT__entry(
+		__field(unsigned int, c)
+		__field(int, usecs)
+	),
+	TP_fast_assign(
+		__entry->c = c;
+		__entry->usecs = usecs;
+	),
+	TP_printk("c=0x%x usecs=%d", __entry->c, __entry->usecs)
+);
+
+#endif /* _TTYCLICKS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ttyclicks_trace
+#include <trace/define_trace.h>
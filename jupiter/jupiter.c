@@ -11,6 +11,7 @@ as articulated by the Free Software Foundation.
 #include <fcntl.h>
 #include <unistd.h>
 #include <locale.h>
+#include <signal.h>
 
 #include <linux/vt.h>
 
@@ -81,6 +82,8 @@ static const struct cmd speechcommands[] = {
 	{"dump buffer","dump",0,0,1},
 	{"suspend the adapter","suspend",0,0,1},
 	{"chromatic scale","step",0,0,0,2},
+	{"go to line","gline",1,1,0,2},
+	{"line number","linenum",1,3},
 	{0,""}
 };
 
@@ -127,6 +130,7 @@ const char *inputword;
 const char *errorword;
 const char *topword;
 const char *bottomword;
+const char *ofword;
 };
 
 static const struct OUTWORDS const outwords[6] = {
@@ -167,7 +171,7 @@ static const struct OUTWORDS const outwords[6] = {
 "set pitch", "lower", "higher",
 "hello there", "reload", "o k",
 "mark", "cut", "mode", "boundary", "input", "error",
-"top", "bottom",
+"top", "bottom", "of",
 
 },{ /* German */
 
@@ -203,7 +207,7 @@ static const struct OUTWORDS const outwords[6] = {
 "setze Tonhöhe", "niedriger", "höher",
 "hallo", "erneut laden", "ok",
 "Markieren", "ausschneiden", "Modus", "Ende", "Kommando", "Fehler",
-"Anfang", "Ende",
+"Anfang", "Ende", "von",
 
 },{ /* Brazilian Portuguese */
 
@@ -239,7 +243,7 @@ static const struct OUTWORDS const outwords[6] = {
 "determinar tom", "mais baixo", "mais alto",
 "olá", "recarregar", "o k",
 "marcar", "cortar", "modo", "limite", "inserir", "erro",
-"topo", "fundo",
+"topo", "fundo", "de",
 
 },{ /* French */
 
@@ -277,7 +281,7 @@ static const struct OUTWORDS const outwords[6] = {
 "pitch", "plus bas", "plus haut",
 "bonjour", "rechargement", "o k",
 "marquer", "couper", "mode", "limite", "entrer", "erreur",
-"début", "fin",
+"début", "fin", "sur",
 
 },{ /* Slovak */
 "Použitie:  jupiter [-d] [-c súbor] hlas.výstup port\n"
@@ -312,7 +316,7 @@ static const struct OUTWORDS const outwords[6] = {
 "nastaviť výšku", "nižšie", "vyššie",
 "dobrý deň", "načítať znovu", "oukey",
 "mark", "cut", "mode", "boundary", "input", "error",
-"top", "bottom",
+"top", "bottom", "z",
 
 /* no more */
 
@@ -616,12 +620,15 @@ acs_shutup();
 }
 
 #define readNextMark acs_rb->marks[27]
+#define GATHERLEN 120 /* characters gathered to read a sentence */
+#define GATHERMAX 3840 /* unless it's one long token */
 
 static void
 readNextPart(void)
 {
 int gsprop;
 int i;
+int gather = GATHERLEN; /* how much text to grab */
 unsigned int *end; /* the end of the sentence */
 unsigned int first; /* first character of the sentence */
 static int flip = 1; /* flip between two ranges of numbers */
@@ -657,9 +664,14 @@ gsprop |= ACS_GS_NLSPACE;
 top:
 /* grab something to read */
 acs_log("nextpart 0x%x\n", acs_rb->cursor[0]);
+if(tp_inroom(&tp_default, gather+2)) {
+acs_buzz();
+acs_rb = 0;
+return;
+}
 tp_in->buf[0] = 0;
 tp_in->offset[0] = 0;
-acs_getsentence(tp_in->buf+1, 120, tp_in->offset+1, gsprop);
+acs_getsentence(tp_in->buf+1, gather, tp_in->offset+1, gsprop);
 
 if(!tp_in->buf[1]) {
 /* Empty sentence, nothing else to read. */
@@ -705,6 +717,18 @@ free(w);
 }
 
 tp_in->len = 1 + acs_unilen(tp_in->buf+1);
+
+/* A long number or url can fill the buffer with no space to break at.
+ * Grab more text, rather than reading it in pieces. */
+if(tp_in->len == gather && gather < GATHERMAX) {
+for(end=tp_in->buf+1; *end; ++end)
+if(acs_isspace(*end)) break;
+if(!*end) {
+gather *= 2;
+goto top;
+}
+}
+
 /* If the sentence runs all the way to the end of the buffer,
  * then we might be in the middle of printing a word.
  * We don't want to read half the word, then come back and refresh
@@ -952,22 +976,14 @@ break;
 
 	case 13: /* up a row */
 		n = acs_startline();
-		if(!acs_back()) goto error_bound;
-		acs_startline();
-		for(i=1; i<n; ++i) {
-			if(acs_getc() == '\n') goto error_bell;
-acs_forward();
-		}
+		if(!acs_gotoline(acs_lineno() - 1)) goto error_bound;
+		if(!acs_gotocol(n)) goto error_bell;
 		break;
 
 	case 14: /* down a row */
 		n = acs_startline();
-acs_endline();
-		if(!acs_forward()) goto error_bound;
-		for(i=1; i<n; ++i) {
-			if(acs_getc() == '\n') goto error_bell;
-			if(!acs_forward()) goto error_bound;
-		}
+		if(!acs_gotoline(acs_lineno() + 1)) goto error_bound;
+		if(!acs_gotocol(n)) goto error_bell;
 		break;
 
 /* read character, or cap character, or word for character */
@@ -1263,6 +1279,18 @@ if(!*suptext) goto error_bell;
 etcjup(suptext);
 if(access(jfile, 4)) goto error_bell;
 chromscale(jfile);
+break;
+
+case 50: /* go to line */
+if(!isdigit((unsigned char)suptext[0])) goto error_bell;
+if(!acs_gotoline(atoi(suptext))) goto error_bound;
+break;
+
+case 51: /* line n of m */
+acs_cursorsync();
+sprintf(shortPhrase, "%s %d %s %d",
+o->lineword, acs_lineno(), o->ofword, acs_linecount());
+acs_say_string_uc(prepTTSmsg(shortPhrase));
 break;
 
 	default:
@@ -1343,10 +1371,93 @@ done:
 last_fgc = acs_fgc;
 }
 
+/*********************************************************************
+Save the trace ring of the bridge, so you can see what happened
+just before the synth went quiet, or jupiter said the wrong thing.
+	kill -USR1 `pidof jupiter`
+	echo ::trace >/etc/jupiter/fifo
+Then run bridge/acstrace on the file.
+The signal only sets a flag; the main loop writes the file,
+within half a second, since select wakes up every 0.4 seconds.
+Latency histograms, from keystroke or new output to the synth,
+are saved the same way, and cleared with ::latency reset.
+	echo ::latency >/etc/jupiter/fifo; cat /var/log/acslatency
+Every read from the driver can be saved, for tests/acsreplay,
+from the start with ACSCAPTURE=file, or from here on with ::capture,
+which always writes /var/log/acscapture; the second ::capture stops it.
+Anyone who can write to the fifo can start it,
+so they don't get to choose the file.
+::profile starts counting the time spent in acs_events(),
+and the second ::profile stops, and writes the numbers to /var/log/acsprofile.
+::cache writes the hits and misses of the sentence cache,
+and how many sentences it holds, to /var/log/acscache.
+*********************************************************************/
+
+static const char tracefile[] = "/var/log/acstrace";
+static const char latencyfile[] = "/var/log/acslatency";
+static const char profilefile[] = "/var/log/acsprofile";
+static const char cachefile[] = "/var/log/acscache";
+static const char capturefile[] = "/var/log/acscapture";
+static char capturing;
+static volatile sig_atomic_t traceRequest;
+
+static void usr1_h(int sig)
+{
+traceRequest = 1;
+}
+
+static void saveTrace(void)
+{
+traceRequest = 0;
+if(acs_trace_save(tracefile))
+acs_log("cannot save the trace in %s\n", tracefile);
+}
+
 /* fifo input still works, even if suspended */
 static void fifo_h(char *msg)
 {
 int rc;
+/* these are quiet, they don't interrupt speech */
+if(stringEqual(msg, "::trace")) {
+saveTrace();
+return;
+}
+if(stringEqual(msg, "::latency")) {
+if(acs_latency_save(latencyfile))
+acs_log("cannot save latencies in %s\n", latencyfile);
+return;
+}
+if(stringEqual(msg, "::latency reset")) {
+acs_latency_reset();
+return;
+}
+if(stringEqual(msg, "::capture")) {
+if(capturing) {
+acs_capture(0);
+capturing = 0;
+return;
+}
+if(acs_capture(capturefile))
+acs_log("cannot capture to %s\n", capturefile);
+else capturing = 1;
+return;
+}
+if(stringEqual(msg, "::cache")) {
+if(tp_cache_save(&tp_default, cachefile))
+acs_log("cannot save the cache counts in %s\n", cachefile);
+return;
+}
+if(stringEqual(msg, "::profile")) {
+if(!acs_profiling) {
+memset(&acs_prof, 0, sizeof(acs_prof));
+acs_profiling = 1;
+return;
+}
+acs_profiling = 0;
+if(acs_profile_save(profilefile))
+acs_log("cannot save the profile in %s\n", profilefile);
+return;
+}
 /* stop reading, and speak the message */
 interrupt();
 // special execute now code
@@ -1494,6 +1605,7 @@ main(int argc, char **argv)
 {
 int i, port, onusb = 0;
 char serialdev[20];
+char *serialpath = serialdev;
 char *cmd = NULL;
 int lastrow, lastcol;
 
@@ -1544,6 +1656,20 @@ testTTS();
 return 0;
 }
 
+/* Preprocess a whole document, in parallel, for offline synthesis.
+ * jupiter batch infile outfile [threads] */
+if(argc && (stringEqual(argv[0], "batch") || stringEqual(argv[0], "lbatch"))) {
+tp_readLiteral = (argv[0][0] == 'l');
+if(argc < 3) usage();
+acs_reset_configure();
+j_configure(start_config, 0);
+if(tp_batch(argv[1], argv[2], (argc > 3 ? atoi(argv[3]) : 0))) {
+perror(tp_batch_failed ? tp_batch_failed : argv[1]);
+exit(1);
+}
+return 0;
+}
+
 if(argc && stringEqual(argv[0], "tc")) {
 j_configure(start_config, 0);
 return 0;
@@ -1559,6 +1685,9 @@ acs_style_defaults();
 
 if (*argv[0] == '|') {
 cmd = argv[0]+1;
+} else if (*argv[0] == '/') {
+/* a serial device by name, perhaps the pseudo terminal of tests/synthfake */
+serialpath = argv[0];
 } else {
 if(argv[0][0] == 'u')
 port = atoi(argv[0]+1), onusb = 1;
@@ -1569,6 +1698,9 @@ sprintf(serialdev, "/dev/%s%d",
 (onusb ? "ttyUSB" : "ttyS"), port);
 }
 
+/* ACSINT points to another device, such as the fake in tests/acsfake. */
+if(getenv("ACSINT")) acsdriver = getenv("ACSINT");
+
 /* Compare major minor numbers on acsdriver with what we see
  * in /sys.  If it's wrong, and we are root, fix it up.
  * This is linux only. */
@@ -1588,6 +1720,15 @@ fprintf(stderr, o->makeDriver, acsdriver);
 exit(1);
 }
 
+/* save the events, to replay later, see tests/acsreplay */
+if(getenv("ACSCAPTURE")) {
+if(acs_capture(getenv("ACSCAPTURE"))) {
+fprintf(stderr, "cannot capture to %s, %s\n", getenv("ACSCAPTURE"), strerror(errno));
+exit(1);
+}
+capturing = 1;
+}
+
 acs_key_h = key_h;
 acs_fgc_h = fgc_h;
 acs_more_h = more_h;
@@ -1599,8 +1740,8 @@ fprintf(stderr, o->execSoft, cmd);
 exit(1);
 }
 
-if(!cmd && acs_serial_open(serialdev, 9600)) {
-fprintf(stderr, o->openSerial, serialdev);
+if(!cmd && acs_serial_open(serialpath, 9600)) {
+fprintf(stderr, o->openSerial, serialpath);
 exit(1);
 }
 
@@ -1611,14 +1752,20 @@ if(synths[i].initstring)
 acs_say_string(synths[i].initstring);
 
 acs_startfifo("/etc/jupiter/fifo");
+signal(SIGUSR1, usr1_h);
 
 /* I have a low usage machine, so a small gap in output
  * usually means something new to read.  Set it at 0.4 seconds. */
 acs_obreak(4);
 
+/* timestamps from the driver, for the latency histograms */
+acs_stamps(1);
+
 /* This is the same as the default, but I set it here for clarity. */
 acs_postprocess = ACS_PP_CTRL_H | ACS_PP_CRLF |
 ACS_PP_CTRL_OTHER | ACS_PP_ESCB;
+/* and let the driver strip escape sequences before they fill its buffer */
+acs_filter(1);
 
 // First event sets the console, in case config file has execution commands.
 acs_all_events();
@@ -1645,6 +1792,7 @@ while(1) {
 char newcmd[8];
 
 acs_all_events();
+if(traceRequest) saveTrace();
 
 key_command:
 if(last_key) {
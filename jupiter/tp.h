@@ -21,25 +21,80 @@ as articulated by the Free Software Foundation.
 /* WORDLEN comes from acsbridge.h */
 #define NEWWORDLEN 200 /* size of word or number after expansion */
 
+/* Buffers grow as needed, so a long number or url is never cut off.
+ * Only offset[1] through offset[len] are meaningful. */
 struct textbuf {
 	unsigned int *buf;
 	acs_ofs_type *offset;
-	unsigned short room;
-	unsigned short len;
+	unsigned int room;
+	unsigned int len;
 };
 
-extern struct textbuf *tp_in, *tp_out;
+struct OUTWORDS;
+struct tp_langhash;
+struct tp_cacheent;
 
-extern char tp_acronUpper; /* acronym letters in upper case? */
-extern char tp_acronDelim;
-extern char tp_oneSymbol; /* read one symbol - not a sentence */
-extern char tp_readLiteral; // read each punctuation mark
-/* a convenient place to put little phrases to speak */
-extern char shortPhrase[NEWWORDLEN];
+#define TP_CACHESIZE 64 /* sentences remembered by the default context */
+
+/*********************************************************************
+All the state of translation, for one sentence at a time.
+The context versions of the functions below keep nothing of their own
+outside the context.  They do call the bridge, for the dictionary,
+the punctuation pronunciations, and utf8 conversions;
+its scratch buffers for those are per thread, see acsbind.c,
+and the tables are only read here.
+So give each thread its own context, and sentences can be preprocessed
+in parallel, lookahead or whole documents,
+as long as nobody changes the dictionary or the pronunciations meanwhile.
+The familiar names, tp_in, shortPhrase, prepTTS(), etc,
+use the default context.
+*********************************************************************/
+
+struct tp_context {
+	char acronUpper; /* acronym letters in upper case? */
+	char acronDelim;
+	char oneSymbol; /* read one symbol - not a sentence */
+	char readLiteral; // read each punctuation mark
+	struct textbuf *in, *out;
+	struct textbuf tb1, tb2;
+	const struct OUTWORDS *ow;
+	const struct tp_langhash *lh; /* word lists of ow, hashed */
+	const char *andWord;
+	const unsigned int *atoi_s;
+	acs_ofs_type end_ofs;
+	/* a convenient place to put little phrases to speak */
+	char phrase[NEWWORDLEN];
+	/* cache of translated sentences, most recently used first */
+	struct tp_cacheent *cache;
+	int cache_count, cache_max;
+	unsigned int cache_serial;
+	unsigned long cache_hits, cache_misses;
+};
+
+extern struct tp_context tp_default;
+
+#define tp_in (tp_default.in)
+#define tp_out (tp_default.out)
+#define tp_acronUpper (tp_default.acronUpper) /* acronym letters in upper case? */
+#define tp_acronDelim (tp_default.acronDelim)
+#define tp_oneSymbol (tp_default.oneSymbol) /* read one symbol - not a sentence */
+#define tp_readLiteral (tp_default.readLiteral) // read each punctuation mark
+#define shortPhrase (tp_default.phrase)
 
 /* prototypes */
 
 /* sourcefile=tpxlate.c */
+int tp_setup(struct tp_context *tp, const struct tp_context *from) ;
+void tp_release(struct tp_context *tp) ;
+void tp_speakChar(struct tp_context *tp, unsigned int c, int sayit, int bellsound, int asword) ;
+void tp_switch(struct tp_context *tp) ;
+void tp_close(struct tp_context *tp, const unsigned int *s, int overflow) ;
+void tp_prep(struct tp_context *tp) ;
+unsigned int *tp_prepmsg(struct tp_context *tp, const char *msg) ;
+int tp_inroom(struct tp_context *tp, int n) ;
+void tp_cachesize(struct tp_context *tp, int n) ;
+void tp_cacheflush(struct tp_context *tp) ;
+int tp_cache_save(const struct tp_context *tp, const char *filename) ;
 int setupTTS(void) ;
 void textBufSwitch(void) ;
 void textbufClose(const unsigned int *s, int overflow) ;
@@ -47,4 +102,8 @@ void speakChar(unsigned int c, int sayit, int bellsound, int asword) ;
 void prepTTS(void) ;
 unsigned int *prepTTSmsg(const char *msg) ;
 
+/* sourcefile=tpbatch.c */
+extern const char *tp_batch_failed;
+int tp_batch(const char *infile, const char *outfile, int nthreads) ;
+
 #endif
@@ -0,0 +1,396 @@
+/*********************************************************************
+
+tpbatch.c: preprocess a whole document for offline synthesis.
+
+Copyright (C) Karl Dahlke, 2014.
+This software may be freely distributed under the GPL, general public license,
+as articulated by the Free Software Foundation.
+
+The document is mapped into memory, converted to unicode,
+and cut into sentences.
+Each sentence is gathered the way jupiter gathers a sentence to read,
+via acs_getsentence_uc(), and then run through the text preprocessor.
+Sentences are independent, so a pool of threads, each with its own
+tp_context, translates them in parallel.
+Output is written in order, one sentence per line, in utf8.
+Beside it, in outfile.ofs, is the offset map:
+one line per word or token, giving the byte offset in the output
+and the byte offset in the input where that word came from.
+*********************************************************************/
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tp.h"
+
+#define SENTMAX 300 /* cut a sentence at a space if it gets this long */
+#define BLOCKSENT 4096 /* sentences translated, then written, at a time */
+#define MAXTHREADS 64
+
+struct sentence {
+unsigned int start, end; // slice of the document
+unsigned int *text; // translated text
+unsigned int *offset; // document index + 1 for each word, else 0
+int len, room;
+};
+
+static unsigned int *doc; // the document in unicode
+static unsigned int *docbyte; // byte offset of each unicode in the file
+static unsigned int doclen;
+static struct sentence *sents;
+static int nsents;
+static int nextsent, endsent; // the work queue for this block
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *mapname; // outfile.ofs, kept for tp_batch_failed
+
+/* the file tp_batch() couldn't open, read, or write */
+const char *tp_batch_failed;
+
+/* Decode utf8, remembering where each character came from.
+ * The mapped file is not null terminated, so I can't use acs_utf82uni.
+ * Malformed sequences become question marks, as they do in the bridge,
+ * and that includes overlong forms, surrogates, and anything past 0x10ffff. */
+static void decode(const unsigned char *p, unsigned int n)
+{
+static const unsigned int least[5] = {0, 0, 0x80, 0x800, 0x10000};
+unsigned int i = 0, c;
+int j, k;
+unsigned char base, mask;
+
+doclen = 0;
+while(i < n) {
+docbyte[doclen] = i;
+base = p[i++];
+if(base <= 0x7f) {
+c = base;
+goto add;
+}
+mask = 0x80, j = 0;
+while(mask&base) {
+++j;
+base &= ~mask;
+mask >>= 1;
+}
+c = '?';
+if(j == 1 || j > 4) goto add;
+c = base;
+for(k=1; k<j; ++k) {
+if(i == n || (p[i]&0xc0) != 0x80) break;
+c = (c<<6) | (p[i++]&0x3f);
+}
+if(k < j || c < least[j] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+c = '?';
+add:
+// a null would end the sentence early
+if(!c) c = ' ';
+doc[doclen++] = c;
+}
+docbyte[doclen] = n;
+}
+
+static int closer(unsigned int c)
+{
+return (c == ')' || c == ']' || c == '"' || c == '\'' || c == 0xbb || c == 0x201d || c == 0x2019);
+}
+
+static int addSentence(unsigned int start, unsigned int end)
+{
+unsigned int i;
+struct sentence *sp;
+
+// nothing but white space, nothing to say
+for(i=start; i<end; ++i)
+if(!acs_isspace(doc[i])) break;
+if(i == end) return 0;
+
+if(!(nsents % BLOCKSENT)) {
+sp = realloc(sents, (nsents+BLOCKSENT) * sizeof(struct sentence));
+if(!sp) return -1;
+sents = sp;
+}
+sp = sents + nsents++;
+memset(sp, 0, sizeof(struct sentence));
+sp->start = start, sp->end = end;
+return 0;
+}
+
+/*********************************************************************
+Cut the document into sentences.
+A sentence ends with period, question mark, or bang,
+perhaps followed by a closing quote or paren,
+and then white space.
+A blank line, a form feed, or a bell also ends a sentence,
+and a sentence that runs on too long is cut at a space.
+A single newline is just white space, as it is when jupiter
+reads a buffer with ACS_GS_NLSPACE.
+*********************************************************************/
+
+static int split(void)
+{
+unsigned int i, j, start = 0, lastspace = 0;
+unsigned int c;
+
+for(i=0; i<doclen; ++i) {
+c = doc[i];
+
+if(c == '\f' || c == '\7') {
+j = i+1;
+goto cut;
+}
+
+if(c == '\n') {
+for(j=i+1; j<doclen; ++j)
+if(doc[j] != ' ' && doc[j] != '\t' && doc[j] != '\r') break;
+if(j < doclen && doc[j] == '\n') {
+j = i+1;
+goto cut;
+}
+}
+
+/* The closers count against SENTMAX too, or translate() overflows its slice. */
+if(c == '.' || c == '?' || c == '!') {
+for(j=i+1; j<doclen && j-start <= SENTMAX && closer(doc[j]); ++j)  ;
+if(j == doclen || acs_isspace(doc[j])) goto cut;
+}
+
+if(acs_isspace(c)) lastspace = i;
+if(i - start < SENTMAX) continue;
+j = (lastspace > start ? lastspace+1 : i+1);
+
+cut:
+if(addSentence(start, j)) return -1;
+start = lastspace = j;
+i = j-1;
+}
+
+if(start < doclen && addSentence(start, doclen)) return -1;
+return 0;
+}
+
+static int sentRoom(struct sentence *sp, int n)
+{
+int room;
+unsigned int *t, *o;
+if(sp->len + n <= sp->room) return 0;
+room = sp->room/2*3 + n + 64;
+t = realloc(sp->text, room * sizeof(unsigned int));
+if(!t) return -1;
+sp->text = t;
+o = realloc(sp->offset, room * sizeof(unsigned int));
+if(!o) return -1;
+sp->offset = o;
+sp->room = room;
+return 0;
+}
+
+/* Translate one sentence in the given context.
+ * If the sentence doesn't fit in the input buffer, it is gathered
+ * and translated in pieces, as jupiter would read it. */
+static void translate(struct tp_context *tp, struct sentence *sp)
+{
+unsigned int slice[SENTMAX+2];
+const unsigned int *base;
+struct textbuf *in, *out;
+int len = sp->end - sp->start;
+int i, k, used;
+unsigned int c;
+
+memcpy(slice, doc + sp->start, len * sizeof(unsigned int));
+slice[len] = 0;
+
+for(base=slice; *base; base+=used) {
+in = tp->in;
+in->buf[0] = 0;
+in->offset[0] = 0;
+acs_getsentence_uc(base, in->buf+1, in->room-2, in->offset+1,
+ACS_GS_NLSPACE | ACS_GS_REPEAT);
+k = acs_unilen(in->buf+1);
+used = in->offset[k+1];
+if(!used) break; // should never happen
+if(!k) continue;
+
+/* The first word is at offset 0, which looks like no word at all.
+ * Shift everything up by one, as prepTTSmsg() does. */
+for(i=2; i<=k+1; ++i)
+if(in->offset[i]) ++in->offset[i];
+in->offset[1] = 1;
+in->len = k+1;
+
+tp_prep(tp);
+out = tp->out;
+
+if(sentRoom(sp, out->len + 1)) return;
+if(sp->len) {
+sp->text[sp->len] = ' ';
+sp->offset[sp->len++] = 0;
+}
+for(i=1; i<out->len; ++i) {
+c = out->buf[i];
+if(c == '\n' || c == '\7') c = ' ';
+sp->text[sp->len] = c;
+k = out->offset[i];
+sp->offset[sp->len++] = (k ? sp->start + (base-slice) + k : 0);
+}
+}
+}
+
+static void *batchWorker(void *arg)
+{
+struct tp_context *tp = arg;
+int n;
+
+while(1) {
+pthread_mutex_lock(&batch_lock);
+n = nextsent++;
+pthread_mutex_unlock(&batch_lock);
+if(n >= endsent) break;
+translate(tp, sents+n);
+}
+
+return 0;
+}
+
+static int utf8len(unsigned int c)
+{
+if(c <= 0x7f) return 1;
+if(c <= 0x7ff) return 2;
+if(c <= 0xffff) return 3;
+if(c <= 0x1fffff) return 4;
+if(c <= 0x3ffffff) return 5;
+return 6;
+}
+
+/* Write a sentence and its offsets, then free it. */
+static void writeSentence(struct sentence *sp, FILE *f, FILE *mapf, unsigned long *outbyte)
+{
+int i;
+unsigned char *w;
+
+if(sp->len) {
+sp->text[sp->len] = 0;
+w = acs_uni2utf8(sp->text);
+if(w) {
+fputs((char*)w, f);
+free(w);
+}
+for(i=0; i<sp->len; ++i) {
+if(sp->offset[i])
+fprintf(mapf, "%lu %u\n", *outbyte, docbyte[sp->offset[i] - 1]);
+*outbyte += utf8len(sp->text[i]);
+}
+fputc('\n', f);
+++*outbyte;
+}
+
+free(sp->text);
+free(sp->offset);
+sp->text = 0, sp->offset = 0;
+}
+
+/*********************************************************************
+Preprocess infile into outfile, and the offset map into outfile.ofs,
+using nthreads threads, or one per processor if nthreads is 0.
+Settings, such as tp_readLiteral, come from the default context.
+Returns 0, or -1 with errno set.
+*********************************************************************/
+
+int tp_batch(const char *infile, const char *outfile, int nthreads)
+{
+int fd, i, n, nrun, rc = -1;
+struct stat st;
+unsigned char *map = MAP_FAILED;
+FILE *f = 0, *mapf = 0;
+struct tp_context *ctx = 0;
+pthread_t *tids = 0;
+unsigned long outbyte = 0;
+
+if(nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+if(nthreads <= 0) nthreads = 1;
+if(nthreads > MAXTHREADS) nthreads = MAXTHREADS;
+
+free(mapname), mapname = 0;
+tp_batch_failed = infile;
+fd = open(infile, O_RDONLY);
+if(fd < 0) return -1;
+if(fstat(fd, &st)) goto done;
+doc = malloc((st.st_size+1) * sizeof(unsigned int));
+docbyte = malloc((st.st_size+1) * sizeof(unsigned int));
+if(!doc || !docbyte) goto nomem;
+if(st.st_size) {
+map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+if(map == MAP_FAILED) goto done;
+madvise(map, st.st_size, MADV_SEQUENTIAL);
+decode(map, st.st_size);
+munmap(map, st.st_size);
+} else doclen = 0, docbyte[0] = 0;
+
+nsents = 0;
+if(split()) goto nomem;
+
+tp_batch_failed = outfile;
+f = fopen(outfile, "w");
+if(!f) goto done;
+mapname = malloc(strlen(outfile) + 5);
+if(!mapname) goto nomem;
+sprintf(mapname, "%s.ofs", outfile);
+tp_batch_failed = mapname;
+mapf = fopen(mapname, "w");
+if(!mapf) goto done;
+
+ctx = calloc(nthreads, sizeof(struct tp_context));
+tids = malloc(nthreads * sizeof(pthread_t));
+if(!ctx || !tids) goto nomem;
+for(i=0; i<nthreads; ++i) {
+if(tp_setup(ctx+i, &tp_default)) {
+nthreads = i;
+goto nomem;
+}
+}
+
+for(n=0; n<nsents; n=endsent) {
+nextsent = n;
+endsent = n + BLOCKSENT;
+if(endsent > nsents) endsent = nsents;
+if(nthreads == 1) {
+batchWorker(ctx);
+} else {
+/* If we can't start them all, the ones we have share the block,
+ * and if we can't start any, this thread does it alone. */
+for(nrun=0; nrun<nthreads; ++nrun)
+if(pthread_create(tids+nrun, 0, batchWorker, ctx+nrun)) break;
+if(!nrun) batchWorker(ctx);
+for(i=0; i<nrun; ++i)
+pthread_join(tids[i], 0);
+}
+for(i=n; i<endsent; ++i)
+writeSentence(sents+i, f, mapf, &outbyte);
+}
+
+rc = 0;
+tp_batch_failed = 0;
+goto done;
+
+nomem:
+errno = ENOMEM;
+tp_batch_failed = 0;
+
+done:
+i = errno;
+if(ctx) {
+while(nthreads) tp_release(ctx + --nthreads);
+free(ctx);
+}
+free(tids);
+if(f && fclose(f)) rc = -1, i = errno, tp_batch_failed = outfile;
+if(mapf && fclose(mapf)) rc = -1, i = errno, tp_batch_failed = mapname;
+free(sents), sents = 0;
+free(doc), doc = 0;
+free(docbyte), docbyte = 0;
+close(fd);
+errno = i;
+return rc;
+}
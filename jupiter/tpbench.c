@@ -0,0 +1,381 @@
+/*********************************************************************
+
+tpbench.c: time the text preprocessor, and check it against golden output.
+
+Copyright (C) Karl Dahlke, 2014.
+This software may be freely distributed under the GPL, general public license,
+as articulated by the Free Software Foundation.
+
+For each language, tts-trial is run through tp_prepmsg() a line at a time,
+as jupiter tts would do it, once normally and once reading punctuation
+literally, and the output is compared with golden/trial.<lang>
+and golden/trial.<lang>.lit.
+Then a synthetic corpus, numbers, money, dates, urls, acronyms,
+contractions, and words with accents, is generated from a fixed seed
+and run through the same way, and timed.
+Its output is too big to keep, so golden/synth.<lang> holds its
+size and a hash of it.
+tp_prep() already checks the end offset of every sentence, via debugCheck,
+and stops if it is wrong; here we also check that every word
+in the output points back into its input line.
+The sentence cache is off; this measures translation, not the cache.
+
+	tpbench [-u] [-n sentences] [language ...]
+
+-u writes new golden files, after you have listened to the output
+and convinced yourself that the change is right.
+A mismatch leaves the output in the current directory, as <file>.new,
+so you can diff it against the golden file.
+Run make bench in this directory.
+
+*********************************************************************/
+
+#include <time.h>
+
+#include "tp.h"
+
+#define SYNTHSENT 20000 /* sentences in the synthetic corpus */
+
+static const struct {
+	const char *name;
+	int lang;
+} languages[] = {
+	{"en", ACS_LANG_EN},
+	{"de", ACS_LANG_DE},
+	{"pt_br", ACS_LANG_PT_BR},
+	{"fr", ACS_LANG_FR},
+	{"sk", ACS_LANG_SK},
+	{0, 0}
+};
+
+static int update;
+static int nsynth = SYNTHSENT;
+static int failures;
+
+/* output gathered in memory, to compare or to write */
+static char *obuf;
+static size_t olen, oroom;
+
+static void oAppend(const char *s)
+{
+	size_t n = strlen(s);
+	if(olen + n + 1 > oroom) {
+		oroom = (olen + n + 1) * 2;
+		obuf = realloc(obuf, oroom);
+		if(!obuf) {
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+	}
+	memcpy(obuf + olen, s, n + 1);
+	olen += n;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The length of the line as tp_prepmsg() sees it, in unicodes,
+ * counting the null slot in front; offsets run from 1 to this.
+ * tp->in can't tell us afterwards, the buffers are swapped in translation. */
+static int inputLength(const char *line)
+{
+	static unsigned int *u;
+	static size_t room;
+	size_t n = strlen(line) + 1;
+	if(n > room) {
+		room = n * 2;
+		u = realloc(u, room * sizeof(unsigned int));
+		if(!u) {
+			fprintf(stderr, "out of memory\n");
+			exit(2);
+		}
+	}
+	return acs_utf82uni((const unsigned char *)line, u) + 1;
+}
+
+/* Every word of output must come from somewhere in the input line. */
+static void checkOffsets(const struct tp_context *tp, const char *line, int inlen)
+{
+	int i;
+	for(i=1; i<=tp->out->len; ++i) {
+		if(tp->out->offset[i] <= inlen)
+			continue;
+		fprintf(stderr, "offset %d at %d is past the end of the input, length %d:\n%s",
+			tp->out->offset[i], i, inlen, line);
+		exit(1);
+	}
+}
+
+/* Translate one line and add it to the output. */
+static void translate(struct tp_context *tp, const char *line)
+{
+	unsigned char *u;
+	int inlen = inputLength(line);
+
+	u = acs_uni2utf8(tp_prepmsg(tp, line));
+	if(!u) {
+		fprintf(stderr, "out of memory\n");
+		exit(2);
+	}
+	checkOffsets(tp, line, inlen);
+	oAppend((char *)u);
+	free(u);
+}
+
+/*********************************************************************
+The synthetic corpus.
+I use my own generator, rather than rand(), so the corpus,
+and the golden files, are the same on every machine.
+*********************************************************************/
+
+static unsigned long seed;
+
+static unsigned int rnd(unsigned int n)
+{
+	seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+	return (seed >> 8) % n;
+}
+
+static const char *plainWords[] = {
+	"the", "a", "house", "walked", "quickly", "over", "river", "and",
+	"government", "computer", "strength", "she", "he", "of", "in",
+	"Reagan", "era", "program", "synthesizer", "keyboard", "screen",
+	"Tim", "Ron", "McGruff", "rhythm", "street", "ox", "by", "is",
+	"für", "café", "naïve", "Müller", "São", "Paulo", "él", "señor",
+	"dis-obedient", "well-known", "re-read", "x-ray",
+	0
+};
+
+static const char *oddWords[] = {
+	"CIA", "ERA", "TAM", "ROM", "SIM", "NASA", "FBI", "IBM", "xkcd",
+	"isn't", "wasn't", "I'll", "O'Brien", "he'll", "it's", "Karl's",
+	"he/she", "him/her", "and/or", "input/output",
+	"www.example.com", "http://www.x.org/a/b.html", "mjordan@basketball.com",
+	"issue.20010513", "C135's", "TI660", "4x4", "18x20x12", "vi",
+	"Act V.", "chapter VI", "Jr.", "Dr.", "Mr.", "e.g.", "i.e.",
+	"--", "...", "(aside)", "\"quoted\"", "[sic]", ";", ":", ",",
+	"#309-076", "+/-", "100%", "&", "a*b", "x^2", "~",
+	0
+};
+
+static void synthNumber(char *s)
+{
+	unsigned int n = rnd(100000);
+	switch(rnd(16)) {
+	case 0: sprintf(s, "%u", rnd(10)); break;
+	case 1: sprintf(s, "%u", n); break;
+	case 2: sprintf(s, "%u,%03u", n / 1000 + 1, n % 1000); break;
+	case 3: sprintf(s, "%u.%02u", n % 1000, rnd(100)); break;
+	case 4: sprintf(s, "$%u", n % 1000); break;
+	case 5: sprintf(s, "$%u.%02u", n, rnd(100)); break;
+	case 6: sprintf(s, "$%u%c", rnd(100) + 1, "KMB"[rnd(3)]); break;
+	case 7: sprintf(s, "$%u.%u million", rnd(100), rnd(10)); break;
+	case 8: sprintf(s, "%u%s", rnd(40) + 1, (const char *[]){"st", "nd", "rd", "th"}[rnd(4)]); break;
+	case 9: sprintf(s, "the %u0's", rnd(10) + 190); break;
+	case 10: sprintf(s, "%u:%02u", rnd(12) + 1, rnd(60)); break;
+	case 11: sprintf(s, "%u/%u/%u", rnd(12) + 1, rnd(28) + 1, rnd(50) + 1970); break;
+	case 12: sprintf(s, "%03u-%04u", rnd(900) + 100, rnd(10000)); break;
+	case 13: sprintf(s, "(%03u) %03u-%04u", rnd(900) + 100, rnd(900) + 100, rnd(10000)); break;
+	case 14: sprintf(s, "room %u", rnd(900) + 100); break;
+	default: sprintf(s, "%u.%u.%u.%u", rnd(256), rnd(256), rnd(256), rnd(256)); break;
+	}
+}
+
+static void synthSentence(char *line)
+{
+	int i, n = rnd(16) + 4;
+	char word[80];
+	int r;
+
+	line[0] = 0;
+	for(i=0; i<n; ++i) {
+		r = rnd(10);
+		if(r < 6)
+			strcpy(word, plainWords[rnd(sizeof(plainWords) / sizeof(char *) - 1)]);
+		else if(r < 8)
+			strcpy(word, oddWords[rnd(sizeof(oddWords) / sizeof(char *) - 1)]);
+		else
+			synthNumber(word);
+		if(i)
+			strcat(line, " ");
+		strcat(line, word);
+	}
+	strcat(line, (const char *[]){".", ".", "?", "!", "...", "?!"}[rnd(6)]);
+	strcat(line, "\n");
+}
+
+static unsigned int hashOutput(void)
+{
+	unsigned int h = 2166136261u;
+	size_t i;
+	for(i=0; i<olen; ++i)
+		h = (h ^ (unsigned char)obuf[i]) * 16777619;
+	return h;
+}
+
+/* Compare the output with a golden file, or write the golden file. */
+static void golden(const char *name, const char *data, size_t len)
+{
+	char path[80], newpath[80];
+	FILE *f;
+	char *g;
+	long glen;
+	int same;
+
+	sprintf(path, "golden/%s", name);
+
+	if(update) {
+		f = fopen(path, "w");
+		if(!f || fwrite(data, 1, len, f) != len || fclose(f)) {
+			perror(path);
+			exit(2);
+		}
+		return;
+	}
+
+	same = 0;
+	f = fopen(path, "r");
+	if(f) {
+		fseek(f, 0, SEEK_END);
+		glen = ftell(f);
+		rewind(f);
+		g = malloc(glen + 1);
+		if(g && fread(g, 1, glen, f) == (size_t)glen)
+			same = (glen == (long)len && !memcmp(g, data, len));
+		free(g);
+		fclose(f);
+	}
+	if(same)
+		return;
+
+	++failures;
+	sprintf(newpath, "%s.new", name);
+	f = fopen(newpath, "w");
+	if(f) {
+		fwrite(data, 1, len, f);
+		fclose(f);
+	}
+	printf("  %s differs from golden; see %s\n", path, newpath);
+}
+
+static void benchLanguage(const char *name, int lang)
+{
+	struct tp_context ctx;
+	char line[400], gname[40];
+	FILE *f;
+	int lit, i, lines;
+	unsigned long chars;
+	double t;
+
+	acs_lang = lang;
+	acs_reset_configure();
+	memset(&ctx, 0, sizeof(ctx));
+	if(tp_setup(&ctx, &tp_default)) {
+		fprintf(stderr, "cannot set up the preprocessor\n");
+		exit(2);
+	}
+
+	for(lit=0; lit<2; ++lit) {
+		ctx.readLiteral = lit;
+
+		/* the hand written trial */
+		f = fopen("tts-trial", "r");
+		if(!f) {
+			perror("tts-trial");
+			exit(2);
+		}
+		olen = 0;
+		oAppend("");
+		lines = 0;
+		while(fgets(line, sizeof(line), f)) {
+			translate(&ctx, line);
+			++lines;
+		}
+		fclose(f);
+		sprintf(gname, "trial.%s%s", name, (lit ? ".lit" : ""));
+		golden(gname, obuf, olen);
+
+		/* the synthetic corpus */
+		seed = 1;
+		olen = 0;
+		oAppend("");
+		chars = 0;
+		t = now();
+		for(i=0; i<nsynth; ++i) {
+			synthSentence(line);
+			chars += strlen(line);
+			translate(&ctx, line);
+		}
+		t = now() - t;
+		if(t <= 0)
+			t = 1e-9;
+
+		printf("%-6s%-8s %5d trial lines, %6d sentences, %8lu chars, %8.0f sentences/s %6.2fM chars/s\n",
+		       name, (lit ? "literal" : ""), lines, nsynth, chars,
+		       nsynth / t, chars / t / 1e6);
+
+		if(nsynth != SYNTHSENT)
+			continue;
+		sprintf(gname, "synth.%s%s", name, (lit ? ".lit" : ""));
+		sprintf(line, "%d sentences in, %lu bytes out, hash %08x\n",
+			nsynth, (unsigned long)olen, hashOutput());
+		golden(gname, line, strlen(line));
+	}
+
+	tp_release(&ctx);
+}
+
+int main(int argc, char **argv)
+{
+	int i, j, any = 0;
+
+	for(i=1; i<argc; ++i) {
+		if(!strcmp(argv[i], "-u")) {
+			update = 1;
+			continue;
+		}
+		if(!strcmp(argv[i], "-n") && i+1 < argc) {
+			nsynth = atoi(argv[++i]);
+			continue;
+		}
+	}
+
+	/* The golden synthetic files are for the standard corpus. */
+	if(nsynth != SYNTHSENT && update) {
+		fprintf(stderr, "golden files are written with the standard corpus only\n");
+		exit(2);
+	}
+
+	for(i=1; i<argc; ++i) {
+		if(argv[i][0] == '-') {
+			if(argv[i][1] == 'n')
+				++i;
+			continue;
+		}
+		for(j=0; languages[j].name; ++j)
+			if(!strcmp(argv[i], languages[j].name))
+				break;
+		if(!languages[j].name) {
+			fprintf(stderr, "language %s is not supported\n", argv[i]);
+			exit(2);
+		}
+		benchLanguage(languages[j].name, languages[j].lang);
+		any = 1;
+	}
+
+	if(!any)
+		for(j=0; languages[j].name; ++j)
+			benchLanguage(languages[j].name, languages[j].lang);
+
+	if(failures) {
+		printf("%d golden files differ\n", failures);
+		return 1;
+	}
+	if(!update)
+		printf("all output matches the golden files\n");
+	return 0;
+}
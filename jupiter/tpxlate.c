@@ -18,24 +18,27 @@ reasonably sized sentence.
 
 #include <time.h>
 #include <malloc.h>
+#include <errno.h>
 
 #include "tp.h"
 
-#define appendBackup() (--tp_out->len)
+#define appendBackup() (--tp->out->len)
+/* Put a character on the output.
+ * The offset at the end of the buffer is always valid, carried forward or 0,
+ * so the offset array never has to be cleared in bulk. */
+#define appendRaw(c) (tp->out->offset[tp->out->len+1] = 0, tp->out->buf[tp->out->len++] = (c))
 #define case_different(x, y) (acs_isupper(x) ^ acs_isupper(y))
 
 
 /*********************************************************************
-A few global variables.
-These can be adjusted based on your synthesizer.
+The default context, behind tp_in, tp_out, shortPhrase, and the settings.
+Settings can be adjusted based on your synthesizer.
 *********************************************************************/
 
-char tp_acronUpper = 1; /* acronym letters in upper case? */
-char tp_acronDelim = ' ';
-char tp_oneSymbol; /* read one symbol - not a sentence */
-char tp_readLiteral = 1; // read each punctuation mark
-/* a convenient place to put little phrases to speak */
-char shortPhrase[NEWWORDLEN];
+struct tp_context tp_default = {
+1, ' ', 0, 1,
+&tp_default.tb1, &tp_default.tb2,
+};
 
 
 /*********************************************************************
@@ -514,31 +517,249 @@ static const struct OUTWORDS outwords[6] = {
 
 }};
 
-static const struct OUTWORDS *ow;
-static const char *andWord;
+/*********************************************************************
+The lists that are searched for an exact word, and the 2 and 3 letter
+words, are consulted for nearly every word we read,
+so they are hashed, once per language, the first time a context
+is set up for that language.
+After that the tables are only read, so threads can share them.
+A slot holds the full hash of the word, and its index in the list, plus 1,
+so that 0 is an empty slot.
+Collisions are resolved by the next slot over.
+Equal words land in the same chain, in list order,
+so a lookup returns the first, just as wordInList() does.
+The 2 and 3 letter tables hold no words at all, just the letters,
+packed into the key.
+*********************************************************************/
+
+struct hashslot {
+	unsigned int key;
+	short index;
+};
+
+struct wordhash {
+	const char * const *list;
+	struct hashslot *slot;
+	unsigned int mask;
+	unsigned int lengths; /* a bit for each length of word in the list */
+};
+
+struct tp_langhash {
+	char built;
+	char noreal2; /* no 2 letter words to check against */
+	unsigned int noreal3; /* a bit for each letter without 3 letter words */
+	struct wordhash contractions, nohundred, bigNumbers, slashOrPhrases;
+	struct wordhash real2, real3;
+};
+
+static struct tp_langhash langhash[6];
+
+/* Hash a word, lower case, as acs_substring_mix() would compare it. */
+static unsigned int wordHash(const unsigned int *s, int s_len)
+{
+	unsigned int h = 2166136261u, c;
+	int i;
+	for(i=0; i<s_len; ++i) {
+		c = s[i];
+		if(c < 0x80) {
+			if(c >= 'A' && c <= 'Z') c |= 0x20;
+		} else if(acs_isalpha(c)) c = acs_tolower(c);
+		h = (h ^ c) * 16777619;
+	}
+	return h;
+}
+
+/* The first slot to try; keys of the letter tables are small numbers,
+ * so mix the bits up. */
+static unsigned int hashStart(unsigned int key)
+{
+	key *= 0x9e3779b1;
+	return key ^ (key >> 16);
+}
+
+static int hashAlloc(struct wordhash *h, int n)
+{
+	unsigned int size = 8;
+	while(size < 2*n) size *= 2;
+	h->slot = calloc(size, sizeof(struct hashslot));
+	if(!h->slot) return -1;
+	h->mask = size - 1;
+	return 0;
+}
+
+static void hashAdd(struct wordhash *h, unsigned int key, int index)
+{
+	unsigned int j = hashStart(key);
+	while(h->slot[j & h->mask].index) ++j;
+	h->slot[j & h->mask].key = key;
+	h->slot[j & h->mask].index = index + 1;
+}
+
+static int hashHas(const struct wordhash *h, unsigned int key)
+{
+	const struct hashslot *hs;
+	unsigned int j = hashStart(key);
+	for(; (hs = h->slot + (j & h->mask))->index; ++j)
+		if(hs->key == key) return 1;
+	return 0;
+}
+
+static int hashList(struct wordhash *h, const char * const *list, int max)
+{
+	int i, n, len;
+	unsigned int u[NEWWORDLEN];
+
+	for(n=0; n<max && list[n]; ++n)  ;
+	h->list = list;
+	if(hashAlloc(h, n)) return -1;
+	for(i=0; i<n; ++i) {
+		if(strlen(list[i]) >= NEWWORDLEN) continue; // never happens
+		len = acs_utf82uni((const unsigned char *)list[i], u);
+		hashAdd(h, wordHash(u, len), i);
+		h->lengths |= (len < 32 ? 1<<len : 1);
+	}
+	return 0;
+}
+
+/* Like wordInList(), but the word must match exactly, s_len > 0. */
+static int wordInHash(const struct wordhash *h, const unsigned int *s, int s_len)
+{
+	const struct hashslot *hs;
+	unsigned int key, j;
+
+	/* Most words aren't the right length to be in the list at all. */
+	if(!(h->lengths & (s_len < 32 ? 1<<s_len : 1))) return -1;
+
+	key = wordHash(s, s_len);
+	for(j = hashStart(key); (hs = h->slot + (j & h->mask))->index; ++j) {
+		if(hs->key != key) continue;
+		if(acs_substring_mix(h->list[hs->index-1], s) == s_len)
+			return hs->index-1;
+	}
 
-/* Set things up for tts preprocessing */
+	return -1;
+}
+
+#define LISTMAX(member) (sizeof(((struct OUTWORDS *)0)->member) / sizeof(char*))
+
+static void freeHashes(struct tp_langhash *lh)
+{
+	free(lh->contractions.slot);
+	free(lh->nohundred.slot);
+	free(lh->bigNumbers.slot);
+	free(lh->slashOrPhrases.slot);
+	free(lh->real2.slot);
+	free(lh->real3.slot);
+	memset(lh, 0, sizeof(struct tp_langhash));
+}
+
+static int buildHashes(int lang)
+{
+	struct tp_langhash *lh = langhash + lang;
+	const struct OUTWORDS *ow = outwords + lang;
+	const char *w;
+	int i, n;
+
+	if(lh->built) return 0;
+
+	if(hashList(&lh->contractions, ow->contractions, LISTMAX(contractions)) ||
+	hashList(&lh->nohundred, ow->nohundred, LISTMAX(nohundred)) ||
+	hashList(&lh->bigNumbers, ow->bigNumbers, LISTMAX(bigNumbers)) ||
+	hashList(&lh->slashOrPhrases, ow->slashOrPhrases, LISTMAX(slashOrPhrases)))
+		goto fail;
+
+	w = ow->real2;
+	if(!w) lh->noreal2 = 1, w = "";
+	if(hashAlloc(&lh->real2, strlen(w)/2)) goto fail;
+	for(; *w; w+=2)
+		hashAdd(&lh->real2, (unsigned char)w[0]<<8 | (unsigned char)w[1], 0);
+
+	for(i=n=0; i<26; ++i) {
+		w = ow->real3[i];
+		if(!w) {
+			lh->noreal3 |= (1<<i);
+			continue;
+		}
+		n += strlen(w)/4;
+	}
+	if(hashAlloc(&lh->real3, n)) goto fail;
+	for(i=0; i<26; ++i) {
+		if(!(w = ow->real3[i])) continue;
+		for(; *w; w+=4)
+			hashAdd(&lh->real3, i<<16 | (unsigned char)w[1]<<8 | (unsigned char)w[2], 0);
+	}
+
+	lh->built = 1;
+	return 0;
+
+fail:
+	freeHashes(lh);
+	return -1;
+}
+
+/* Set things up for tts preprocessing.
+ * Settings are copied from another context, if you provide one,
+ * otherwise they stay as they are.
+ * A context is used by one thread at a time,
+ * but separate contexts can run in parallel. */
 int
-setupTTS(void)
+tp_setup(struct tp_context *tp, const struct tp_context *from)
 {
-const int room = 400;
-tp_in->buf = malloc(room * sizeof(unsigned int));
-tp_in->offset = malloc(room * sizeof(acs_ofs_type));
-tp_out->buf = malloc(room * sizeof(unsigned int));
-tp_out->offset = malloc(room * sizeof(acs_ofs_type));
-if(!tp_in->buf || !tp_in->offset || !tp_out->buf || !tp_out->offset)
+const int room = 400; // to start; the buffers grow as needed
+
+if(from && from != tp) {
+tp->acronUpper = from->acronUpper;
+tp->acronDelim = from->acronDelim;
+tp->oneSymbol = from->oneSymbol;
+tp->readLiteral = from->readLiteral;
+}
+
+tp->in = &tp->tb1;
+tp->out = &tp->tb2;
+tp->in->buf = malloc(room * sizeof(unsigned int));
+tp->in->offset = malloc(room * sizeof(acs_ofs_type));
+tp->out->buf = malloc(room * sizeof(unsigned int));
+tp->out->offset = malloc(room * sizeof(acs_ofs_type));
+if(!tp->in->buf || !tp->in->offset || !tp->out->buf || !tp->out->offset) {
+tp_release(tp);
 return -1;
-tp_in->room = room;
-tp_out->room = room;
+}
+tp->in->room = room;
+tp->out->room = room;
+tp->in->len = tp->out->len = 0;
 
-	ow = outwords + acs_lang;
-	andWord = ow->andWord;
+	tp->ow = outwords + acs_lang;
+	tp->andWord = tp->ow->andWord;
 
-//  sortReservedWords();
+if(buildHashes(acs_lang)) {
+tp_release(tp);
+return -1;
+}
+tp->lh = langhash + acs_lang;
 
 return 0;
 }
 
+void
+tp_release(struct tp_context *tp)
+{
+tp_cachesize(tp, 0);
+free(tp->tb1.buf);
+free(tp->tb1.offset);
+free(tp->tb2.buf);
+free(tp->tb2.offset);
+memset(&tp->tb1, 0, sizeof(struct textbuf));
+memset(&tp->tb2, 0, sizeof(struct textbuf));
+}
+
+int
+setupTTS(void)
+{
+if(tp_setup(&tp_default, 0)) return -1;
+tp_cachesize(&tp_default, TP_CACHESIZE);
+return 0;
+}
+
 
 /*********************************************************************
 Turn null into '\n'.
@@ -547,13 +768,13 @@ The name of this function is vestigial; now acting on unicodes,
 so we wouldn't want to ascify the buffer.
 *********************************************************************/
 
-static void ascify(void)
+static void ascify(struct tp_context *tp)
 {
 	unsigned int *s, *end_s;
 	unsigned int  c;
 
-	s =tp_in->buf + 1;
-	end_s = tp_in->buf + tp_in->len;
+	s =tp->in->buf + 1;
+	end_s = tp->in->buf + tp->in->len;
 
 	for(; s < end_s; ++s) {
 		c = *s;
@@ -561,7 +782,7 @@ static void ascify(void)
 		if(c == '\t') goto add_c;
 		if(c == '\n') goto add_c;
 		if(c == '\7')goto add_c;
-		if(!tp_readLiteral) {
+		if(!tp->readLiteral) {
 			/* Treat delete or control character as space */
 			if(c == 0x7f) c = ' ';
 			if(c < ' ') c = ' ';
@@ -580,11 +801,11 @@ add_c:
  * asword = 1, say the word cap before capital letter.
  * asword = 2, a letter is spoken using the nato phonetic alphabet,
  * thus making it clear whether it is m or n. */
-void speakChar(unsigned int c, int sayit, int bellsound, int asword)
+void tp_speakChar(struct tp_context *tp, unsigned int c, int sayit, int bellsound, int asword)
 {
 	short i, l;
 	const char *t;
-	static char ctrlstr[] = "controal x";
+	char ctrlstr[] = "controal x";
 char hexbuf[16];
 
 	if(c == '\7') {
@@ -614,8 +835,8 @@ char hexbuf[16];
 		t = ctrlstr;
 
 copy_t:
-		strcpy((char*)shortPhrase, t);
-		if(sayit) acs_say_string(shortPhrase);
+		strcpy((char*)tp->phrase, t);
+		if(sayit) acs_say_string(tp->phrase);
 		return;
 	} /* control character */
 
@@ -626,14 +847,14 @@ if(t) goto copy_t;
 
 if(acs_isalpha(c) && asword == 2) {
 c = acs_unaccent(c);
-t = ow->natoWords[c-'a'];
+t = tp->ow->natoWords[c-'a'];
 goto copy_t;
 }
 
 if(acs_isalnum(c)) {
 	if(sayit) {
 if(acs_isupper(c) && asword == 1)
-acs_say_string_n(ow->capWord);
+acs_say_string_n(tp->ow->capWord);
 c = acs_tolower(c);
 acs_say_char(c);
 }
@@ -644,55 +865,66 @@ return;
 // We are past getpunc(), guess we don't know how to say this unicode.
 // Just say it in hex.
 sprintf(hexbuf, "%x", c);
-strcpy(shortPhrase, ow->unicodeWord);
-l = strlen(shortPhrase);
+strcpy(tp->phrase, tp->ow->unicodeWord);
+l = strlen(tp->phrase);
 for(i=0; hexbuf[i]; ++i) {
-shortPhrase[l++] = ' ';
-shortPhrase[l++] = hexbuf[i];
+tp->phrase[l++] = ' ';
+tp->phrase[l++] = hexbuf[i];
 }
-shortPhrase[l] = 0;
-			t =  shortPhrase;
+tp->phrase[l] = 0;
+			t =  tp->phrase;
 		goto copy_t;
 }
 
+void speakChar(unsigned int c, int sayit, int bellsound, int asword)
+{
+tp_speakChar(&tp_default, c, sayit, bellsound, asword);
+}
+
 
 /*********************************************************************
 Text buffer structures.
 Holds input text and output text, as transformed by each pass.
 *********************************************************************/
 
-static struct textbuf tb1, tb2;
-
-struct textbuf *tp_in = &tb1, *tp_out = &tb2;
+void tp_switch(struct tp_context *tp)
+{
+	struct textbuf *save;
+	save = tp->in;
+	tp->in = tp->out;
+	tp->out = save;
+	tp->out->buf[0] = 0;
+	tp->out->offset[0] = tp->out->offset[1] = 0;
+	tp->out->len = 1;
+}
 
 void textBufSwitch(void)
 {
-	struct textbuf *save;
-	save = tp_in;
-	tp_in = tp_out;
-	tp_out = save;
-	memset(tp_out->offset, 0, tp_out->room*sizeof(acs_ofs_type));
-	tp_out->buf[0] = 0;
-	tp_out->len = 1;
+tp_switch(&tp_default);
 }
 
-static void carryOffsetForward(const unsigned int *s)
+static void carryOffsetForward(struct tp_context *tp, const unsigned int *s)
 {
-	acs_ofs_type offset = tp_in->offset[s - tp_in->buf];
-	tp_out->offset[tp_out->len] = offset;
+	acs_ofs_type offset = tp->in->offset[s - tp->in->buf];
+	tp->out->offset[tp->out->len] = offset;
 }
 
 /* There's always room for the last zero */
-void textbufClose(const unsigned int *s, int overflow)
+void tp_close(struct tp_context *tp, const unsigned int *s, int overflow)
 {
 	if(overflow) {
 		/* Back up to the start of this token. */
-		while(!tp_out->offset[tp_out->len]) {
+		while(!tp->out->offset[tp->out->len]) {
 			appendBackup();
-			if(tp_out->len == 1) break;
+			if(tp->out->len == 1) break;
 		}
-	} else carryOffsetForward(s);
-	tp_out->buf[tp_out->len] = 0;
+	} else carryOffsetForward(tp, s);
+	tp->out->buf[tp->out->len] = 0;
+}
+
+void textbufClose(const unsigned int *s, int overflow)
+{
+tp_close(&tp_default, s, overflow);
 }
 
 
@@ -733,112 +965,134 @@ times, moneys, phone numbers, etc to the growing buffer.
 They all return 1 if we run out of buffer.
 *********************************************************************/
 
-static int roomCheck(int n)
+/* Make room for n more cells, plus the closing zero.
+ * The storage doubles, and is kept from one sentence to the next,
+ * so after the first few sentences it never moves,
+ * and starting a new sentence is just setting len back to 1. */
+static int bufRoom(struct textbuf *b, unsigned int n)
 {
 	unsigned int *buf;
 	acs_ofs_type *ofs;
-	int room;
-	if(tp_out->len + n < tp_out->room) return 0;
-	room = tp_out->room/3*4;
-	buf = realloc(tp_out->buf, room * sizeof(unsigned int));
+	unsigned int room;
+	if(b->len + n < b->room) return 0;
+	room = b->room;
+	while(b->len + n >= room) room *= 2;
+	buf = realloc(b->buf, room * sizeof(unsigned int));
 	if(!buf) return 1;
-	ofs = realloc(tp_out->offset, room*sizeof(acs_ofs_type));
+	b->buf = buf;
+	ofs = realloc(b->offset, room*sizeof(acs_ofs_type));
 	if(!ofs) return 1;
-	tp_out->buf = buf;
-	tp_out->offset = ofs;
-tp_out->room = room;
+	b->offset = ofs;
+	b->room = room;
 	return 0;
 }
 
-static int appendChar(unsigned int c)
+static int roomCheck(struct tp_context *tp, int n)
 {
-	if(roomCheck(1)) return 1;
-	tp_out->buf[tp_out->len++] = c;
+	return bufRoom(tp->out, n);
+}
+
+/* Make sure the input buffer holds n cells, before you fill it. */
+int tp_inroom(struct tp_context *tp, int n)
+{
+	unsigned int len = tp->in->len;
+	int rc;
+	tp->in->len = 0;
+	rc = bufRoom(tp->in, n);
+	tp->in->len = len;
+	return rc;
+}
+
+static int appendChar(struct tp_context *tp, unsigned int c)
+{
+	if(roomCheck(tp, 1)) return 1;
+	appendRaw(c);
 	return 0;
 }
 
 /* append an isolated char or digit */
-static int appendIchar(unsigned int c)
+static int appendIchar(struct tp_context *tp, unsigned int c)
 {
-	if(roomCheck(2)) return 1;
-	tp_out->buf[tp_out->len++] = c;
-	tp_out->buf[tp_out->len++] = ' ';
+	if(roomCheck(tp, 2)) return 1;
+	appendRaw(c);
+	appendRaw(' ');
 	return 0;
 }
 
 /* Input is lower case utf8, output is the unicode buffer. */
-static int appendString(const char *s)
+static int appendString(struct tp_context *tp, const char *s)
 {
 	int n = strlen(s);
-	if(roomCheck(n+1)) return 1;
-	n = acs_utf82uni(s, tp_out->buf + tp_out->len);
-	tp_out->len += n;
-	tp_out->buf[tp_out->len++] = ' ';
+	if(roomCheck(tp, n+1)) return 1;
+	n = acs_utf82uni(s, tp->out->buf + tp->out->len);
+	memset(tp->out->offset + tp->out->len + 1, 0, n*sizeof(acs_ofs_type));
+	tp->out->len += n;
+	appendRaw(' ');
 	return 0;
 }
 
-static int appendIdigit(int n)
+static int appendIdigit(struct tp_context *tp, int n)
 {
-	return (ow->idigits[n] ?
-appendString(ow->idigits[n]) :
-appendIchar('0'+n));
+	return (tp->ow->idigits[n] ?
+appendString(tp, tp->ow->idigits[n]) :
+appendIchar(tp, '0'+n));
 }
 
 /* Speak a string of digits.
 In espeakup the string reads faster and smoother if it is in words,
 so that's what we do. */
-static int appendDigitString(const unsigned int *s, int n)
+static int appendDigitString(struct tp_context *tp, const unsigned int *s, int n)
 {
 	unsigned int c;
 	while(n--) {
 		c = *s++;
-		if(appendIdigit(c-'0')) return 1;
+		if(appendIdigit(tp, c-'0')) return 1;
 	}
 	return 0;
 }
 
-static void lastUncomma(void)
+static void lastUncomma(struct tp_context *tp)
 {
-	int len = tp_out->len;
-	acs_ofs_type offset = tp_out->offset[len];
-	unsigned int *s = tp_out->buf + len - 1;
+	int len = tp->out->len;
+	acs_ofs_type offset = tp->out->offset[len];
+	unsigned int *s = tp->out->buf + len - 1;
 	unsigned int c = *s;
 	while(c == ' ') --len, c = *--s;
 	if(c != ',') return;
 	--len;
-	tp_out->offset[len] = offset;
-	tp_out->len = len;
+	tp->out->offset[len] = offset;
+	tp->out->len = len;
 }
 
-static int appendAcronString(const char *s)
+static int appendAcronString(struct tp_context *tp, const char *s)
 {
 	char c;
 	int n = strlen(s);
-	if(roomCheck(2*n)) return 1;
+	if(roomCheck(tp, 2*n)) return 1;
 	while(n--) {
 		c = *s++;
 		/* we assume c is an ascii letter */
-		if(tp_acronUpper) c &= 0xdf;
+		if(tp->acronUpper) c &= 0xdf;
 		else c |= 0x20;
-		tp_out->buf[tp_out->len++] = c;
-		c = (n ? tp_acronDelim : ' ');
-		tp_out->buf[tp_out->len++] = c;
+		appendRaw(c);
+		c = (n ? tp->acronDelim : ' ');
+		appendRaw(c);
 	}
 	return 0;
 }
 
-static int appendAcronCodes(const unsigned int *s, int n)
+static int appendAcronCodes(struct tp_context *tp, const unsigned int *s, int n)
 {
 	unsigned int c;
-	if(roomCheck(2*n)) return 1;
+	if(roomCheck(tp, 2*n)) return 1;
 	while(n--) {
 		c = *s++;
 		/* we assume c is alpha */
-		if(tp_acronUpper) c = acs_toupper(c);
+		if(tp->acronUpper) c = acs_toupper(c);
 		else c = acs_tolower(c);
-		tp_out->buf[tp_out->len++] = c;
-		c = (n ? tp_acronDelim : ' ');
-		tp_out->buf[tp_out->len++] = c;
+		appendRaw(c);
+		c = (n ? tp->acronDelim : ' ');
+		appendRaw(c);
 	}
 	return 0;
 }
@@ -846,13 +1100,13 @@ static int appendAcronCodes(const unsigned int *s, int n)
 /* Read a natural number, up to 3 digits. */
 /* The dohundred parameter indicates 2 hundred 3 or 2 oh 3. */
 /* The zero parameter indicates whether 0 will be read. */
-static int append3num(int n, int dohundred, int zero)
+static int append3num(struct tp_context *tp, int n, int dohundred, int zero)
 {
 	const char *q;
 	int rc = 0;
 
 	if(!n) {
-		if(zero) return appendIdigit(0);
+		if(zero) return appendIdigit(tp, 0);
 		return 0;
 	}
 
@@ -860,68 +1114,68 @@ static int append3num(int n, int dohundred, int zero)
 if(acs_lang == ACS_LANG_PT_BR || acs_lang == ACS_LANG_SK) {
 char buf[4];
 sprintf(buf, "%d", n);
-return appendString(buf);
+return appendString(tp, buf);
 }
 
 	if(n >= 100) {
-		rc |= appendIdigit(n/100);
+		rc |= appendIdigit(tp, n/100);
 		n %= 100;
 		if(!n) dohundred = 1;
 // Don't think there is anything like 2 oh 3 in languages other than english.
 		if(acs_lang != ACS_LANG_EN) dohundred = 1;
-		if(dohundred) rc |= appendString(ow->hundredWord); 
-		else if(n < 10) rc |= appendString(ow->ohWord);
+		if(dohundred) rc |= appendString(tp, tp->ow->hundredWord); 
+		else if(n < 10) rc |= appendString(tp, tp->ow->ohWord);
 		if(!n) return rc;
 	} /* hundreds */
 
-	if(n < 10) return appendString(ow->idigits[n]);
-	if(n < 20) return appendString(ow->teens[n-10]);
+	if(n < 10) return appendString(tp, tp->ow->idigits[n]);
+	if(n < 20) return appendString(tp, tp->ow->teens[n-10]);
 
-		q = ow->decades[n/10 - 2];
+		q = tp->ow->decades[n/10 - 2];
 		n %= 10;
-		if(!n) return appendString(q);
+		if(!n) return appendString(tp, q);
 
 if(acs_lang == ACS_LANG_DE) {
-rc |= appendString(ow->idigits[n]);
-		rc |= appendString(ow->andWord);
-		rc |= appendString(q);
+rc |= appendString(tp, tp->ow->idigits[n]);
+		rc |= appendString(tp, tp->ow->andWord);
+		rc |= appendString(tp, q);
 } else {
-		rc |= appendString(q);
-rc |= appendString(ow->idigits[n]);
+		rc |= appendString(tp, q);
+rc |= appendString(tp, tp->ow->idigits[n]);
 	}
 
 	return rc;
 }
 
 /* read 09 as O 9, and 00 as o o */
-static int appendOX(int n)
+static int appendOX(struct tp_context *tp, int n)
 {
 	int rc = 0;
-	if(n < 10) rc |= appendString(ow->ohWord);
-	if(n) rc |= append3num(n, 0, 0);
-	else rc |= appendString(ow->ohWord);
+	if(n < 10) rc |= appendString(tp, tp->ow->ohWord);
+	if(n) rc |= append3num(tp, n, 0, 0);
+	else rc |= appendString(tp, tp->ow->ohWord);
 	return rc;
 }
 
 /* Read a 4 digit number as a year. */
 /* This is optimal for other 4-digit numbers, such as house numbers etc. */
-static int appendYear(int y)
+static int appendYear(struct tp_context *tp, int y)
 {
 	int rc = 0;
 
 if(acs_lang == ACS_LANG_PT_BR || acs_lang == ACS_LANG_SK) {
 char buf[6];
 sprintf(buf, "%d", y);
-return appendString(buf);
+return appendString(tp, buf);
 }
 
 	if(!((y%1000) / 100)) {
 		if(y >= 1000) {
-			rc |= appendIdigit(y/1000);
-			rc |= appendString(ow->thousandWord);
+			rc |= appendIdigit(tp, y/1000);
+			rc |= appendString(tp, tp->ow->thousandWord);
 		}
 		y %= 100;
-		rc |= append3num(y, 0, 0);
+		rc |= append3num(tp, y, 0, 0);
 		return rc;
 	} /* in the year 2007 */
 
@@ -935,75 +1189,75 @@ y%= 100;
 yd[2] = y / 10 + '0';
 y%= 10;
 yd[3] = y + '0';
-return appendDigitString(yd, 4);
+return appendDigitString(tp, yd, 4);
 }
 
-	rc |= append3num(y/100, 0, 0); /* century */
+	rc |= append3num(tp, y/100, 0, 0); /* century */
 	y %= 100;
-	if(!y) rc |= appendString(ow->hundredWord);
-	else rc |= appendOX(y);
+	if(!y) rc |= appendString(tp, tp->ow->hundredWord);
+	else rc |= appendOX(tp, y);
 	return rc;
 }
 
 /* Read a natural number, up to 6 digits. */
-static int append6num(int n)
+static int append6num(struct tp_context *tp, int n)
 {
 	int rc = 0;
 	int top = n/1000;
 	int bottom = n%1000;
-	if(top < 10) return appendYear(n);
+	if(top < 10) return appendYear(tp, n);
 	if(top) {
-		rc |= append3num(top, 1, 0);
-		rc |= appendString(ow->thousandWord);
+		rc |= append3num(tp, top, 1, 0);
+		rc |= appendString(tp, tp->ow->thousandWord);
 	}
-	rc |= append3num(bottom, 1, (int)!top);
+	rc |= append3num(tp, bottom, 1, (int)!top);
 	return rc;
 }
 
 /* append 3-digit ordinal, such as first, or seventeenth */
-static int appendOrdinal(int n)
+static int appendOrdinal(struct tp_context *tp, int n)
 {
 	int rc = 0;
 
 	if(n >= 100) {
-		rc |= appendIdigit(n/100);
+		rc |= appendIdigit(tp, n/100);
 		n %= 100;
-		if(!n) { rc |= appendString(ow->hundredthWord); return rc; }
-		rc |= appendString(ow->hundredWord);
+		if(!n) { rc |= appendString(tp, tp->ow->hundredthWord); return rc; }
+		rc |= appendString(tp, tp->ow->hundredWord);
 	}
 
 	if(n < 20) {
-		rc |= appendString(ow->ordinals[n]);
+		rc |= appendString(tp, tp->ow->ordinals[n]);
 		return rc;
 	}
 
 	if(n%10 == 0) {
-		rc |= appendString(ow->orddecades[n/10-2]);
+		rc |= appendString(tp, tp->ow->orddecades[n/10-2]);
 		return rc;
 	}
 
 	/* write the decade first */
-	rc |= appendString(ow->decades[n/10 - 2]);
-	rc |= appendString(ow->ordinals[n%10]);
+	rc |= appendString(tp, tp->ow->decades[n/10 - 2]);
+	rc |= appendString(tp, tp->ow->ordinals[n%10]);
 	return rc;
 }
 
 /* read the nxx and xxxx of a phone number */
-static int appendNxx(int n)
+static int appendNxx(struct tp_context *tp, int n)
 {
 	int rc = 0;
 	int h = n/100; /* h is nonzero */
 	n %= 100;
-	rc |= appendIdigit(h);
-	if(!n) rc |= appendString(ow->hundredWord);
+	rc |= appendIdigit(tp, h);
+	if(!n) rc |= appendString(tp, tp->ow->hundredWord);
 	else {
-		rc |= appendIdigit(n/10);
-		rc |= appendIdigit(n%10);
+		rc |= appendIdigit(tp, n/10);
+		rc |= appendIdigit(tp, n%10);
 	}
 	return 0;
 }
 
-static int appendXxxx(int n)
+static int appendXxxx(struct tp_context *tp, int n)
 {
 	int rc = 0;
 	int t, h; /* thousands, hundreds */
@@ -1015,51 +1269,51 @@ static int appendXxxx(int n)
 
 	if(h) {
 		if(t && (n/10 || !n)) {
-			rc |= append3num(t*10 + h, 0, 0);
+			rc |= append3num(tp, t*10 + h, 0, 0);
 		} else {
-			rc |= appendIdigit(t);
-			rc |= appendIdigit(h);
+			rc |= appendIdigit(tp, t);
+			rc |= appendIdigit(tp, h);
 		}
 
 		if(!n) {
-			rc |= appendString(ow->hundredWord);
+			rc |= appendString(tp, tp->ow->hundredWord);
 			return rc;
 		}
 
 		if(t && n/10) {
-			rc |= append3num(n, 0, 0);
+			rc |= append3num(tp, n, 0, 0);
 		} else {
-			rc |= appendIdigit(n/10);
-			rc |= appendIdigit(n%10);
+			rc |= appendIdigit(tp, n/10);
+			rc |= appendIdigit(tp, n%10);
 		}
 
 		return rc;
 	} /* second digit is nonzero */
 
-	rc |= appendIdigit(t);
+	rc |= appendIdigit(tp, t);
 
 	if(!n) {
-		if(t) rc |= appendString(ow->thousandWord);
-		else rc |= appendString("0 0 0");
+		if(t) rc |= appendString(tp, tp->ow->thousandWord);
+		else rc |= appendString(tp, "0 0 0");
 		return rc;
 	} /* ends in 000 */
 
-	rc |= appendIdigit(0);
-	rc |= appendIdigit(n/10);
-	rc |= appendIdigit(n%10);
+	rc |= appendIdigit(tp, 0);
+	rc |= appendIdigit(tp, n/10);
+	rc |= appendIdigit(tp, n%10);
 	return rc;
 }
 
-static int appendFraction(int num, int den, int preand)
+static int appendFraction(struct tp_context *tp, int num, int den, int preand)
 {
 	int rc = 0;
-	if(preand) rc |= appendString(ow->andWord);
-	rc |= append3num(num, 1, 1);
+	if(preand) rc |= appendString(tp, tp->ow->andWord);
+	rc |= append3num(tp, num, 1, 1);
 	if(den > 1) {
-		if(den == 2) rc |= appendString(ow->halfWord);
-		else rc |= appendOrdinal(den);
+		if(den == 2) rc |= appendString(tp, tp->ow->halfWord);
+		else rc |= appendOrdinal(tp, den);
 	}
-	if(num > 1) { appendBackup(); rc |= appendIchar('s'); }
+	if(num > 1) { appendBackup(); rc |= appendIchar(tp, 's'); }
 	return rc;
 }
 
@@ -1070,8 +1324,7 @@ static int alphaLength(const unsigned int *s)
 	return len;
 }
 
-static const unsigned int *atoi_s;
-static int atoiLength(const unsigned int *s, int len)
+static int atoiLength(struct tp_context *tp, const unsigned int *s, int len)
 {
 	int n = 0;
 	while(len--) {
@@ -1079,7 +1332,7 @@ static int atoiLength(const unsigned int *s, int len)
 		n = 10*n + *s - '0';
 		++s;
 	}
-	atoi_s = s;
+	tp->atoi_s = s;
 	return n;
 }
 
@@ -1096,7 +1349,7 @@ static int atoiLength(const unsigned int *s, int len)
  * Zeroflag indicates 0 dollars.
  * Oneflag indicates 1 dollar.
  * If the number of cents is negative, cents were not specified. */
-static int appendMoney(int zeroflag, int oneflag, int cents, const unsigned int *q)
+static int appendMoney(struct tp_context *tp, int zeroflag, int oneflag, int cents, const unsigned int *q)
 {
 	int rc = 0;
 	int pluralflag = 1;
@@ -1105,18 +1358,18 @@ static int appendMoney(int zeroflag, int oneflag, int cents, const unsigned int
 	const unsigned int *s = q;
 
 	if(zeroflag && cents <= 0)
-		rc |= appendIdigit(0);
+		rc |= appendIdigit(tp, 0);
 
 	/* print dollar or dollars */
 	if(!zeroflag || (zeroflag && cents <= 0)) {
-		rc |= appendString(~oneflag & pluralflag ? ow->dollarsWord : ow->dollarWord);
-		if(cents > 0) rc |= appendString(ow->andWord);
+		rc |= appendString(tp, ~oneflag & pluralflag ? tp->ow->dollarsWord : tp->ow->dollarWord);
+		if(cents > 0) rc |= appendString(tp, tp->ow->andWord);
 	} /* print dollars */
 
 	if(cents > 0) {
 		oneflag = (cents == 1);
-		rc |= append3num(cents, 0, 0);
-		rc |= appendString(~oneflag & pluralflag ? ow->centsWord : ow->centWord);
+		rc |= append3num(tp, cents, 0, 0);
+		rc |= appendString(tp, ~oneflag & pluralflag ? tp->ow->centsWord : tp->ow->centWord);
 	} /* print cents */
 
 	return rc;
@@ -1149,41 +1402,36 @@ rather than saying t.a.m.
 *********************************************************************/
 
 /* is a 2-letter word native? */
-static int isWord2(const unsigned int *s)
+static int isWord2(struct tp_context *tp, const unsigned int *s)
 {
 	char c1 = acs_unaccent(s[0]);
 	char c2 = acs_unaccent(s[1]);
-const char *w = ow->real2;
 
-if(!w) return 1; // nothing to check against
-
-	for(; *w; w+=2)
-		if(w[0] == c1 && w[1] == c2) return 1;
+if(tp->lh->noreal2) return 1; // nothing to check against
 
-	return 0;
+	return hashHas(&tp->lh->real2, (unsigned char)c1<<8 | (unsigned char)c2);
 }
 
 
-static int isWord3(const unsigned int *s)
+static int isWord3(struct tp_context *tp, const unsigned int *s)
 {
 unsigned int c0;
 	char c1 = acs_unaccent(s[0]);
 	char c2 = acs_unaccent(s[1]);
 	char c3 = acs_unaccent(s[2]);
-	int lowbit = acs_islower(s[0]) | acs_islower(s[1]) | acs_islower(s[2]);
+	int lowbit;
 	short i;
-const char *w;
+unsigned int letter;
 
 if(c1 == ' ') return 0; // should not happen
 
-w = ow->real3[(c1|0x20)-'a'];
-if(!w) return -1; // nothing to check against
-
-	for(; *w; w+=4) {
-		if(w[1] != c2) continue;
-		if(w[2] != c3) continue;
+letter = (c1|0x20)-'a';
+if(letter >= 26 || (tp->lh->noreal3 & (1<<letter)))
+return -1; // nothing to check against
 
+	if(hashHas(&tp->lh->real3, letter<<16 | (unsigned char)c2<<8 | (unsigned char)c3)) {
 		/* we've got the right 3 letters */
+		lowbit = acs_islower(s[0]) | acs_islower(s[1]) | acs_islower(s[2]);
 		c1 = s[3];
 		if(c1 == ' ') return 1;
 		if(lowbit) return 1;
@@ -1197,7 +1445,7 @@ return 0;
 		}
 
 		return 1;
-	} /* loop looking for this 3-letter word */
+	} /* this 3-letter word is in the table */
 
 	return 0;
 }
@@ -1249,8 +1497,8 @@ static const unsigned char letterPairs[26][32] = {
 
 static int transitionValue(char x, char y)
 {
-	/* paranoia */
-	if(x == ' ' || y == ' ') return 0;
+	/* paranoia; this also catches letters that don't unaccent to a-z */
+	if(x < 'a' || x > 'z' || y < 'a' || y > 'z') return 0;
 	return letterPairs[x-'a'][y-'a'];
 }
 
@@ -1298,7 +1546,7 @@ static const char *icc3[] = {
 static const char *icc4[] = {
 "schl","schr","schw",0};
 
-static int isPronounceable(const unsigned int *s, int len)
+static int isPronounceable(struct tp_context *tp, const unsigned int *s, int len)
 {
 	int i, cnt;
 	char c1, c2, c3;
@@ -1332,11 +1580,11 @@ static int isPronounceable(const unsigned int *s, int len)
 	}
 
 	/* word must be in the list to be pronunceable */
-return wordInList(ow->contractions, s, len) >= 0;
+return wordInHash(&tp->lh->contractions, s, len) >= 0;
 
 	no_apos:
 	if(len == 1) return 1;
-	if(len == 2) return isWord2(s);
+	if(len == 2) return isWord2(tp, s);
 
 	/* Simple vowel check */
 	c1 = 0;
@@ -1354,7 +1602,7 @@ return wordInList(ow->contractions, s, len) >= 0;
 	} /* upper lower */
 
 	if(len == 3) {
-i = isWord3(s);
+i = isWord3(tp, s);
 if(i >= 0) return i;
 }
 
@@ -1411,7 +1659,7 @@ Return 1 on overflow.
 Pass back the updated pointer, just after the input token.
 *********************************************************************/
 
-static int expandAlphaNumeric(unsigned int **sp)
+static int expandAlphaNumeric(struct tp_context *tp, unsigned int **sp)
 {
 	unsigned int c, d, e, f;
 	unsigned int *start = *sp, *end; /* bracket the token */
@@ -1457,7 +1705,7 @@ if(			(g == '0' && e == 't') ||
 			(g == '3' && (e == 'r' || (end > start+1 && e == 't'))) ||
 			(g > '3' && e == 't')) {
 				end += 2;
-				if(appendOrdinal(i)) goto overflow;
+				if(appendOrdinal(tp, i)) goto overflow;
 				goto success;
 			} /* correct ending for a one-digit number */
 		} /* ends in st or nd or rd or th */
@@ -1465,7 +1713,7 @@ if(			(g == '0' && e == 't') ||
 
 	/* find the start and end of this number */
 	if(d == ',' || d == '.' || acs_isalpha(d) ||
-	tp_oneSymbol) comma = start;
+	tp->oneSymbol) comma = start;
 	if(d == '-' && acs_isalnum(start[-2])) comma = start;
 	if(c == '0') comma = start;
 	for(end=start+1; (e = *end); ++end) {
@@ -1489,7 +1737,7 @@ if(			(g == '0' && e == 't') ||
 		if(e == '-' && acs_isalnum(end[1])) comma = start;
 		if(end - start > 19) comma = start; /* I don't do trillions */
 		/* int foo[] = {237,485,193,221}; */
-		if(tp_readLiteral && end - start > 7) comma = start;
+		if(tp->readLiteral && end - start > 7) comma = start;
 	}
 
 	/* Bad comma arrangement?  Read each component. */
@@ -1513,15 +1761,15 @@ if(			(g == '0' && e == 't') ||
 			if(i) zeroflag = 0;
 			if(start == end && i != 1) oneflag = 0;
 			if(start < end && i) oneflag = 0;
-			if(append3num(i, 1, 0)) goto overflow;
+			if(append3num(tp, i, 1, 0)) goto overflow;
 			if(i && start < end) {
 				i = (end-start) / 4 - 1;
-				if(appendString(ow->bigNumbers[i])) goto overflow;
+				if(appendString(tp, tp->ow->bigNumbers[i])) goto overflow;
 			}
 			++start;
 		} /* loop over groups of 3 */
 		if(d == '$') goto money;
-		if(zeroflag && appendIdigit(0)) goto overflow;
+		if(zeroflag && appendIdigit(tp, 0)) goto overflow;
 		goto success;
 	} /* comma formatted number */
 
@@ -1531,12 +1779,12 @@ if(			(g == '0' && e == 't') ||
 		if(acs_isalpha(d) || acs_isalpha(e) ||
 		(d == '.' && acs_isalnum(start[-2])) ||
 		(e == '.' && acs_isalnum(end[1]))) {
-			i = atoiLength(start, 4);
-			if(appendYear(i)) goto overflow;
-			i = atoiLength(start+4, 2);
-			if(appendOX(i)) goto overflow;
-			i = atoiLength(start+6, 2);
-			if(appendOX(i)) goto overflow;
+			i = atoiLength(tp, start, 4);
+			if(appendYear(tp, i)) goto overflow;
+			i = atoiLength(tp, start+4, 2);
+			if(appendOX(tp, i)) goto overflow;
+			i = atoiLength(tp, start+6, 2);
+			if(appendOX(tp, i)) goto overflow;
 			goto success;
 		} /* number part of a larger token */
 	} /* 19yymmdd */
@@ -1557,9 +1805,9 @@ if(			(g == '0' && e == 't') ||
 		do { --q; } while(acs_isdigit(*q));
 		if(*q != '.') goto copydigits;
 copynumber:
-		value = atoiLength(start, end-start);
-		if(appendYear(value)) goto overflow;
-		if(!value && appendIdigit(0)) goto overflow;
+		value = atoiLength(tp, start, end-start);
+		if(appendYear(tp, value)) goto overflow;
+		if(!value && appendIdigit(tp, 0)) goto overflow;
 		goto success;
 	} /* leading decimal point */
 
@@ -1591,11 +1839,11 @@ copynumber:
 
 	/* speak the number naturally */
 	i = end - start;
-	value = atoiLength(start, i);
+	value = atoiLength(tp, start, i);
 	zeroflag = !value;
 	oneflag = (value == 1);
 	if(i == 4) {
-		if(appendYear(value)) goto overflow;
+		if(appendYear(tp, value)) goto overflow;
 		if(d == '$' && i < 4) goto money;
 		appendBackup();
 		goto possessive; /* the 1970's */
@@ -1615,7 +1863,7 @@ copynumber:
 			q = start-2;
 			i = 0;
 			do --q, ++i; while(acs_isalpha(*q));
-			if(wordInList(ow->nohundred, ++q, i) >= 0)
+			if(wordInHash(&tp->lh->nohundred, ++q, i) >= 0)
 				hundredflag = 0;
 			goto past3;
 		}
@@ -1625,22 +1873,22 @@ copynumber:
 	} /* three digits */
 past3:
 
-	if(append3num(value, hundredflag, 0)) goto overflow;
-	if(d == '$' && !tp_oneSymbol) {
-		if(!tp_readLiteral) goto money;
+	if(append3num(tp, value, hundredflag, 0)) goto overflow;
+	if(d == '$' && !tp->oneSymbol) {
+		if(!tp->readLiteral) goto money;
 		if(end-start == 2 || end-start == 3) goto money;
 		if(e == '.' && acs_isdigit(end[1])) goto money;
 		/* read $3 as dollar three, a positional parameter */
 	}
-	if(zeroflag && appendIdigit(0)) goto overflow;
+	if(zeroflag && appendIdigit(tp, 0)) goto overflow;
 
 	appendBackup();
 	goto possessive;
 
 copydigits:
-	if(d == '$' && !tp_readLiteral &&
-	appendString(ow->dollarWord)) goto overflow;
-	if(appendDigitString(start, end-start)) goto overflow;
+	if(d == '$' && !tp->readLiteral &&
+	appendString(tp, tp->ow->dollarWord)) goto overflow;
+	if(appendDigitString(tp, start, end-start)) goto overflow;
 	appendBackup();
 	goto possessive;
 
@@ -1666,7 +1914,7 @@ money:
 			/* This is rather unusual; we use bigNumber[]
 			 * for both input and output. */
 			if(j > 1) {
-				moneySuffix = wordInList( ow->bigNumbers, q, j);
+				moneySuffix = wordInHash(&tp->lh->bigNumbers, q, j);
 			} else if(!acs_isalnum(q[1])) {
 				e = acs_toupper(e);
 				if(e == 'K') moneySuffix = 0;
@@ -1676,15 +1924,15 @@ money:
 			if(moneySuffix >= 0) {
 				q += j;
 				if(i > 0) {
-					if(appendString(ow->pointWord)) goto overflow;
-					if(i >= 10 && appendIdigit(i/10)) goto overflow;
+					if(appendString(tp, tp->ow->pointWord)) goto overflow;
+					if(i >= 10 && appendIdigit(tp, i/10)) goto overflow;
 					if(i < 10 && end[1] == '0'&&
-					appendString(ow->ohWord)) goto overflow;
+					appendString(tp, tp->ow->ohWord)) goto overflow;
 					i %= 10;
-					if(appendIdigit(i)) goto overflow;
+					if(appendIdigit(tp, i)) goto overflow;
 				} /* point xx */
-				if(appendString(ow->bigNumbers[moneySuffix])) goto overflow;
-				if(appendMoney(0, 0, -1, q)) goto overflow;
+				if(appendString(tp, tp->ow->bigNumbers[moneySuffix])) goto overflow;
+				if(appendMoney(tp, 0, 0, -1, q)) goto overflow;
 				end = q;
 				goto success;
 			} /* valid money suffix */
@@ -1696,10 +1944,10 @@ money:
 	if(*end == '.' &&
 	acs_isdigit(end[1]) && acs_isdigit(end[2]) &&
 	!acs_isdigit(end[3])) {
-		i = atoiLength(end+1, 2);
+		i = atoiLength(tp, end+1, 2);
 	end += 3;
 	} /* .xx follows */
-	if(appendMoney(zeroflag, oneflag, i, end)) goto overflow;
+	if(appendMoney(tp, zeroflag, oneflag, i, end)) goto overflow;
 	goto success;
 
 alphaToken:
@@ -1712,7 +1960,7 @@ alphaToken:
 	if(c == 'p' &&
 	acs_substring_mix((char*)"ph.d", start) > 0 &&
 	!acs_isalnum(start[4])) {
-		if(appendAcronString((char*)"phd")) goto overflow;
+		if(appendAcronString(tp, (char*)"phd")) goto overflow;
 		end = start + 4;
 		goto success;
 	}
@@ -1722,25 +1970,25 @@ alphaToken:
 	while(end[1] == '.' && acs_isalpha(end[2]))
 		end += 2;
 	if(end - start >= 2 && !acs_isalnum(end[1])) {
-		if(!tp_readLiteral || end - start > 2 || acs_isupper(*start)) {
+		if(!tp->readLiteral || end - start > 2 || acs_isupper(*start)) {
 			++end;
 			/* check for e.g. and i.e. */
 			d = acs_tolower(start[2]);
 			if(c == 'e' && d == 'g') {
-				if(appendString(ow->egWord)) goto overflow;
+				if(appendString(tp, tp->ow->egWord)) goto overflow;
 				goto success;
 			}
 			if(c == 'i' && d == 'e') {
-				if(appendString(ow->ieWord)) goto overflow;
+				if(appendString(tp, tp->ow->ieWord)) goto overflow;
 				goto success;
 			}
 			/* speak each letter */
 			for(; start < end; start+=2) {
 				c = *start;
-				if(tp_acronUpper) c = acs_toupper(c);
+				if(tp->acronUpper) c = acs_toupper(c);
 				else c = acs_tolower(c);
-				if(appendIchar(c)) goto overflow;
-				if(start < end-1) tp_out->buf[tp_out->len-1] = tp_acronDelim;
+				if(appendIchar(tp, c)) goto overflow;
+				if(start < end-1) tp->out->buf[tp->out->len-1] = tp->acronDelim;
 			}
 			appendBackup();
 			goto possessive;
@@ -1779,7 +2027,7 @@ alphaToken:
 
 	/* strip out trailing apostrophes */
 	while(acs_unaccent(end[-1]) == '\'') {
-		if(end-start >= 5 && !tp_readLiteral &&
+		if(end-start >= 5 && !tp->readLiteral &&
 		acs_tolower(end[-2]) == 'n' &&
 		acs_tolower(end[-3]) == 'i') {
 			f = 'G';
@@ -1820,9 +2068,10 @@ alphaToken:
 		ur = acs_replace(start, end-start);
 		if(ur) {
 			j = acs_unilen(ur);
-			if(roomCheck(j)) goto overflow;
-			memcpy(tp_out->buf + tp_out->len, ur, j*sizeof(unsigned int));
-			tp_out->len += j;
+			if(roomCheck(tp, j)) goto overflow;
+			memcpy(tp->out->buf + tp->out->len, ur, j*sizeof(unsigned int));
+			memset(tp->out->offset + tp->out->len + 1, 0, j*sizeof(acs_ofs_type));
+			tp->out->len += j;
 			goto possessive;
 		} /* user replaced the entire word */
 		if(!casecut) break;
@@ -1836,7 +2085,7 @@ alphaToken:
 		/* If it's not a native word, or it has yet more apostrophes
 		 * around it, read each component. */
 		if(acs_unaccent(d) == '\'' || acs_unaccent(d) == '\'' ||
-		!isPronounceable(start, end-start))
+		!isPronounceable(tp, start, end-start))
 			end = apos, apos = 0, e = '\'';
 	} /* interior apostrophe */
 
@@ -1861,12 +2110,12 @@ alphaToken:
 		}
 		i = strlen(leadLetters);
 		if(i) {
-			if(appendAcronString(leadLetters)) goto overflow;
+			if(appendAcronString(tp, leadLetters)) goto overflow;
 			start += i;
 		}
 	} /* followed by @ */
 
-	if(isPronounceable(start, end-start)) goto copyword;
+	if(isPronounceable(tp, start, end-start)) goto copyword;
 
 	/* Don't bother spelling out long words;
 	 * the user hasn't got the time or the patience. */
@@ -1882,7 +2131,7 @@ alphaToken:
 	}
 
 acronym:
-	rc = appendAcronCodes(start, end-start);
+	rc = appendAcronCodes(tp, start, end-start);
 	if(rc) goto overflow;
 	appendBackup();
 	goto possessive;
@@ -1892,7 +2141,7 @@ copyword:
 	for(; start<end; ++start) {
 		c = *start;
 		if(acs_isalpha(c)) c = acs_tolower(c);
-		if(appendChar(c)) goto overflow;
+		if(appendChar(tp, c)) goto overflow;
 	}
 
 possessive:
@@ -1901,23 +2150,23 @@ possessive:
 	if(e == 's' && !acs_isalnum(end[1]) &&
 	acs_isalpha(end[-1])) {
 		++end;
-		if(appendString("'s")) goto overflow;
+		if(appendString(tp, "'s")) goto overflow;
 		goto success;
 	}
 
 	/* check for 's or 'll */
 	if(acs_unaccent(e) == '\'' && acs_tolower(end[1]) == 's' && !acs_isalnum(end[2])) {
 		end += 2;
-		if(appendString("'s")) goto overflow;
+		if(appendString(tp, "'s")) goto overflow;
 		goto success;
 	}
 	if(acs_unaccent(e) == '\'' && acs_tolower(end[1]) == 'l' && end[1] == end[2] && !acs_isalnum(end[3])) {
 		end += 3;
-		if(appendString("'ll")) goto overflow;
+		if(appendString(tp, "'ll")) goto overflow;
 		goto success;
 	}
 
-	appendChar(' ');
+	appendChar(tp, ' ');
 
 success:
 	*sp = end;
@@ -1943,7 +2192,7 @@ Pass back the updated pointer, just after the punctuation mark,
 or passed any additional characters that are swallowed.
 *********************************************************************/
 
-static int expandPunct(const unsigned int **sp)
+static int expandPunct(struct tp_context *tp, const unsigned int **sp)
 {
 	unsigned int c, d, e;
 	const unsigned int *s = *sp;
@@ -1956,18 +2205,18 @@ static int expandPunct(const unsigned int **sp)
 	d = s[-1];
 	e = s[1];
 
-	if(tp_readLiteral) {
+	if(tp->readLiteral) {
 		/* Here are the exceptions */
-		if(tp_oneSymbol |c >= 0x80 || !strchr(".^$", (char)c)) {
+		if(tp->oneSymbol |c >= 0x80 || !strchr(".^$", (char)c)) {
 do_punct:
 			d = acs_unaccent(c);
-			if(!tp_oneSymbol &&
+			if(!tp->oneSymbol &&
 			!acs_getpunc(c) &&
 			c >= 0x100 &&
 			!isalnum(d))
 				c = d;
-			speakChar(c, 0, 0, 0);
-				if(appendString(shortPhrase)) goto overflow;
+			tp_speakChar(tp, c, 0, 0, 0);
+				if(appendString(tp, tp->phrase)) goto overflow;
 			goto success;
 		}
 	}
@@ -1977,14 +2226,14 @@ do_punct:
 		if(tolower(e) == 's' && s[2] == ')' && acs_isalpha(d)) {
 			/* fill out the form(s) */
 			appendBackup();
-			if(appendIchar('s')) goto overflow;
+			if(appendIchar(tp, 's')) goto overflow;
 			++end;
 			break;
 		}
 
 	case '[': case '{':
 		if(acs_isspace(d)) {
-			do_comma: if(appendIchar(',')) goto overflow;
+			do_comma: if(appendIchar(tp, ',')) goto overflow;
 		}
 		break;
 
@@ -2020,7 +2269,7 @@ do_punct:
 		 * Turn word-I into word.I */
 		if(acs_isalpha(d) && acs_isalnum(e)) {
 			if(e == 'I' && acs_isalpha(s[-2]) && acs_isspace(s[2])) {
-				if(appendIchar('.')) goto overflow;
+				if(appendIchar(tp, '.')) goto overflow;
 			}
 			break;
 		}
@@ -2033,7 +2282,7 @@ do_punct:
 		if(acs_isspace(d) &&
 		(acs_isalnum(e) || e == '$')) {
 			if(acs_isalpha(e) && acs_isalpha(end[1])) break;
-			if(appendString(ow->minusWord)) goto overflow;
+			if(appendString(tp, tp->ow->minusWord)) goto overflow;
 			break;
 		}
 
@@ -2049,7 +2298,7 @@ do_punct:
 			for(len=1; len<6; ++len)
 				if(!acs_isdigit(s[len])) break;
 			rightlen = len;
-			if(len < 6) rightnum = atoiLength(s, len);
+			if(len < 6) rightnum = atoiLength(tp, s, len);
 			c = s[len];
 			if(acs_isalpha(c) || c == '-') rightnum = -1;
 		}
@@ -2057,7 +2306,7 @@ do_punct:
 			for(len=1; len<6; ++len)
 				if(!acs_isdigit(t[-len])) break;
 			leftlen = len;
-			if(len < 6) leftnum = atoiLength(t-len+1, len);
+			if(len < 6) leftnum = atoiLength(tp, t-len+1, len);
 			c = t[-len];
 			if(acs_isalpha(c) || c == '-') rightnum = -1;
 		}
@@ -2066,18 +2315,18 @@ do_punct:
 		if(leftnum > 0 && rightnum > leftnum &&
 		(rightlen == leftlen ||
 		(spaceAround && rightlen == leftlen+1))) {
-				lastUncomma();
-				if(appendString(ow->toWord)) goto overflow;
+				lastUncomma(tp);
+				if(appendString(tp, tp->ow->toWord)) goto overflow;
 				break;
 			}
 		if(spaceAround) goto do_comma;
 		if(!acs_isdigit(e)) goto do_comma;
-		if(appendString(ow->dashWord)) goto overflow;
+		if(appendString(tp, tp->ow->dashWord)) goto overflow;
 		break;
 
 	case '$':
 		/* This logic decides whether to read the word dollar.
-		 * It is applicable only when tp_readLiteral is 1.
+		 * It is applicable only when tp->readLiteral is 1.
 		 * Supress the word "dollar" if we're starting a money amount.
 		 * Unfortunately this logic mirrors the logic in
 		 * expandAlphaNumeric, which also decides whether a number
@@ -2087,8 +2336,8 @@ do_punct:
 		 * First check for $.39 = 39 cents */
 		if(e == '.' && acs_isdigit(end[1]) && acs_isdigit(end[2]) &&
 		!acs_isalnum(end[3])) {
-			if(appendMoney(1, 0,
-			atoiLength(end+1, 2), end+3)) goto overflow;
+			if(appendMoney(tp, 1, 0,
+			atoiLength(tp, end+1, 2), end+3)) goto overflow;
 			end += 3;
 			break;
 		}
@@ -2099,7 +2348,7 @@ do_punct:
 		if(len > 3) goto nomoney; // $3456
 		if(len > 1) break; // $34 or $345
 // now looks like $3 and something, could be a parameter
-		if(!tp_readLiteral) break;
+		if(!tp->readLiteral) break;
 		if(*t == '.' && acs_isdigit(t[1])) break; // $3.5
 		/* Check for comma formatting. */
 		if(*t != ',') goto nomoney;
@@ -2109,7 +2358,7 @@ do_punct:
 		if(!acs_isdigit(t[1])) break;
 // $345,678,digits
 nomoney:
-		if(tp_readLiteral) goto do_punct;
+		if(tp->readLiteral) goto do_punct;
 		break;
 
 	case '.':
@@ -2122,16 +2371,16 @@ nomoney:
 			for(t=s-2; acs_isdigit(*t); --t) ;
 			if(*t == '.' && acs_isdigit(t[-1])) goto do_dot;
 do_point:
-			if(appendString(ow->pointWord)) goto overflow;
+			if(appendString(tp, tp->ow->pointWord)) goto overflow;
 			break;
 		}
 		if(acs_isalnum(d) && acs_isalnum(e)) {
 do_dot:
-			if(appendString(ow->dotWord)) goto overflow;
+			if(appendString(tp, tp->ow->dotWord)) goto overflow;
 			break;
 		}
 		if(acs_isdigit(e)) goto do_point;
-		if(tp_readLiteral) goto do_punct;
+		if(tp->readLiteral) goto do_punct;
 		if(!e || acs_isspace(e)) goto copychar;
 		break;
 
@@ -2147,12 +2396,12 @@ do_dot:
 		if(*s == ' ') ++s;
 		if(acs_isdigit(*t) || acs_isdigit(*s) ||
 		(t[1] == ' ' && s[-1] == ' ')) {
-			const char *w = ow->equalsWord;
-			if(c == '<') w = ow->lessWord;
-			if(c == '>') w = ow->greaterWord;
-			if(appendString(w)) goto overflow;
+			const char *w = tp->ow->equalsWord;
+			if(c == '<') w = tp->ow->lessWord;
+			if(c == '>') w = tp->ow->greaterWord;
+			if(appendString(tp, w)) goto overflow;
 			if(e == '=' && c != '=') {
-				if(appendString(ow->oreqWord)) goto overflow;
+				if(appendString(tp, tp->ow->oreqWord)) goto overflow;
 			}
 			end = s;
 		}
@@ -2167,18 +2416,18 @@ do_dot:
 
 		case '@':
 		if(acs_isalnum(d) && acs_isalnum(e))
-			if(appendString(ow->atWord)) goto overflow;
+			if(appendString(tp, tp->ow->atWord)) goto overflow;
 		break;
 
 		case '#':
 		if(acs_isalnum(d)) break;
 		if(acs_isdigit(e)) {
-			if(appendString(ow->numberWord)) goto overflow;
+			if(appendString(tp, tp->ow->numberWord)) goto overflow;
 			break;
 		}
 		if((e == 's' && !acs_isalnum(s[2])) ||
 		(acs_unaccent(e) == '\'' && s[2] == 's' && !acs_isalnum(s[3]))) {
-			if(appendString(ow->numbersWord)) goto overflow;
+			if(appendString(tp, tp->ow->numbersWord)) goto overflow;
 			++end;
 			if(acs_unaccent(e) == '\'') ++end;
 		}
@@ -2204,20 +2453,20 @@ do_dot:
 		++t;
 		/* and/or is already set */
 		if(rightnum == 2 && acs_substring_mix("or", s) == 2) break;
-		if(wordInList(ow->slashOrPhrases, t, leftnum+rightnum+1) >= 0) {
-			if(appendString(ow->orWord)) goto overflow;
+		if(wordInHash(&tp->lh->slashOrPhrases, t, leftnum+rightnum+1) >= 0) {
+			if(appendString(tp, tp->ow->orWord)) goto overflow;
 			break;
 		} /* predefined or phrase */
 		if(case_different(*s, *t) ||
 		case_different(s[rightnum-1], t[leftnum-1]))
 			goto do_slash;
 		if(leftnum < 4 || rightnum < 4) goto do_slash;
-		if(!isPronounceable(t, leftnum)) goto do_slash;
-		if(!isPronounceable(s, rightnum)) goto do_slash;
-		if(appendString(ow->andWord)) goto overflow;
+		if(!isPronounceable(tp, t, leftnum)) goto do_slash;
+		if(!isPronounceable(tp, s, rightnum)) goto do_slash;
+		if(appendString(tp, tp->ow->andWord)) goto overflow;
 		break;
 do_slash:
-		if(appendString(ow->slashWord)) goto overflow;
+		if(appendString(tp, tp->ow->slashWord)) goto overflow;
 		break;
 
 	case '^': /* squared cubed etc */
@@ -2231,23 +2480,23 @@ do_slash:
 		if(acs_isdigit(e)) goto noexp;
 		end = t;
 		if(rightnum > 3 || rightnum < 2) {
-			if(appendString(ow->toTheWord)) goto overflow;
-			if(appendOrdinal(rightnum)) goto overflow;
+			if(appendString(tp, tp->ow->toTheWord)) goto overflow;
+			if(appendOrdinal(tp, rightnum)) goto overflow;
 		}
 		if(rightnum == 2) {
-			if(appendString(ow->squareWord)) goto overflow;
+			if(appendString(tp, tp->ow->squareWord)) goto overflow;
 		}
 		if(rightnum == 3) {
-			if(appendString(ow->cubeWord)) goto overflow;
+			if(appendString(tp, tp->ow->cubeWord)) goto overflow;
 		}
 			break;
 noexp:
-		if(tp_readLiteral) goto do_punct;
+		if(tp->readLiteral) goto do_punct;
 		break;
 
 case ':':
 		if(e == '/' || (acs_isalpha(d) && !acs_isalnum(s[-2]))) {
-			if(appendString(ow->colonWord)) goto overflow;
+			if(appendString(tp, tp->ow->colonWord)) goto overflow;
 			break;
 		}
 		if(acs_isspace(e)) goto do_comma;
@@ -2263,14 +2512,14 @@ case ':':
 	case '!':
 		if(d == ' ') break;
 		if(acs_isalnum(d) && acs_isalnum(e)) {
-			if(appendString(ow->bangWord)) goto overflow;
+			if(appendString(tp, tp->ow->bangWord)) goto overflow;
 		}
 		/* fall through */
 
 	case ',': case '?':
 	case '+':
 copychar:
-		if(appendIchar(c)) goto overflow;
+		if(appendIchar(tp, c)) goto overflow;
 		if(c == '&' && acs_isalnum(e)) appendBackup();
 	} /* switch */
 
@@ -2295,36 +2544,36 @@ whence we can write to tp_out.
 See tc_textBufSwitch() near the top of this file.
 *********************************************************************/
 
-static void expandSentence(void)
+static void expandSentence(struct tp_context *tp)
 {
 	unsigned int *s;
 	unsigned int c;
 	int overflowValue = 1;
 
-	s = tp_in->buf + 1;
+	s = tp->in->buf + 1;
 
 	while((c = *s)) {
-		if(c == '\t' && !tp_oneSymbol) c = ' ';
+		if(c == '\t' && !tp->oneSymbol) c = ' ';
 		if(c == ' ') goto nextchar;
-		carryOffsetForward(s);
+		carryOffsetForward(tp, s);
 		if(c == '\n' || c == '\7') {
 passThrough:
-			if(appendChar(c)) goto overflow;
+			if(appendChar(tp, c)) goto overflow;
 			goto nextchar;
 		} /* physical newline or bell */
 
-		if(c == '\f' && !tp_oneSymbol) {
+		if(c == '\f' && !tp->oneSymbol) {
 			goto passThrough;
 		} /* formfeed */
 
-		if(c == '\n' && !tp_oneSymbol)goto passThrough;
+		if(c == '\n' && !tp->oneSymbol)goto passThrough;
 
 		if(acs_isalnum(c)) {
-			if(expandAlphaNumeric(&s)) goto overflow;
+			if(expandAlphaNumeric(tp, &s)) goto overflow;
 			continue;
 		} /* word or number */
 
-		if(expandPunct((const unsigned int **)&s)) goto overflow;
+		if(expandPunct(tp, (const unsigned int **)&s)) goto overflow;
 		continue;
 
 nextchar:
@@ -2334,7 +2583,7 @@ nextchar:
 	overflowValue = 0;
 
 overflow:
-	textbufClose(s, overflowValue);
+	tp_close(tp, s, overflowValue);
 }
 
 
@@ -2343,7 +2592,7 @@ Postprocess the text, to get rid of extra blanks
 and multiple consecutive commas.
 *********************************************************************/
 
-static void postCleanup(void)
+static void postCleanup(struct tp_context *tp)
 {
 	unsigned int *s, *t;
 	acs_ofs_type *u, *v;
@@ -2352,8 +2601,8 @@ static void postCleanup(void)
 	static const char squishable[] = ",;:.?!";
 	char presquish = 0, postsquish, insquish;
 
-	s = t = tp_out->buf + 1;
-	u = v = tp_out->offset + 1;
+	s = t = tp->out->buf + 1;
+	u = v = tp->out->offset + 1;
 	d = '\f';
 
 	for(; (c = *s); ++s, ++u) {
@@ -2395,12 +2644,191 @@ add_c:
 		*t++ = d = c;
 		*v++ = *u;
 		presquish = insquish;
-	} /* loop over chars in tp_out */
+	} /* loop over chars in tp->out */
 
 	if(d == ' ') --t, --v;
 	*t = 0;
 	*v = *u;
-	tp_out->len = t - tp_out->buf;
+	tp->out->len = t - tp->out->buf;
+}
+
+
+/*********************************************************************
+A cache of translated sentences.
+The same text is spoken over and over: prompts, status lines,
+console messages, a line read again with prow or nrow.
+Each entry holds the input text and offsets, the settings that
+affect translation, and the output text and offsets.
+Entries are kept in most recently used order, and the last one
+falls off when the cache is full.
+The whole cache is flushed if the dictionary or the punctuation
+pronunciations change, as tracked by acs_pron_serial.
+*********************************************************************/
+
+struct tp_cacheent {
+	struct tp_cacheent *next;
+	unsigned int hash;
+	unsigned short inlen, outlen;
+	char settings[6];
+	unsigned int *inbuf, *outbuf;
+	acs_ofs_type *inofs, *outofs;
+};
+
+#define CACHEMAXLEN 400 /* don't bother with longer sentences */
+
+void tp_cacheflush(struct tp_context *tp)
+{
+	struct tp_cacheent *e;
+	while((e = tp->cache)) {
+		tp->cache = e->next;
+		free(e);
+	}
+	tp->cache_count = 0;
+	tp->cache_serial = acs_pron_serial;
+}
+
+void tp_cachesize(struct tp_context *tp, int n)
+{
+	tp_cacheflush(tp);
+	tp->cache_max = (n > 0 ? n : 0);
+}
+
+/* Write the hit and miss counts, and how full the cache is, to a file. */
+int tp_cache_save(const struct tp_context *tp, const char *filename)
+{
+	unsigned long total = tp->cache_hits + tp->cache_misses;
+	FILE *f;
+	int rc = 0, e;
+
+	f = fopen(filename, "w");
+	if(!f) return -1;
+	fprintf(f, "%lu hits, %lu misses", tp->cache_hits, tp->cache_misses);
+	if(total)
+		fprintf(f, ", %.1f%% hits", 100.0 * tp->cache_hits / total);
+	fprintf(f, "\n%d of %d sentences cached\n", tp->cache_count, tp->cache_max);
+	if(ferror(f)) rc = -1;
+	e = errno;
+	if(fclose(f)) rc = -1, e = errno;
+	errno = e;
+	return rc;
+}
+
+static void cacheSettings(const struct tp_context *tp, char *set)
+{
+	set[0] = acs_lang;
+	set[1] = tp->readLiteral;
+	set[2] = tp->oneSymbol;
+	set[3] = tp->acronUpper;
+	set[4] = tp->acronDelim;
+	set[5] = 0;
+}
+
+static unsigned int cacheHash(const struct textbuf *in, const char *set)
+{
+	unsigned int h = 2166136261u;
+	int i;
+	for(i=0; i<5; ++i)
+		h = (h ^ (unsigned char)set[i]) * 16777619;
+	for(i=1; i<in->len; ++i)
+		h = (h ^ in->buf[i]) * 16777619;
+	for(i=1; i<=in->len; ++i)
+		h = (h ^ in->offset[i]) * 16777619;
+	return h;
+}
+
+/* Look for the input in the cache, and if it's there,
+ * copy the translation to the output buffer and return 1. */
+static int cacheLookup(struct tp_context *tp, unsigned int h, const char *set)
+{
+	struct tp_cacheent *e, *prev = 0;
+	struct textbuf *in = tp->in, *out = tp->out;
+
+	for(e=tp->cache; e; prev=e, e=e->next) {
+		if(e->hash != h || e->inlen != in->len) continue;
+		if(memcmp(e->settings, set, sizeof(e->settings))) continue;
+		if(memcmp(e->inbuf, in->buf+1, (in->len-1)*sizeof(unsigned int))) continue;
+		if(memcmp(e->inofs, in->offset+1, in->len*sizeof(acs_ofs_type))) continue;
+		break;
+	}
+	if(!e) return 0;
+
+	out->len = 0;
+	while(out->room <= e->outlen)
+		if(roomCheck(tp, e->outlen+1)) return 0;
+
+	// move to the front
+	if(prev) {
+		prev->next = e->next;
+		e->next = tp->cache;
+		tp->cache = e;
+	}
+
+	out->offset[0] = 0;
+	out->buf[0] = 0;
+	memcpy(out->buf+1, e->outbuf, (e->outlen-1)*sizeof(unsigned int));
+	out->buf[e->outlen] = 0;
+	memcpy(out->offset+1, e->outofs, e->outlen*sizeof(acs_ofs_type));
+	out->len = e->outlen;
+	return 1;
+}
+
+/* Save a copy of the input, before ascify changes it in place. */
+static struct tp_cacheent *cacheStart(struct tp_context *tp, unsigned int h, const char *set)
+{
+	struct tp_cacheent *e;
+	struct textbuf *in = tp->in;
+
+	e = malloc(sizeof(struct tp_cacheent) +
+	in->len * sizeof(unsigned int) + (in->len+1) * sizeof(acs_ofs_type));
+	if(!e) return 0;
+	e->hash = h;
+	e->inlen = in->len;
+	memcpy(e->settings, set, sizeof(e->settings));
+	e->inbuf = (unsigned int *) (e+1);
+	e->inofs = (acs_ofs_type *) (e->inbuf + in->len);
+	memcpy(e->inbuf, in->buf+1, (in->len-1)*sizeof(unsigned int));
+	memcpy(e->inofs, in->offset+1, in->len*sizeof(acs_ofs_type));
+	return e;
+}
+
+/* Add the output to the entry, and put it at the front of the cache. */
+static void cacheFinish(struct tp_context *tp, struct tp_cacheent *e)
+{
+	struct tp_cacheent *f, **pp;
+	const struct textbuf *out = tp->out;
+	int inlen = e->inlen;
+	unsigned int *inbuf;
+
+	f = realloc(e, sizeof(struct tp_cacheent) +
+	(inlen + out->len) * sizeof(unsigned int) +
+	(inlen + 1 + out->len + 1) * sizeof(acs_ofs_type));
+	if(!f) {
+		free(e);
+		return;
+	}
+	e = f;
+
+	/* Unsigned ints first, then the shorts, so everything is aligned.
+	 * Move the input offsets out of the way, then lay down the output. */
+	inbuf = (unsigned int *) (e+1);
+	e->inbuf = inbuf;
+	e->outbuf = inbuf + inlen;
+	e->inofs = (acs_ofs_type *) (e->outbuf + out->len);
+	memmove(e->inofs, inbuf + inlen, (inlen+1)*sizeof(acs_ofs_type));
+	e->outofs = e->inofs + inlen + 1;
+	e->outlen = out->len;
+	memcpy(e->outbuf, out->buf+1, (out->len-1)*sizeof(unsigned int));
+	memcpy(e->outofs, out->offset+1, out->len*sizeof(acs_ofs_type));
+
+	e->next = tp->cache;
+	tp->cache = e;
+	if(++tp->cache_count <= tp->cache_max) return;
+
+	// drop the least recently used
+	for(pp=&tp->cache; (*pp)->next; pp=&(*pp)->next)  ;
+	free(*pp);
+	*pp = 0;
+	--tp->cache_count;
 }
 
 
@@ -2410,61 +2838,95 @@ Run all the phases of translation.
 *********************************************************************/
 
 char debugPoint;
-static acs_ofs_type end_ofs;
 #define debugCheck(c, which) \
 if(debugPoint == c) { \
 int kk; \
 printf("%s", which->buf+1); \
 for(kk=1; kk<=which->len; ++kk) if(which->offset[kk]) printf("%d=%d\n", kk, which->offset[kk]); } \
-if(end_ofs != which->offset[which->len]) { \
+if(tp->end_ofs != which->offset[which->len]) { \
 fprintf(stderr, "end offset inconsistency %c.%d.%d length %d\n", \
-c, end_ofs, which->offset[which->len], which->len); \
+c, tp->end_ofs, which->offset[which->len], which->len); \
 exit(1); \
 } \
 if(debugPoint == c) exit(0)
 
-void prepTTS(void)
+void tp_prep(struct tp_context *tp)
 {
-	end_ofs = tp_in->offset[tp_in->len];
-
-	debugCheck('a', tp_in);
+	struct tp_cacheent *e = 0;
+	unsigned int h = 0;
+	char set[6];
+
+	tp->end_ofs = tp->in->offset[tp->in->len];
+
+	debugCheck('a', tp->in);
+
+	if(tp->cache_max && tp->in->len <= CACHEMAXLEN) {
+		if(tp->cache_serial != acs_pron_serial)
+			tp_cacheflush(tp);
+		cacheSettings(tp, set);
+		h = cacheHash(tp->in, set);
+		if(cacheLookup(tp, h, set)) {
+			++tp->cache_hits;
+			return;
+		}
+		++tp->cache_misses;
+		e = cacheStart(tp, h, set);
+	}
 
 	/* get ready for the first in->out transformation */
-	memset(tp_out->offset, 0, tp_out->room*sizeof(acs_ofs_type));
-	tp_out->buf[0] = 0;
-	tp_out->len = 1;
+	tp->out->buf[0] = 0;
+	tp->out->offset[0] = tp->out->offset[1] = 0;
+	tp->out->len = 1;
 
-	if(!tp_oneSymbol) {
-		ascify();
-		debugCheck('b', tp_in);
-	} /* tp_oneSymbol */
+	if(!tp->oneSymbol) {
+		ascify(tp);
+		debugCheck('b', tp->in);
+	} /* tp->oneSymbol */
 
 	/* translate everything to alphanum text */
-	expandSentence();
-	debugCheck('y', tp_out);
+	expandSentence(tp);
+	debugCheck('y', tp->out);
 
 	/* compress whitespace and sequences of commas and periods */
-	postCleanup();
-	debugCheck('z', tp_out);
+	postCleanup(tp);
+	debugCheck('z', tp->out);
+
+	if(e) cacheFinish(tp, e);
 }
 
 
-unsigned int *prepTTSmsg(const char *msg)
+unsigned int *tp_prepmsg(struct tp_context *tp, const char *msg)
 {
 int i, len;
 
-/* I assume there is room for the message */
-tp_in->buf[0] = 0;
-len = acs_utf82uni(msg, tp_in->buf+1);
+if(tp_inroom(tp, strlen(msg) + 2)) {
+tp->out->buf[1] = 0;
+return tp->out->buf + 1;
+}
+tp->in->buf[0] = 0;
+len = acs_utf82uni(msg, tp->in->buf+1);
 ++len;
-tp_in->len = len;
-tp_in->buf[len] = 0;
+tp->in->len = len;
+tp->in->buf[len] = 0;
 
 	for(i=1; i<=len; ++i)
-		tp_in->offset[i] = i;
+		tp->in->offset[i] = i;
 
-	prepTTS();
+	tp_prep(tp);
 
-	return tp_out->buf + 1;
+	return tp->out->buf + 1;
 }
 
+/* These feed the latency histograms of the bridge; tp_prep doesn't. */
+void prepTTS(void)
+{
+tp_prep(&tp_default);
+acs_latency(ACS_LAT_PREP);
+}
+
+unsigned int *prepTTSmsg(const char *msg)
+{
+unsigned int *u = tp_prepmsg(&tp_default, msg);
+acs_latency(ACS_LAT_PREP);
+return u;
+}
@@ -0,0 +1,471 @@
+/*********************************************************************
+acsbench.c: time the hot paths of the bridge, and the preprocessor.
+
+Each benchmark runs a few rounds, and the best round counts,
+since the best is the steadiest on a busy machine.
+Output is one line per benchmark, tab separated, easy to diff or parse:
+name, operations per round, nanoseconds per operation,
+and millions of characters a second, where that means something.
+Lines that start with # are comments.
+
+	events	tty output through acs_events(), 4000 characters at a time,
+		as the driver would bring us up to date
+	postprocess	the part of that spent in postprocess() and the indexes
+	sentence	acs_getsentence() over the whole tty buffer, sentence by sentence
+	search	acs_bufsearch() for a word that isn't there, start to end
+	words	acs_endword(), acs_forward(), over the whole buffer
+	replace	acs_replace() on every word of the text
+	utf82uni	acs_utf82uni() on the text
+	uni2utf8	acs_uni2utf8_n() back again
+	screensnap	acs_screensnap() of a full 25 by 80 screen
+	prepmsg	prepTTSmsg() on each line of the text, cache off
+
+The bridge opens a fake acsint, a unix socket, as in tests/acsfake,
+and the screen comes from socket.vcsa.
+The text is tts-trial from jupiter, or a file you name,
+repeated to fill the tty buffer, with \r\n at the end of each line,
+as it would come from the tty.
+
+	acsbench [-n rounds] [-c baseline] [-t percent] [textfile]
+
+Save the output of a good build, then run with -c baseline,
+and every benchmark more than percent slower, 25 by default,
+is named on stderr, and the exit status is 1.
+Run make bench in this directory.
+*********************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../jupiter/tp.h"
+
+#define stringEqual !strcmp
+
+#define SOCKNAME "/tmp/acsbench"
+#define CHUNK 4000 // characters in each packet from the fake driver
+#define ROWS 25
+#define COLS 80
+
+static unsigned char *utext; // the text file, utf8
+static int ulen;
+static unsigned int *text; // the text we feed as output, unicode
+static int tlen;
+static unsigned char *packets; // text as NEWCHARS events, CHUNK characters each
+static int npackets;
+static unsigned int *scratch;
+static unsigned char *scratch8;
+static int client = -1;
+
+/* set by each benchmark, for the report */
+static unsigned long ops, chars;
+
+static double now(void)
+{
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *allocOrDie(size_t n)
+{
+void *p = malloc(n);
+if(!p) {
+fprintf(stderr, "out of memory\n");
+exit(2);
+}
+return p;
+}
+
+/* Read the text, and repeat it until it fills the tty buffer twice over. */
+static void loadText(const char *filename)
+{
+FILE *f;
+long n;
+unsigned int *u;
+int i, ul;
+
+f = fopen(filename, "r");
+if(!f) {
+perror(filename);
+exit(2);
+}
+fseek(f, 0, SEEK_END);
+n = ftell(f);
+rewind(f);
+utext = allocOrDie(n + 1);
+if(fread(utext, 1, n, f) != (size_t)n || !n) {
+fprintf(stderr, "cannot read %s\n", filename);
+exit(2);
+}
+fclose(f);
+utext[n] = 0;
+ulen = n;
+
+u = allocOrDie((n + 1) * sizeof(unsigned int));
+ul = acs_utf82uni(utext, u);
+text = allocOrDie((2*TTYLOGSIZE + 2*ul + 2) * sizeof(unsigned int));
+while(tlen < 2*TTYLOGSIZE) {
+for(i=0; i<ul; ++i) {
+if(u[i] == '\n') text[tlen++] = '\r';
+text[tlen++] = u[i];
+}
+}
+free(u);
+
+npackets = (tlen + CHUNK - 1) / CHUNK;
+packets = allocOrDie(npackets * (4 + 4*CHUNK));
+for(i=0; i<npackets; ++i) {
+unsigned char *p = packets + i * (4 + 4*CHUNK);
+int n = (i < npackets-1 ? CHUNK : tlen - i*CHUNK);
+p[0] = ACS_TTY_NEWCHARS;
+p[1] = 1; // console 1
+p[2] = n, p[3] = n >> 8;
+memcpy(p + 4, text + i*CHUNK, 4*n);
+}
+
+scratch = allocOrDie((ulen + 1) * sizeof(unsigned int));
+scratch8 = allocOrDie(tlen * 6 + 1);
+}
+
+/* A fake acsint, with a screen full of text. */
+static void openFake(void)
+{
+struct sockaddr_un sa;
+unsigned char screen[4 + ROWS*COLS*2];
+int lfd, fd, i;
+
+memset(screen, 0, sizeof(screen));
+screen[0] = ROWS, screen[1] = COLS;
+screen[2] = 0, screen[3] = ROWS-1;
+for(i=0; i<ROWS*COLS; ++i) {
+screen[4 + 2*i] = (text[i] >= ' ' && text[i] < 0x7f ? text[i] : ' ');
+screen[4 + 2*i + 1] = 7;
+}
+fd = open(SOCKNAME ".vcsa", O_RDWR | O_CREAT | O_TRUNC, 0644);
+if(fd < 0 || write(fd, screen, sizeof(screen)) != sizeof(screen)) {
+perror(SOCKNAME ".vcsa");
+exit(2);
+}
+close(fd);
+
+lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+memset(&sa, 0, sizeof(sa));
+sa.sun_family = AF_UNIX;
+strcpy(sa.sun_path, SOCKNAME);
+unlink(SOCKNAME);
+if(lfd < 0 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) || listen(lfd, 1)) {
+perror(SOCKNAME);
+exit(2);
+}
+/* connect goes through on the backlog, before we accept */
+if(acs_open(SOCKNAME) < 0) {
+perror(SOCKNAME);
+exit(2);
+}
+client = accept(lfd, 0, 0);
+if(client < 0) {
+perror("accept");
+exit(2);
+}
+close(lfd);
+i = (4 + 4*CHUNK) * 2;
+setsockopt(client, SOL_SOCKET, SO_SNDBUF, &i, sizeof(i));
+
+/* the driver tells us we are on console 1, and that sets acs_tb */
+memset(screen, 0, 4);
+screen[0] = ACS_FGC, screen[1] = 1;
+if(send(client, screen, 4, 0) < 0 || acs_events() < 0) {
+perror("console 1");
+exit(2);
+}
+}
+
+/* Throw away whatever the bridge has said to the driver. */
+static void discard(void)
+{
+static unsigned char cmdbuf[1024];
+while(recv(client, cmdbuf, sizeof(cmdbuf), MSG_DONTWAIT) > 0)
+;
+}
+
+/*********************************************************************
+The benchmarks.  Each one returns the seconds that count,
+and sets ops and chars.
+*********************************************************************/
+
+static double feed(void)
+{
+int i, n;
+double t, total = 0;
+
+for(i=0; i<npackets; ++i) {
+n = (i < npackets-1 ? CHUNK : tlen - i*CHUNK);
+if(send(client, packets + i * (4 + 4*CHUNK), 4 + 4*n, 0) < 0) {
+perror("send");
+exit(2);
+}
+t = now();
+if(acs_events() < 0) {
+perror("acs_events");
+exit(2);
+}
+total += now() - t;
+discard();
+++ops;
+}
+chars = tlen;
+return total;
+}
+
+static double runEvents(void)
+{
+return feed();
+}
+
+static double runPostprocess(void)
+{
+memset(&acs_prof, 0, sizeof(acs_prof));
+acs_profiling = 1;
+feed();
+acs_profiling = 0;
+return acs_prof.ns_postprocess / 1e9;
+}
+
+static double runSentence(void)
+{
+static unsigned int dest[400];
+static acs_ofs_type offsets[400];
+int len;
+double t = now();
+
+acs_rb = acs_tb;
+acs_rb->cursor = acs_rb->start;
+while(acs_rb->cursor < acs_rb->end) {
+acs_getsentence(dest, 398, offsets, ACS_GS_REPEAT | ACS_GS_NLSPACE);
+len = acs_unilen(dest);
+if(!len) break;
+chars += offsets[len];
+acs_rb->cursor += (offsets[len] ? offsets[len] : 1);
+++ops;
+}
+t = now() - t;
+acs_rb = 0;
+return t;
+}
+
+static double runSearch(void)
+{
+int i;
+double t = now();
+for(i=0; i<20; ++i) {
+acs_startbuf();
+if(acs_bufsearch("qzxjv", 0, 0)) {
+fprintf(stderr, "found a word that isn't there\n");
+exit(2);
+}
+chars += acs_mb->end - acs_mb->start;
+++ops;
+}
+return now() - t;
+}
+
+static double runWords(void)
+{
+double t = now();
+acs_startbuf();
+while(acs_endword() && acs_forward())
+++ops;
+chars = acs_mb->end - acs_mb->start;
+return now() - t;
+}
+
+static double runReplace(void)
+{
+int i, j;
+double t = now();
+for(i=0; i<tlen; i=j) {
+for(j=i; j<tlen && acs_isalpha(text[j]); ++j)
+;
+if(j == i) {
+++j;
+continue;
+}
+acs_replace(text + i, j - i);
+chars += j - i;
+++ops;
+}
+return now() - t;
+}
+
+static double runUtf82uni(void)
+{
+int i;
+double t = now();
+for(i=0; i<20; ++i)
+acs_utf82uni(utext, scratch);
+ops = 20, chars = 20 * ulen;
+return now() - t;
+}
+
+static double runUni2utf8(void)
+{
+int i;
+double t = now();
+for(i=0; i<20; ++i)
+acs_uni2utf8_n(text, tlen, scratch8);
+ops = 20, chars = 20 * tlen;
+return now() - t;
+}
+
+static double runScreensnap(void)
+{
+int i;
+double t = now();
+for(i=0; i<1000; ++i)
+acs_screensnap();
+ops = 1000, chars = 1000 * ROWS * COLS;
+return now() - t;
+}
+
+static double runPrepmsg(void)
+{
+char *line, *end;
+char save;
+double t = now();
+for(line=(char*)utext; *line; line=end) {
+end = strchr(line, '\n');
+end = (end ? end+1 : line + strlen(line));
+save = *end, *end = 0;
+prepTTSmsg(line);
+*end = save;
+chars += end - line;
+++ops;
+}
+return now() - t;
+}
+
+static const struct {
+const char *name;
+double (*run)(void);
+} benches[] = {
+{"events", runEvents},
+{"postprocess", runPostprocess},
+{"sentence", runSentence},
+{"search", runSearch},
+{"words", runWords},
+{"replace", runReplace},
+{"utf82uni", runUtf82uni},
+{"uni2utf8", runUni2utf8},
+{"screensnap", runScreensnap},
+{"prepmsg", runPrepmsg},
+{0, 0}
+};
+
+static double results[sizeof(benches) / sizeof(benches[0])];
+
+/* Compare with a saved run; return the number that got slower. */
+static int compare(const char *filename, int percent)
+{
+FILE *f;
+char line[200], name[40];
+unsigned long n;
+double ns;
+int i, slower = 0;
+
+f = fopen(filename, "r");
+if(!f) {
+perror(filename);
+exit(2);
+}
+while(fgets(line, sizeof(line), f)) {
+if(line[0] == '#') continue;
+if(sscanf(line, "%39s %lu %lf", name, &n, &ns) != 3) continue;
+for(i=0; benches[i].name; ++i)
+if(stringEqual(name, benches[i].name)) break;
+if(!benches[i].name || ns <= 0) continue;
+if(results[i] > ns * (100 + percent) / 100) {
+fprintf(stderr, "%s is %.0f%% slower, %.1f ns, was %.1f\n",
+name, (results[i] / ns - 1) * 100, results[i], ns);
+++slower;
+}
+}
+fclose(f);
+return slower;
+}
+
+int main(int argc, char **argv)
+{
+const char *textfile = "../jupiter/tts-trial";
+const char *baseline = 0;
+int rounds = 5, percent = 25;
+int i, r;
+double t, best;
+unsigned long bestops, bestchars;
+
+++argv, --argc;
+while(argc && argv[0][0] == '-') {
+if(stringEqual(argv[0], "-n") && argc > 1)
+rounds = atoi(*++argv), --argc;
+else if(stringEqual(argv[0], "-c") && argc > 1)
+baseline = *++argv, --argc;
+else if(stringEqual(argv[0], "-t") && argc > 1)
+percent = atoi(*++argv), --argc;
+else
+argc = -1;
+++argv, --argc;
+}
+if(argc == 1)
+textfile = argv[0];
+else if(argc || rounds < 1) {
+fprintf(stderr, "usage: acsbench [-n rounds] [-c baseline] [-t percent] [textfile]\n");
+exit(2);
+}
+
+acs_lang = ACS_LANG_EN;
+acs_reset_configure();
+acs_setword("computer", "compeuter");
+acs_setword("read", "reed");
+acs_setword("library", "lighbrary");
+if(setupTTS()) {
+fprintf(stderr, "cannot set up the preprocessor\n");
+exit(2);
+}
+tp_cachesize(&tp_default, 0);
+
+loadText(textfile);
+openFake();
+
+printf("# acsbench, best of %d rounds, %s, %d characters of output\n",
+rounds, textfile, tlen);
+printf("# name\tops\tns/op\tMchars/s\n");
+for(i=0; benches[i].name; ++i) {
+best = 0;
+bestops = bestchars = 0;
+for(r=0; r<rounds; ++r) {
+ops = chars = 0;
+t = benches[i].run();
+if(!r || t < best)
+best = t, bestops = ops, bestchars = chars;
+}
+if(best <= 0) best = 1e-9;
+results[i] = (bestops ? best * 1e9 / bestops : 0);
+printf("%s\t%lu\t%.1f\t%.2f\n", benches[i].name, bestops,
+results[i], bestchars / best / 1e6);
+}
+fflush(stdout);
+
+acs_close();
+unlink(SOCKNAME);
+unlink(SOCKNAME ".vcsa");
+
+if(baseline && compare(baseline, percent))
+return 1;
+return 0;
+}
@@ -0,0 +1,941 @@
+/*********************************************************************
+acsfake.c: a stand-in for /dev/acsint, in user space.
+
+This lets you run the bridge, and jupiter, without the kernel module,
+on a build machine, or under a profiler.
+It listens on a unix socket, and speaks the protocol in drivers/acsint.h,
+as drivers/acsint.c does: it captures the keys you ask it to capture,
+keeps a circular buffer of output for each console,
+throws MORECHARS when there is new output, with the same output break,
+brings your buffer up to date when you refresh or strike a key,
+and puts timestamps on events, and filters the output, if you ask.
+Each batch of events, what the driver would return from one read(),
+is one packet on the socket.
+A batch isn't sent until you have read the last one,
+so a slow adapter gets bigger batches, as it would from the driver.
+The screen of the foreground console is kept in socket.vcsa,
+in the format of /dev/vcsa, 25 by 80, for screen mode.
+acs_open() sees that its device is a socket, and does the rest.
+
+	acsfake [-x] [-n times] socket script
+	ACSINT=socket jupiter -c test.cfg esp "|cat >/dev/null"
+
+The script says what happens, one thing per line.
+	# a comment
+	rate n	run n lines a second, 0 for as fast as possible
+	cps n	output goes to the console at n characters a second, 0 for all at once
+	key code [shift]	strike a key, by its code in linux/input.h,
+		shift state as in acsint.h: 1 shift, 2 right alt, 4 control, 8 left alt
+	type text	type at the shell, which echoes each character
+	out text	a program writes a line; \e \t \b \r \n and \\ are escapes
+	file path	a program writes the contents of a file
+	fgc n	switch to console n
+	sleep ms	do nothing for a while
+	wait	until the adapter has read everything
+The script runs the number of times given by -n, 1 by default,
+and then we say how long it took, and wait for the adapter to close,
+or exit if -x is given.
+Text is utf8, and an output line ends in \r\n, as it would after onlcr.
+Keys that go to the console do nothing; use type to see them echo.
+*********************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/sockios.h>
+
+#include "acsbridge.h"
+
+#define stringEqual !strcmp
+
+#define NCONSOLES 12
+#define CBUFSIZE 65536 // as in the driver
+#define RBUF_LEN 400
+#define ROWS 25
+#define COLS 80
+
+/* circular buffer of output, indexes into area, -1 for none */
+struct cbuf {
+unsigned int area[CBUFSIZE];
+int head, tail, mark, echopoint;
+};
+static struct cbuf cbuf_tty[NCONSOLES];
+static unsigned int staging[CBUFSIZE];
+static unsigned long long tty_stamp[NCONSOLES];
+
+/* the screen of each console, for the vcsa file */
+struct screen {
+unsigned char cell[ROWS][COLS][2];
+int x, y;
+int esc; // 1 after escape, 2 inside a csi sequence
+};
+static struct screen screens[NCONSOLES];
+static int vcs_fd = -1, vcs_dirty = 1;
+
+/* events waiting to be read */
+static char rbuf[RBUF_LEN];
+static int rbuf_head, rbuf_tail;
+
+static int fg; // foreground console, 0 based
+static unsigned short capture[ACS_NUM_KEYS], passt[ACS_NUM_KEYS];
+static int key_divert, key_monitor, key_bypass;
+static int user_bufsize = 256;
+static int outputbreak = 5;
+static unsigned long long last_out; // time of the last output, 0 after a key
+static int stamps;
+
+static int client = -1;
+static unsigned char *packet;
+
+/* what we did, for the report at the end */
+static unsigned long n_keys, n_chars, n_packets, n_bytes;
+
+static unsigned long long nanotime(void)
+{
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void cb_reset(struct cbuf *cb)
+{
+cb->head = cb->tail = cb->mark = 0;
+cb->echopoint = -1;
+}
+
+/* drop the oldest character if the buffer is full */
+static void cb_append(struct cbuf *cb, unsigned int c)
+{
+cb->area[cb->head] = c;
+cb->head = (cb->head + 1) % CBUFSIZE;
+if(cb->head == cb->tail) {
+if(cb->tail == cb->mark) cb->mark = -1;
+if(cb->tail == cb->echopoint) cb->echopoint = -1;
+cb->tail = (cb->tail + 1) % CBUFSIZE;
+}
+}
+
+/*********************************************************************
+The output filter, ACS_FILTER, as in the driver:
+escape sequences, bells, and the cr of cr lf are kept out of the buffer.
+They still go to the screen.
+*********************************************************************/
+
+#define FILT_GROUND 0
+#define FILT_ESC 1
+#define FILT_CSI 2
+#define FILT_STRING 3
+#define FILT_STRING_ESC 4
+#define FILT_CSIMAX 64
+#define FILT_STRINGMAX 4096
+
+struct filter {
+int flags, state, count;
+};
+static struct filter filters[NCONSOLES];
+
+static int filter_out(int mino, unsigned int c)
+{
+struct filter *f = filters + mino;
+
+if(!f->flags) return 0;
+
+again:
+if(f->state != FILT_GROUND) {
+if(c == 0x18 || c == 0x1a) {
+f->state = FILT_GROUND;
+return 1;
+}
+switch(f->state) {
+case FILT_ESC:
+if(c == '\33') return 1;
+if(c == '[') {
+f->state = FILT_CSI, f->count = 0;
+return 1;
+}
+if(c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_') {
+f->state = FILT_STRING, f->count = 0;
+return 1;
+}
+if(c >= 0x20 && c <= 0x2f) return 1;
+if(c >= 0x30 && c <= 0x7e) {
+f->state = FILT_GROUND;
+return 1;
+}
+break;
+case FILT_CSI:
+if(c >= 0x20 && c <= 0x3f) {
+if(++f->count == FILT_CSIMAX) f->state = FILT_GROUND;
+return 1;
+}
+if(c >= 0x40 && c <= 0x7e) {
+f->state = FILT_GROUND;
+return 1;
+}
+if(c == '\33') {
+f->state = FILT_ESC;
+return 1;
+}
+break;
+case FILT_STRING:
+if(c == '\7' || c == 0x9c) {
+f->state = FILT_GROUND;
+return 1;
+}
+if(c == '\33') f->state = FILT_STRING_ESC;
+else if(++f->count == FILT_STRINGMAX) f->state = FILT_GROUND;
+return 1;
+case FILT_STRING_ESC:
+if(c == '\\') {
+f->state = FILT_GROUND;
+return 1;
+}
+f->state = FILT_ESC;
+goto again;
+}
+if(c >= ' ') f->state = FILT_GROUND;
+}
+
+if(f->flags & ACS_FILTER_ESC) {
+if(c == '\33') {
+f->state = FILT_ESC;
+return 1;
+}
+if(c == 0x9b) {
+f->state = FILT_CSI, f->count = 0;
+return 1;
+}
+if(c == 0x90 || c == 0x98 || c == 0x9d || c == 0x9e || c == 0x9f) {
+f->state = FILT_STRING, f->count = 0;
+return 1;
+}
+}
+
+if(c == '\7' && f->flags & ACS_FILTER_BELL) return 1;
+return 0;
+}
+
+/* lf over the cr, if the adapter hasn't read the cr yet */
+static int cb_crlf(struct cbuf *cb)
+{
+int last;
+if(cb->head == cb->tail || cb->mark == cb->head) return 0;
+last = (cb->head + CBUFSIZE - 1) % CBUFSIZE;
+if(cb->area[last] != '\r') return 0;
+cb->area[last] = '\n';
+return 1;
+}
+
+static int rbuf_room(int n)
+{
+return rbuf_head + n <= RBUF_LEN;
+}
+
+static void put_stamp(char *where, unsigned long long ns)
+{
+where[0] = ACS_STAMP;
+where[1] = where[2] = where[3] = 0;
+memcpy(where + 4, &ns, 8);
+}
+
+/*********************************************************************
+The screen, a very small terminal: printable characters, return,
+newline, backspace, tab, and escape sequences, which are skipped.
+*********************************************************************/
+
+static void screen_put(int mino, unsigned int c)
+{
+struct screen *s = screens + mino;
+
+if(s->esc == 1) {
+s->esc = (c == '[' ? 2 : 0);
+return;
+}
+if(s->esc == 2) {
+if(c >= 0x40 && c <= 0x7e) s->esc = 0;
+return;
+}
+
+switch(c) {
+case '\33': s->esc = 1; return;
+case '\r': s->x = 0; break;
+case '\n': ++s->y; break;
+case '\b': if(s->x) --s->x; break;
+case '\t':
+s->x = (s->x + 8) & ~7;
+if(s->x >= COLS) s->x = COLS-1;
+break;
+default:
+if(c < ' ') return;
+if(s->x == COLS) s->x = 0, ++s->y;
+if(s->y == ROWS) {
+memmove(s->cell[0], s->cell[1], (ROWS-1) * COLS * 2);
+memset(s->cell[ROWS-1], 0, COLS * 2);
+s->y = ROWS-1;
+}
+s->cell[s->y][s->x][0] = (c < 0x80 ? c : '?');
+s->cell[s->y][s->x][1] = 7;
+++s->x;
+}
+
+if(s->y == ROWS) {
+memmove(s->cell[0], s->cell[1], (ROWS-1) * COLS * 2);
+memset(s->cell[ROWS-1], 0, COLS * 2);
+s->y = ROWS-1;
+}
+if(mino == fg) vcs_dirty = 1;
+}
+
+static void vcs_write(void)
+{
+static unsigned char buf[4 + ROWS*COLS*2];
+struct screen *s = screens + fg;
+
+if(!vcs_dirty) return;
+vcs_dirty = 0;
+buf[0] = ROWS, buf[1] = COLS;
+buf[2] = (s->x < COLS ? s->x : COLS-1), buf[3] = s->y;
+memcpy(buf+4, s->cell, ROWS*COLS*2);
+pwrite(vcs_fd, buf, sizeof(buf), 0);
+}
+
+/*********************************************************************
+Events coming in, as the keyboard and vt notifiers see them.
+*********************************************************************/
+
+/* Output on a console; echo is 1 if this echoes a key. */
+static void pushlog(unsigned int c, int mino, int echo)
+{
+struct cbuf *cb = cbuf_tty + mino;
+int throw = 0;
+unsigned long long now = nanotime();
+
+if(filter_out(mino, c)) {
+screen_put(mino, c);
+return;
+}
+
+if(mino == fg) {
+if(cb->mark == cb->head || cb->echopoint == cb->head || echo)
+throw = 1;
+if(!echo) {
+if(last_out && outputbreak &&
+now - last_out < outputbreak * 100000000ULL)
+throw = 0;
+last_out = now;
+}
+}
+
+if(!(c == '\n' && filters[mino].flags & ACS_FILTER_CRLF && cb_crlf(cb)))
+cb_append(cb, c);
+if(stamps && !tty_stamp[mino])
+tty_stamp[mino] = now;
+screen_put(mino, c);
+++n_chars;
+
+if(throw && rbuf_room(8)) {
+rbuf[rbuf_head] = ACS_TTY_MORECHARS;
+rbuf[rbuf_head+1] = echo;
+rbuf[rbuf_head+2] = rbuf[rbuf_head+3] = 0;
+memcpy(rbuf + rbuf_head + 4, &c, 4);
+rbuf_head += 8;
+if(echo) cb->echopoint = cb->head;
+}
+}
+
+static void keystroke(int key, int ss)
+{
+int keep = 0, send = 0;
+
+ss &= 0xf;
+if(key_divert || key_monitor) keep = 1;
+if(key_bypass) {
+key_bypass = 0;
+send = 1;
+} else if(key < ACS_NUM_KEYS && capture[key] & (1<<ss)) {
+keep = 1;
+if(passt[key] & (1<<ss)) send = 1;
+} else if(!key_divert) send = 1;
+
+if(keep && rbuf_room(stamps ? 16 : 4)) {
+if(stamps) {
+put_stamp(rbuf + rbuf_head, nanotime());
+rbuf_head += 12;
+}
+rbuf[rbuf_head] = ACS_KEYSTROKE;
+rbuf[rbuf_head+1] = key;
+rbuf[rbuf_head+2] = ss;
+rbuf[rbuf_head+3] = 0;
+rbuf_head += 4;
+++n_keys;
+}
+
+if(send) last_out = 0;
+}
+
+static void switch_console(int mino)
+{
+if(mino < 0 || mino >= NCONSOLES || mino == fg) return;
+fg = mino;
+vcs_dirty = 1;
+if(rbuf_room(4)) {
+rbuf[rbuf_head] = ACS_FGC;
+rbuf[rbuf_head+1] = fg + 1;
+rbuf[rbuf_head+2] = rbuf[rbuf_head+3] = 0;
+rbuf_head += 4;
+}
+}
+
+/*********************************************************************
+The adapter reads: this is device_read() in the driver.
+Skip ahead to the last FGC, bring the buffer up to date if need be,
+and send FGC, then the new characters, then the other events.
+The adapter's read buffer is user_bufsize characters plus 400 bytes,
+as the bridge allocates it.
+*********************************************************************/
+
+static void deliver(void)
+{
+struct cbuf *cb;
+int len = user_bufsize * 4 + 400;
+int n = 0, t, culen = 0, cup = 0, j;
+int temp_head = rbuf_head, temp_tail = rbuf_tail;
+int catchup = 0, catchup_head = 0, catchup_echo = 0;
+unsigned long long stamp = 0;
+
+for(t=temp_tail; t<temp_head; t+=4) {
+if(rbuf[t] == ACS_FGC) temp_tail = t;
+else if(rbuf[t] == ACS_TTY_MORECHARS) t += 4;
+else if(rbuf[t] == ACS_STAMP) t += 8;
+}
+
+cb = cbuf_tty + fg;
+if(cb->head != cb->mark) {
+for(t=temp_tail; t<temp_head; t+=4) {
+if(rbuf[t] == ACS_TTY_MORECHARS) {
+if(rbuf[t+1]) catchup_echo = 1;
+t += 4;
+continue;
+}
+if(rbuf[t] == ACS_STAMP) {
+t += 8;
+continue;
+}
+catchup_head = 1;
+break;
+}
+}
+if(catchup_echo && cb->echopoint >= 0)
+catchup = 1, cup = cb->echopoint;
+if(catchup_head)
+catchup = 1, cup = cb->head;
+
+if(catchup) {
+if(cb->mark < 0) cb->mark = cb->tail;
+culen = (cup - cb->mark + CBUFSIZE) % CBUFSIZE;
+for(j=0; j<culen; ++j)
+staging[j] = cb->area[(cb->mark + j) % CBUFSIZE];
+cb->mark = cup;
+cb->echopoint = -1;
+stamp = tty_stamp[fg];
+tty_stamp[fg] = 0;
+}
+if(!stamps) stamp = 0;
+
+if(rbuf[temp_tail] == ACS_FGC && temp_tail < temp_head) {
+memcpy(packet, rbuf + temp_tail, 4);
+temp_tail += 4;
+n += 4, len -= 4;
+}
+
+j = 0;
+if(culen > user_bufsize) {
+j = culen - user_bufsize;
+culen -= j;
+}
+if(catchup && len >= (culen + 1) * 4 + (stamp ? 12 : 0)) {
+if(stamp) {
+put_stamp((char *)packet + n, stamp);
+n += 12, len -= 12;
+}
+packet[n] = ACS_TTY_NEWCHARS;
+packet[n+1] = fg + 1;
+packet[n+2] = culen;
+packet[n+3] = culen >> 8;
+memcpy(packet + n + 4, staging + j, culen * 4);
+n += (culen + 1) * 4;
+len -= (culen + 1) * 4;
+}
+
+t = temp_head - temp_tail;
+if(t > len) t = len;
+memcpy(packet + n, rbuf + temp_tail, t);
+temp_tail += t;
+n += t;
+
+rbuf_tail = temp_tail;
+if(rbuf_head == rbuf_tail) rbuf_head = rbuf_tail = 0;
+
+vcs_write();
+if(n && send(client, packet, n, 0) == n)
+++n_packets, n_bytes += n;
+}
+
+/* Has the adapter read everything we sent? */
+static int drained(void)
+{
+int q = 0;
+if(ioctl(client, SIOCOUTQ, &q) < 0) return 1;
+return q == 0;
+}
+
+/*********************************************************************
+Commands from the adapter: this is device_write() in the driver.
+Sounds are ignored; pushing input on the tty is ignored.
+*********************************************************************/
+
+static void commands(const unsigned char *p, int len)
+{
+int c, key, ss, n;
+
+while(len) {
+c = *p++, --len;
+switch(c) {
+case ACS_CLEAR_KEYS:
+memset(capture, 0, sizeof(capture));
+memset(passt, 0, sizeof(passt));
+break;
+
+case ACS_SET_KEY:
+if(len < 2) return;
+key = p[0], ss = p[1];
+p += 2, len -= 2;
+if(key >= ACS_NUM_KEYS) break;
+capture[key] |= 1 << (ss & 0xf);
+if(ss & ACS_KEY_T) passt[key] |= 1 << (ss & 0xf);
+else passt[key] &= ~(1 << (ss & 0xf));
+break;
+
+case ACS_UNSET_KEY:
+if(len < 2) return;
+key = p[0], ss = p[1];
+p += 2, len -= 2;
+if(key >= ACS_NUM_KEYS) break;
+passt[key] = 0;
+capture[key] &= ~(1 << (ss & 0xf));
+break;
+
+case ACS_ISMETA:
+if(len < 2) return;
+p += 2, len -= 2;
+break;
+
+case ACS_SOUNDS: case ACS_SOUNDS_TTY: case ACS_SOUNDS_KMSG:
+if(len < 1) return;
+++p, --len;
+break;
+
+case ACS_NOTES:
+if(len < 1) return;
+n = *p++, --len;
+n *= 3;
+if(n > len) n = len;
+p += n, len -= n;
+break;
+
+case ACS_SWOOP:
+if(len < 3) return;
+p += 3, len -= 3;
+break;
+
+case ACS_STEPS:
+if(len < 7) return;
+p += 7, len -= 7;
+break;
+
+case ACS_BYPASS:
+key_bypass = 1;
+break;
+
+case ACS_DIVERT:
+if(len < 1) return;
+key_divert = (*p++ != 0), --len;
+break;
+
+case ACS_MONITOR:
+if(len < 1) return;
+key_monitor = (*p++ != 0), --len;
+break;
+
+case ACS_OBREAK:
+if(len < 1) return;
+outputbreak = *p++, --len;
+break;
+
+case ACS_STAMPS:
+if(len < 1) return;
+stamps = (*p++ != 0), --len;
+break;
+
+case ACS_REFRESH:
+if(rbuf_room(4)) {
+rbuf[rbuf_head] = ACS_REFRESH;
+rbuf[rbuf_head+1] = rbuf[rbuf_head+2] = rbuf[rbuf_head+3] = 0;
+rbuf_head += 4;
+}
+break;
+
+case ACS_PUSH_TTY:
+if(len < 2) return;
+n = p[0] | (p[1] << 8);
+p += 2, len -= 2;
+if(n > len) n = len;
+p += n, len -= n;
+break;
+
+case ACS_FILTER:
+if(len < 2) return;
+for(n=0; n<NCONSOLES; ++n) {
+if(p[0] && n != p[0]-1) continue;
+filters[n].flags = p[1];
+filters[n].state = FILT_GROUND;
+}
+p += 2, len -= 2;
+break;
+
+case ACS_BUFSIZE:
+if(len < 2) return;
+n = p[0] | (p[1] << 8);
+p += 2, len -= 2;
+if(n < 256) n = 256;
+user_bufsize = n;
+break;
+}
+}
+}
+
+/*********************************************************************
+The script.
+*********************************************************************/
+
+static char **lines;
+static int nlines;
+
+static unsigned int *outq; // output waiting to be written
+static int outlen, outpos, outroom;
+static int cps;
+static unsigned long long out_start;
+
+static void outq_add(unsigned int c)
+{
+if(outlen == outroom) {
+outroom = outroom * 2 + 1000;
+outq = realloc(outq, outroom * sizeof(unsigned int));
+if(!outq) {
+fprintf(stderr, "out of memory\n");
+exit(2);
+}
+}
+outq[outlen++] = c;
+}
+
+/* utf8 text to the output queue, with \n as \r\n */
+static void outq_text(const char *s, int len)
+{
+unsigned int u[2];
+char one[8];
+int j, k;
+
+while(len) {
+/* one utf8 character at a time */
+k = 1;
+if((unsigned char)*s >= 0xc0)
+while(k < len && k < 4 && (s[k] & 0xc0) == 0x80) ++k;
+memcpy(one, s, k);
+one[k] = 0;
+s += k, len -= k;
+j = acs_utf82uni((unsigned char *)one, u);
+if(j != 1) u[0] = '?';
+if(u[0] == '\n') outq_add('\r');
+outq_add(u[0]);
+}
+}
+
+/* unescape \e \t \b \r \n \\ in place */
+static int unescape(char *s)
+{
+char *t = s, *start = s;
+for(; *s; ++s) {
+if(*s != '\\' || !s[1]) {
+*t++ = *s;
+continue;
+}
+switch(*++s) {
+case 'e': *t++ = '\33'; break;
+case 't': *t++ = '\t'; break;
+case 'b': *t++ = '\b'; break;
+case 'r': *t++ = '\r'; break;
+case 'n': *t++ = '\n'; break;
+default: *t++ = *s;
+}
+}
+*t = 0;
+return t - start;
+}
+
+static void loadScript(const char *filename)
+{
+FILE *f = fopen(filename, "r");
+char line[1000];
+int room = 0;
+
+if(!f) {
+perror(filename);
+exit(1);
+}
+while(fgets(line, sizeof(line), f)) {
+line[strcspn(line, "\r\n")] = 0;
+if(!line[0] || line[0] == '#') continue;
+if(nlines == room) {
+room = room * 2 + 100;
+lines = realloc(lines, room * sizeof(char *));
+}
+lines[nlines++] = strdup(line);
+}
+fclose(f);
+}
+
+static void writeFile(const char *filename)
+{
+FILE *f = fopen(filename, "r");
+char buf[4096];
+size_t n, keep = 0;
+int k;
+
+if(!f) {
+perror(filename);
+return;
+}
+while((n = fread(buf + keep, 1, sizeof(buf) - keep, f)) > 0) {
+n += keep;
+/* don't split a utf8 character across reads */
+for(k=n; k > 0 && k > (int)n-4 && (buf[k-1] & 0xc0) == 0x80; --k) ;
+if(k > 0 && (unsigned char)buf[k-1] >= 0xc0) --k;
+else k = n;
+outq_text(buf, k);
+keep = n - k;
+memmove(buf, buf + k, keep);
+}
+outq_text(buf, keep);
+fclose(f);
+}
+
+/* Run a line of the script.
+ * Returns 1 if we should wait for the adapter to read everything. */
+static int runLine(char *line, unsigned long long *next)
+{
+char *arg = strchr(line, ' ');
+char verb[12];
+int n;
+
+n = (arg ? arg - line : (int)strlen(line));
+if(n >= (int)sizeof(verb)) n = sizeof(verb) - 1;
+memcpy(verb, line, n);
+verb[n] = 0;
+arg = (arg ? arg + 1 : line + strlen(line));
+
+if(stringEqual(verb, "key")) {
+int key = 0, ss = 0;
+sscanf(arg, "%d %d", &key, &ss);
+keystroke(key, ss);
+return 0;
+}
+if(stringEqual(verb, "type")) {
+char *s = strdup(arg);
+n = unescape(s);
+outq_text(s, n);
+free(s);
+/* typed characters echo as they are typed, rate doesn't apply */
+while(outpos < outlen) {
+last_out = 0; // the key went to the console
+pushlog(outq[outpos++], fg, 1);
+}
+outpos = outlen = 0;
+return 0;
+}
+if(stringEqual(verb, "out")) {
+char *s = malloc(strlen(arg) + 2);
+strcpy(s, arg);
+n = unescape(s);
+s[n++] = '\n';
+outq_text(s, n);
+free(s);
+out_start = nanotime();
+return 0;
+}
+if(stringEqual(verb, "file")) {
+writeFile(arg);
+out_start = nanotime();
+return 0;
+}
+if(stringEqual(verb, "fgc")) {
+switch_console(atoi(arg) - 1);
+return 0;
+}
+if(stringEqual(verb, "cps")) {
+cps = atoi(arg);
+return 0;
+}
+if(stringEqual(verb, "sleep")) {
+*next = nanotime() + atoi(arg) * 1000000ULL;
+return 0;
+}
+if(stringEqual(verb, "wait"))
+return 1;
+if(stringEqual(verb, "rate"))
+return 0; // handled by the caller
+fprintf(stderr, "unknown script line: %s\n", line);
+return 0;
+}
+
+int main(int argc, char **argv)
+{
+struct sockaddr_un sa;
+int lfd, i, times = 1, leave = 0, waiting = 0, rate = 0;
+int line = 0, round = 0, scriptDone = 0, timeout;
+unsigned long long now, next = 0, t0, elapsed;
+char vcsname[sizeof(sa.sun_path) + 8];
+unsigned char cmdbuf[1024];
+struct pollfd pfd;
+
+++argv, --argc;
+while(argc && argv[0][0] == '-') {
+if(stringEqual(argv[0], "-x"))
+leave = 1;
+else if(stringEqual(argv[0], "-n") && argc > 1)
+times = atoi(*++argv), --argc;
+else
+argc = 0;
+++argv, --argc;
+}
+if(argc != 2) {
+fprintf(stderr, "usage: acsfake [-x] [-n times] socket script\n");
+exit(1);
+}
+if(strlen(argv[0]) >= sizeof(sa.sun_path)) {
+fprintf(stderr, "socket name %s is too long\n", argv[0]);
+exit(1);
+}
+
+loadScript(argv[1]);
+packet = malloc(65536 * 4 + 1000);
+for(i=0; i<NCONSOLES; ++i)
+cb_reset(cbuf_tty + i);
+
+sprintf(vcsname, "%s.vcsa", argv[0]);
+vcs_fd = open(vcsname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+if(vcs_fd < 0) {
+perror(vcsname);
+exit(1);
+}
+vcs_write();
+
+lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+memset(&sa, 0, sizeof(sa));
+sa.sun_family = AF_UNIX;
+strcpy(sa.sun_path, argv[0]);
+unlink(argv[0]);
+if(lfd < 0 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) || listen(lfd, 1)) {
+perror(argv[0]);
+exit(1);
+}
+
+/* one adapter at a time, as with the driver */
+client = accept(lfd, 0, 0);
+if(client < 0) {
+perror("accept");
+exit(1);
+}
+i = 4 * (65536 * 4 + 1000);
+setsockopt(client, SOL_SOCKET, SO_SNDBUF, &i, sizeof(i));
+
+/* the adapter starts out on console 1 */
+fg = -1;
+switch_console(0);
+
+t0 = nanotime();
+while(1) {
+now = nanotime();
+
+/* output, at cps characters a second */
+if(outpos < outlen) {
+int upto = outlen;
+if(cps) {
+unsigned long long due = (now - out_start) * cps / 1000000000ULL;
+if(due < (unsigned long long)upto) upto = due;
+}
+while(outpos < upto)
+pushlog(outq[outpos++], fg, 0);
+if(outpos == outlen)
+outpos = outlen = 0;
+}
+
+if(!scriptDone && outpos == outlen && now >= next &&
+!(waiting && (rbuf_head || !drained()))) {
+waiting = 0;
+if(line == nlines) {
+line = 0;
+if(++round == times) {
+scriptDone = 1;
+elapsed = nanotime() - t0;
+}
+}
+if(!scriptDone) {
+char *l = lines[line++];
+if(!strncmp(l, "rate ", 5)) rate = atoi(l+5);
+waiting = runLine(l, &next);
+if(rate && next <= now)
+next = now + 1000000000ULL / rate;
+}
+}
+
+if(scriptDone == 1 && !rbuf_head && drained()) {
+fprintf(stderr, "%.3f seconds, %lu keys, %lu characters of output, %lu packets, %lu bytes\n",
+elapsed / 1e9, n_keys, n_chars, n_packets, n_bytes);
+scriptDone = 2;
+if(leave) break;
+}
+
+if(rbuf_head > rbuf_tail && drained())
+deliver();
+
+/* how long can we sleep */
+now = nanotime();
+timeout = -1;
+if(rbuf_head > rbuf_tail || outpos < outlen || waiting || scriptDone == 1)
+timeout = 1;
+else if(!scriptDone)
+timeout = (next > now ? (next - now) / 1000000 + 1 : 0);
+
+pfd.fd = client;
+pfd.events = POLLIN;
+if(poll(&pfd, 1, timeout) <= 0) continue;
+if(pfd.revents & (POLLHUP | POLLERR)) break;
+i = read(client, cmdbuf, sizeof(cmdbuf));
+if(i <= 0) break;
+commands(cmdbuf, i);
+}
+
+close(client);
+unlink(argv[0]);
+unlink(vcsname);
+return 0;
+}
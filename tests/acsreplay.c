@@ -0,0 +1,356 @@
+/*********************************************************************
+acsreplay.c: play back a stream of events captured by acs_capture().
+
+Start jupiter with ACSCAPTURE=file, or send it ::capture file
+through its fifo, and every read from /dev/acsint is saved,
+with the time it happened.
+That is a workload you can run again, and again, after every change,
+without a person at the keyboard.
+
+	acsreplay [-f] [-x] capture socket
+	ACSINT=socket jupiter -c test.cfg esp "|cat >/dev/null"
+
+This listens on socket, as acsfake does, and sends each read
+to the adapter that connects, as one packet,
+with the gaps between them that were recorded,
+or as fast as the adapter can take them if -f is given.
+A packet isn't sent until the adapter has read the last one.
+Commands from the adapter are read and thrown away,
+and the screen, socket.vcsa, is blank; the capture doesn't have the screen.
+At the end we say how many events went by, and how fast,
+then wait for the adapter to close, or exit if -x is given.
+Send ::profile to jupiter's fifo before and after,
+and /var/log/acsprofile says where the time went.
+
+	acsreplay -b [-n times] capture socket
+
+This opens the socket itself, through acs_open(),
+and runs the bridge alone, in this process,
+as fast as it will go, with handlers that only count.
+It prints the profile of acs_events(): events a second,
+and the time in postprocess(), in the memmove
+that slides the buffer when the driver overflows,
+and in the handlers.
+*********************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/sockios.h>
+
+#include "acsbridge.h"
+
+#define stringEqual !strcmp
+
+#define ROWS 25
+#define COLS 80
+
+struct packet {
+unsigned long long ns;
+unsigned int len;
+unsigned char *data;
+};
+static struct packet *packets;
+static int npackets;
+static unsigned long nevents;
+
+static int client = -1;
+
+static unsigned long long nanotime(void)
+{
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* events in a packet, as acs_events() would count them */
+static int countEvents(const unsigned char *p, int len)
+{
+int i = 0, n = 0;
+while(i <= len-4) {
+if(p[i] != ACS_STAMP) ++n;
+if(p[i] == ACS_TTY_MORECHARS) i += 4;
+else if(p[i] == ACS_STAMP) i += 8;
+else if(p[i] == ACS_TTY_NEWCHARS) {
+unsigned int culen = p[i+2] | (p[i+3] << 8);
+i += culen * 4;
+}
+i += 4;
+}
+return n;
+}
+
+static void loadCapture(const char *filename)
+{
+FILE *f;
+struct acs_capture_hdr hdr;
+struct acs_capture_rec r;
+int room = 0;
+
+f = fopen(filename, "r");
+if(!f) {
+perror(filename);
+exit(1);
+}
+if(fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+memcmp(hdr.magic, "ACSCAPT1", 8) || hdr.version != 1) {
+fprintf(stderr, "%s is not an acsint capture\n", filename);
+exit(1);
+}
+
+while(fread(&r, sizeof(r), 1, f) == 1) {
+if(npackets == room) {
+room = room ? room*2 : 1024;
+packets = realloc(packets, room * sizeof(struct packet));
+if(!packets) {
+fprintf(stderr, "out of memory\n");
+exit(1);
+}
+}
+packets[npackets].ns = r.ns;
+packets[npackets].len = r.len;
+packets[npackets].data = malloc(r.len);
+if(!packets[npackets].data) {
+fprintf(stderr, "out of memory\n");
+exit(1);
+}
+if(fread(packets[npackets].data, 1, r.len, f) != r.len) {
+fprintf(stderr, "%s is cut short after %d reads\n", filename, npackets);
+break;
+}
+nevents += countEvents(packets[npackets].data, r.len);
+++npackets;
+}
+
+fclose(f);
+if(!npackets) {
+fprintf(stderr, "%s is empty\n", filename);
+exit(1);
+}
+}
+
+/* Has the adapter read everything we sent? */
+static int drained(void)
+{
+int q = 0;
+if(ioctl(client, SIOCOUTQ, &q) < 0) return 1;
+return q == 0;
+}
+
+/* Throw away the adapter's commands; return -1 when it closes. */
+static int discard(void)
+{
+static unsigned char cmdbuf[1024];
+int n;
+while((n = recv(client, cmdbuf, sizeof(cmdbuf), MSG_DONTWAIT)) > 0)
+;
+if(n == 0) return -1;
+if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+return -1;
+}
+
+static int listenOn(const char *sockname)
+{
+struct sockaddr_un sa;
+char vcsname[sizeof(sa.sun_path) + 8];
+unsigned char blank[4 + ROWS*COLS*2];
+int lfd, fd;
+
+if(strlen(sockname) >= sizeof(sa.sun_path)) {
+fprintf(stderr, "socket name %s is too long\n", sockname);
+exit(1);
+}
+
+sprintf(vcsname, "%s.vcsa", sockname);
+fd = open(vcsname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+memset(blank, 0, sizeof(blank));
+blank[0] = ROWS, blank[1] = COLS;
+if(fd < 0 || write(fd, blank, sizeof(blank)) != sizeof(blank)) {
+perror(vcsname);
+exit(1);
+}
+close(fd);
+
+lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+memset(&sa, 0, sizeof(sa));
+sa.sun_family = AF_UNIX;
+strcpy(sa.sun_path, sockname);
+unlink(sockname);
+if(lfd < 0 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) || listen(lfd, 1)) {
+perror(sockname);
+exit(1);
+}
+return lfd;
+}
+
+static void acceptClient(int lfd)
+{
+int i;
+client = accept(lfd, 0, 0);
+if(client < 0) {
+perror("accept");
+exit(1);
+}
+i = 4 * 65536;
+setsockopt(client, SOL_SOCKET, SO_SNDBUF, &i, sizeof(i));
+}
+
+static void sendPacket(const struct packet *p)
+{
+if(send(client, p->data, p->len, 0) < 0) {
+perror("send");
+exit(1);
+}
+}
+
+/*********************************************************************
+Replay to jupiter, or any other adapter, on the other end of the socket.
+*********************************************************************/
+
+static void serve(const char *sockname, int fast, int leave)
+{
+int lfd, n = 0;
+unsigned long long t0, now, due;
+struct pollfd pfd;
+
+lfd = listenOn(sockname);
+acceptClient(lfd);
+
+t0 = nanotime();
+while(n < npackets) {
+if(discard() < 0) {
+fprintf(stderr, "the adapter went away after %d of %d reads\n", n, npackets);
+exit(1);
+}
+now = nanotime();
+due = t0 + (packets[n].ns - packets[0].ns);
+if(drained() && (fast || now >= due)) {
+sendPacket(packets + n);
+++n;
+continue;
+}
+pfd.fd = client;
+pfd.events = POLLIN;
+poll(&pfd, 1, (!fast && due > now + 1000000 ? (due - now) / 1000000 : 1));
+}
+while(!drained()) {
+if(discard() < 0) break;
+usleep(1000);
+}
+
+now = nanotime() - t0;
+fprintf(stderr, "%.3f seconds, %d reads, %lu events, %.0f events a second\n",
+now / 1e9, npackets, nevents, nevents / (now / 1e9));
+fprintf(stderr, "recorded over %.3f seconds\n",
+(packets[npackets-1].ns - packets[0].ns) / 1e9);
+if(leave) return;
+
+pfd.fd = client;
+pfd.events = POLLIN;
+while(poll(&pfd, 1, -1) >= 0 && discard() == 0)
+;
+}
+
+/*********************************************************************
+Run the bridge here, and profile it.
+*********************************************************************/
+
+static unsigned long n_keys, n_more, n_fgc;
+
+static void key_h(int key, int ss, int leds)
+{
+++n_keys;
+}
+
+static void more_h(int echo, unsigned int c)
+{
+++n_more;
+}
+
+static void fgc_h(void)
+{
+++n_fgc;
+}
+
+static void bench(const char *sockname, int times)
+{
+int lfd, n, round;
+const struct acs_profile *p;
+
+lfd = listenOn(sockname);
+/* connect goes through on the backlog, before we accept */
+if(acs_open(sockname) < 0) {
+perror(sockname);
+exit(1);
+}
+acceptClient(lfd);
+
+acs_key_h = key_h;
+acs_more_h = more_h;
+acs_fgc_h = fgc_h;
+memset(&acs_prof, 0, sizeof(acs_prof));
+acs_profiling = 1;
+
+for(round=0; round<times; ++round) {
+for(n=0; n<npackets; ++n) {
+sendPacket(packets + n);
+if(acs_events() < 0) {
+perror("acs_events");
+exit(1);
+}
+if(discard() < 0) break;
+}
+}
+
+acs_profiling = 0;
+p = &acs_prof;
+printf("%d reads, %lu events, %lu keys, %lu more, %lu console switches\n",
+npackets * times, nevents * times, n_keys, n_more, n_fgc);
+printf("%.3f seconds in acs_events, %.0f events a second, %.0f ns an event\n",
+p->ns_events / 1e9, p->events / (p->ns_events / 1e9 + 1e-9),
+p->events ? (double)p->ns_events / p->events : 0.0);
+printf("postprocess %.3f seconds, overflow memmove %.3f seconds, handlers %.3f seconds\n",
+p->ns_postprocess / 1e9, p->ns_memmove / 1e9, p->ns_handlers / 1e9);
+acs_close();
+}
+
+int main(int argc, char **argv)
+{
+int fast = 0, leave = 0, inproc = 0, times = 1;
+
+++argv, --argc;
+while(argc && argv[0][0] == '-') {
+if(stringEqual(argv[0], "-f"))
+fast = 1;
+else if(stringEqual(argv[0], "-x"))
+leave = 1;
+else if(stringEqual(argv[0], "-b"))
+inproc = 1;
+else if(stringEqual(argv[0], "-n") && argc > 1)
+times = atoi(*++argv), --argc;
+else
+argc = 0;
+++argv, --argc;
+}
+if(argc != 2 || times < 1) {
+fprintf(stderr, "usage: acsreplay [-f] [-x] capture socket\n");
+fprintf(stderr, "       acsreplay -b [-n times] capture socket\n");
+exit(1);
+}
+
+loadCapture(argv[0]);
+if(inproc)
+bench(argv[1], times);
+else
+serve(argv[1], fast, leave);
+unlink(argv[1]);
+return 0;
+}
@@ -0,0 +1,91 @@
+/*********************************************************************
+screentest.c: the reprint detector, in screen mode, with the filter on.
+
+	acsfake -x /tmp/screentest screentest.scr &
+	screentest /tmp/screentest
+
+The driver's filter, acs_filter(1), would strip the cursor motion
+that the screen model needs, and a repaint would look like new text.
+The bridge leaves those alone in screen mode.
+Here a program paints two lines, then paints them again, then adds a third.
+Each line should reach the tty log once.
+Exits 0 if it does, 1 if it doesn't.
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "acsbridge.h"
+
+static int more;
+
+static void more_h(int echo, unsigned int c)
+{
+more = 1;
+}
+
+/* How many times does this text appear in the tty log? */
+static int count(const char *text)
+{
+const unsigned int *s, *t;
+const char *p;
+int n = 0;
+
+for(s=acs_tb->start; s<acs_tb->end; ++s) {
+for(t=s, p=text; *p && t<acs_tb->end && *t == (unsigned char)*p; ++t, ++p) ;
+if(!*p) ++n;
+}
+return n;
+}
+
+int main(int argc, char **argv)
+{
+static const char *lines[] = { "first line", "second line", "third line", 0 };
+struct pollfd pfd;
+int i, n, rc = 0;
+
+if(argc != 2) {
+fprintf(stderr, "usage: screentest socket\n");
+exit(1);
+}
+if(acs_open(argv[1]) < 0) {
+perror(argv[1]);
+exit(1);
+}
+acs_more_h = more_h;
+
+/* the first event sets the console */
+if(acs_events() < 0) {
+perror("acs_events");
+exit(1);
+}
+acs_filter(1);
+if(acs_screenmode(1)) {
+fprintf(stderr, "cannot enter screen mode\n");
+exit(1);
+}
+
+/* Read until the fake has been quiet for a second, or goes away. */
+pfd.fd = acs_fd;
+pfd.events = POLLIN;
+while(poll(&pfd, 1, 1000) > 0) {
+if(pfd.revents & (POLLHUP|POLLERR)) break;
+if(acs_events() < 0) break;
+if(more) {
+more = 0;
+acs_refresh();
+}
+}
+acs_refresh();
+
+for(i=0; lines[i]; ++i) {
+n = count(lines[i]);
+printf("%s: %d\n", lines[i], n);
+if(n != 1) rc = 1;
+}
+printf(rc ? "the repaint was not seen as a reprint\n" : "ok\n");
+acs_close();
+return rc;
+}
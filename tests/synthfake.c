@@ -0,0 +1,475 @@
+/*********************************************************************
+synthfake.c: pretend to be a speech synthesizer, with index markers,
+so we can time the adapter without a unit on the serial port.
+
+It takes text as the synth would, in the style of acs_style,
+holds it until the end of the utterance, the return,
+or ^K return for the dectalk, then speaks it at so many characters a second,
+after a short startup delay.
+Commands to the synth, rate, volume, and so on, are skipped.
+As speech reaches each index marker, the marker goes back to the adapter
+in the form that unit uses, and acs_sy_events() reads it:
+	dbe, esp	\1ni or <mark name="n"/>, returned as the byte n
+	dte, dtp	[:i r n], returned as ESC P0;32;nz
+	bns, ace	^F, returned as ^F
+	gen	no index markers
+^X, or ^C for the dectalk and generic styles, stops speech
+and throws away whatever hasn't been spoken.
+
+When it ends, on end of file or a signal, it tells you how many utterances
+it spoke, and the gaps between them, from the time it went quiet
+to the time the next utterance arrived.
+That is the adapter's turnaround when reading continuously.
+A silence of a second or more is someone thinking, and isn't counted.
+It also reports each shutup, and the time from there to the next speech.
+
+By default it talks on stdin and stdout, so the adapter can run it as
+a software synth, which jupiter calls a pipe.
+	jupiter dbe "|synthfake dbe"
+With -p it makes a pseudo terminal, and a link to it,
+so the adapter opens it as a serial port.
+	synthfake -p /tmp/synth dte &
+	jupiter dte /tmp/synth
+
+	synthfake [-p link] [-c chars_per_second] [-l startup_ms] [-o report] style
+*********************************************************************/
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+
+#include "acsbridge.h"
+
+#define stringEqual !strcmp
+
+static const struct {
+const char *name;
+int style;
+} styles[] = {
+{"gen", ACS_SY_STYLE_GENERIC},
+{"dbe", ACS_SY_STYLE_DOUBLE},
+{"dte", ACS_SY_STYLE_DECEXP},
+{"dtp", ACS_SY_STYLE_DECPC},
+{"bns", ACS_SY_STYLE_BNS},
+{"ace", ACS_SY_STYLE_ACE},
+{"esp", ACS_SY_STYLE_ESPEAKUP},
+{0, 0}
+};
+
+static int style;
+static int cps = 150; // about 180 words a minute
+static int startup = 50; // milliseconds from return to sound
+static int fd0 = 0, fd1 = 1;
+static volatile sig_atomic_t stop;
+
+/*********************************************************************
+What is waiting to be spoken: characters, and index markers,
+which are stored as 0x100 plus the marker.
+An utterance is held in pending until it ends,
+then it moves to the speech queue.
+*********************************************************************/
+
+#define MARK 0x100
+
+struct queue {
+int *item;
+int len, room, pos;
+};
+static struct queue pending, speech;
+
+static void qadd(struct queue *q, int c)
+{
+if(q->len == q->room) {
+q->room = q->room * 2 + 1000;
+q->item = realloc(q->item, q->room * sizeof(int));
+if(!q->item) {
+fprintf(stderr, "out of memory\n");
+exit(2);
+}
+}
+q->item[q->len++] = c;
+}
+
+static unsigned long long nanotime(void)
+{
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the time the next item in the speech queue is done, 0 if quiet */
+static unsigned long long next_at;
+static unsigned long long quiet_since;
+
+/* for the report */
+static unsigned long n_utter, n_chars, n_marks, n_shutup, n_cut, n_cutchars, n_idle;
+static unsigned long long *gaps, *restarts;
+static int ngaps, nrestarts, gaproom, restartroom;
+static unsigned long long shutup_at;
+
+static void sample(unsigned long long **a, int *n, int *room, unsigned long long v)
+{
+if(*n == *room) {
+*room = *room * 2 + 100;
+*a = realloc(*a, *room * sizeof(unsigned long long));
+if(!*a) {
+fprintf(stderr, "out of memory\n");
+exit(2);
+}
+}
+(*a)[(*n)++] = v;
+}
+
+/*********************************************************************
+The end of an utterance: move it to the speech queue,
+and start talking if we were quiet.
+*********************************************************************/
+
+static void utterance(void)
+{
+unsigned long long now = nanotime();
+int j;
+
+if(!pending.len) return;
+++n_utter;
+if(shutup_at) {
+sample(&restarts, &nrestarts, &restartroom, now - shutup_at);
+shutup_at = 0;
+} else if(quiet_since) {
+/* a long silence is the user thinking, not the adapter */
+if(now - quiet_since < 1000000000ULL)
+sample(&gaps, &ngaps, &gaproom, now - quiet_since);
+else ++n_idle;
+}
+quiet_since = 0;
+
+if(speech.pos == speech.len)
+speech.pos = speech.len = 0;
+for(j=0; j<pending.len; ++j)
+qadd(&speech, pending.item[j]);
+pending.len = 0;
+if(!next_at)
+next_at = now + startup * 1000000ULL;
+}
+
+static void shutup(void)
+{
+int j, cut = 0;
+++n_shutup;
+for(j=speech.pos; j<speech.len; ++j)
+if(speech.item[j] < MARK) ++cut;
+if(cut) ++n_cut, n_cutchars += cut;
+speech.pos = speech.len = 0;
+pending.len = 0;
+next_at = 0;
+quiet_since = 0;
+shutup_at = nanotime();
+}
+
+/* send an index marker back, the way this unit does it */
+static void sendMark(int n)
+{
+char buf[20];
+int len = 0;
+
+switch(style) {
+case ACS_SY_STYLE_DOUBLE:
+case ACS_SY_STYLE_ESPEAKUP:
+buf[0] = n, len = 1;
+break;
+case ACS_SY_STYLE_DECEXP:
+case ACS_SY_STYLE_DECPC:
+len = sprintf(buf, "\33P0;32;%dz", n);
+break;
+case ACS_SY_STYLE_BNS:
+case ACS_SY_STYLE_ACE:
+buf[0] = 6, len = 1;
+break;
+}
+if(len) write(fd1, buf, len);
+++n_marks;
+}
+
+/* speak whatever is due */
+static void speak(void)
+{
+unsigned long long now = nanotime();
+int c;
+
+while(next_at && now >= next_at) {
+if(speech.pos == speech.len) {
+next_at = 0;
+quiet_since = now;
+speech.pos = speech.len = 0;
+break;
+}
+c = speech.item[speech.pos++];
+if(c >= MARK) {
+sendMark(c - MARK);
+continue;
+}
+++n_chars;
+next_at += 1000000000ULL / cps;
+}
+}
+
+/*********************************************************************
+Parse the text coming in.
+This is a state machine, because a command can be split across reads.
+cmd holds a command in progress, and cmdlen is its length,
+0 when we are in plain text.
+*********************************************************************/
+
+static char cmd[80];
+static int cmdlen;
+
+static int shutupByte(void)
+{
+if(style == ACS_SY_STYLE_DECEXP || style == ACS_SY_STYLE_DECPC ||
+style == ACS_SY_STYLE_GENERIC)
+return 3;
+return 24;
+}
+
+/* A command is complete; is it an index marker? */
+static void command(void)
+{
+int n;
+cmd[cmdlen] = 0;
+switch(style) {
+case ACS_SY_STYLE_DOUBLE:
+if(cmdlen > 2 && cmd[cmdlen-1] == 'i' && sscanf(cmd+1, "%d", &n) == 1)
+qadd(&pending, MARK + n);
+break;
+case ACS_SY_STYLE_DECEXP:
+case ACS_SY_STYLE_DECPC:
+if(sscanf(cmd, "[:i r %d]", &n) == 1)
+qadd(&pending, MARK + n);
+break;
+case ACS_SY_STYLE_ESPEAKUP:
+if(cmd[0] == '<' && sscanf(cmd, "<mark name=\"%d\"", &n) == 1)
+qadd(&pending, MARK + n);
+if(cmd[0] == 1 && cmd[cmdlen-1] == 'i' && sscanf(cmd+1, "%d", &n) == 1)
+qadd(&pending, MARK + n);
+break;
+}
+cmdlen = 0;
+}
+
+static void input(const unsigned char *s, int len)
+{
+int c;
+
+for(; len; ++s, --len) {
+c = *s;
+
+if(c == shutupByte()) {
+shutup();
+cmdlen = 0;
+continue;
+}
+
+if(cmdlen) {
+if(cmdlen < (int)sizeof(cmd) - 1)
+cmd[cmdlen++] = c;
+switch(style) {
+case ACS_SY_STYLE_DOUBLE:
+case ACS_SY_STYLE_BNS:
+// control a or e, a number, and a letter
+if(cmdlen > 1 && isalpha(c)) command();
+break;
+case ACS_SY_STYLE_ACE:
+// escape and two characters
+if(cmdlen == 3) command();
+break;
+case ACS_SY_STYLE_DECEXP:
+case ACS_SY_STYLE_DECPC:
+if(cmdlen == 2 && c != ':') {
+// not a command after all
+qadd(&pending, '[');
+qadd(&pending, c);
+cmdlen = 0;
+}
+if(c == ']') command();
+break;
+case ACS_SY_STYLE_ESPEAKUP:
+// ssml, or doubletalk style commands
+if(cmd[0] == '<' ? c == '>' : cmdlen > 1 && isalpha(c)) command();
+break;
+}
+continue;
+}
+
+/* the start of a command */
+if((c == 1 && (style == ACS_SY_STYLE_DOUBLE || style == ACS_SY_STYLE_ESPEAKUP)) ||
+(c == 5 && style == ACS_SY_STYLE_BNS) ||
+(c == '\33' && style == ACS_SY_STYLE_ACE) ||
+(c == '[' && (style == ACS_SY_STYLE_DECEXP || style == ACS_SY_STYLE_DECPC)) ||
+(c == '<' && style == ACS_SY_STYLE_ESPEAKUP)) {
+cmd[0] = c, cmdlen = 1;
+continue;
+}
+
+if(c == 6 && (style == ACS_SY_STYLE_BNS || style == ACS_SY_STYLE_ACE)) {
+qadd(&pending, MARK);
+continue;
+}
+
+if(c == '\r') {
+utterance();
+continue;
+}
+/* ^K is the dectalk's force speak; the return is coming */
+if(c < ' ') continue;
+
+qadd(&pending, c);
+}
+}
+
+/*********************************************************************
+The report.
+*********************************************************************/
+
+static int cmpull(const void *a, const void *b)
+{
+unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+return (x > y) - (x < y);
+}
+
+static void summary(FILE *f, const char *what, unsigned long long *a, int n)
+{
+unsigned long long sum = 0;
+int j;
+
+if(!n) {
+fprintf(f, "%s: none\n", what);
+return;
+}
+qsort(a, n, sizeof(*a), cmpull);
+for(j=0; j<n; ++j) sum += a[j];
+fprintf(f, "%s: %d, mean %.2f ms, median %.2f ms, 90%% %.2f ms, max %.2f ms\n",
+what, n, sum / 1e6 / n, a[n/2] / 1e6, a[n*9/10] / 1e6, a[n-1] / 1e6);
+}
+
+static void report(const char *filename)
+{
+FILE *f = stderr;
+if(filename) f = fopen(filename, "w");
+if(!f) {
+perror(filename);
+return;
+}
+fprintf(f, "%lu utterances, %lu characters spoken, %lu index markers returned\n",
+n_utter, n_chars, n_marks);
+fprintf(f, "%lu shutups, %lu while speaking, %lu characters not spoken\n",
+n_shutup, n_cut, n_cutchars);
+summary(f, "gaps between utterances", gaps, ngaps);
+fprintf(f, "%lu silences of a second or more, not counted as gaps\n", n_idle);
+summary(f, "shutup to next utterance", restarts, nrestarts);
+if(f != stderr) fclose(f);
+}
+
+static void catch(int sig)
+{
+stop = 1;
+}
+
+/* a pseudo terminal, with a link to its name, for the adapter to open */
+static void makePty(const char *link)
+{
+struct termios t;
+const char *name;
+
+fd0 = posix_openpt(O_RDWR | O_NOCTTY);
+if(fd0 < 0 || grantpt(fd0) || unlockpt(fd0) || !(name = ptsname(fd0))) {
+perror("pseudo terminal");
+exit(1);
+}
+tcgetattr(fd0, &t);
+cfmakeraw(&t);
+tcsetattr(fd0, TCSANOW, &t);
+fd1 = fd0;
+unlink(link);
+if(symlink(name, link)) {
+perror(link);
+exit(1);
+}
+}
+
+int main(int argc, char **argv)
+{
+const char *link = 0, *output = 0;
+unsigned char buf[4096];
+struct pollfd pfd;
+int j, n, timeout;
+unsigned long long now;
+
+++argv, --argc;
+while(argc > 1 && argv[0][0] == '-') {
+if(stringEqual(argv[0], "-p"))
+link = argv[1];
+else if(stringEqual(argv[0], "-c"))
+cps = atoi(argv[1]);
+else if(stringEqual(argv[0], "-l"))
+startup = atoi(argv[1]);
+else if(stringEqual(argv[0], "-o"))
+output = argv[1];
+else
+break;
+argv += 2, argc -= 2;
+}
+if(argc == 1)
+for(j=0; styles[j].name; ++j)
+if(stringEqual(argv[0], styles[j].name)) break;
+if(argc != 1 || !styles[j].name || cps <= 0) {
+fprintf(stderr, "usage: synthfake [-p link] [-c chars_per_second] [-l startup_ms] [-o report] gen|dbe|dte|dtp|bns|ace|esp\n");
+exit(1);
+}
+style = styles[j].style;
+
+signal(SIGINT, catch);
+signal(SIGTERM, catch);
+signal(SIGHUP, catch);
+signal(SIGPIPE, SIG_IGN);
+if(link) makePty(link);
+
+while(!stop) {
+speak();
+timeout = -1;
+if(next_at) {
+now = nanotime();
+timeout = (next_at > now ? (next_at - now) / 1000000 + 1 : 0);
+}
+pfd.fd = fd0;
+pfd.events = POLLIN;
+n = poll(&pfd, 1, timeout);
+if(n < 0 && errno != EINTR) break;
+if(n <= 0) continue;
+n = read(fd0, buf, sizeof(buf));
+if(n > 0) {
+input(buf, n);
+continue;
+}
+/* A pty reads EIO when the adapter closes it; wait for the next one. */
+if(link && n < 0 && errno == EIO) {
+usleep(100000);
+continue;
+}
+break;
+}
+
+report(output);
+if(link) unlink(link);
+return 0;
+}
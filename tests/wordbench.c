@@ -0,0 +1,177 @@
+/*********************************************************************
+wordbench.c: time the word list lookups of the text preprocessor.
+
+The lookups are static, so I pull in the whole preprocessor.
+Every word of the hashed lists, and some words that aren't there,
+are looked up both ways, by the hash and by the old linear scan,
+and every 2 and 3 letter combination is checked for pronounceability
+against a linear scan of real2 and real3.
+The answers must agree; then we print the cost per word.
+Usage: wordbench [rounds], with LANG selecting the language.
+*********************************************************************/
+
+#include <time.h>
+
+#include "../jupiter/tpxlate.c"
+
+static unsigned int words[400][NEWWORDLEN];
+static int wordlens[400];
+static int nwords;
+
+static double now(void)
+{
+struct timespec ts;
+clock_gettime(CLOCK_MONOTONIC, &ts);
+return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void addWords(const char * const *list, int max)
+{
+int i;
+for(i=0; i<max && list[i] && nwords < 400; ++i) {
+if(strlen(list[i]) >= NEWWORDLEN) continue;
+wordlens[nwords] = acs_utf82uni((const unsigned char *)list[i], words[nwords]);
+++nwords;
+}
+}
+
+/* the way isWord2 and isWord3 used to find their words */
+static int scan2(const struct OUTWORDS *ow, char c1, char c2)
+{
+const char *w = ow->real2;
+if(!w) return 1;
+for(; *w; w+=2)
+if(w[0] == c1 && w[1] == c2) return 1;
+return 0;
+}
+
+static int scan3(const struct OUTWORDS *ow, char c1, char c2, char c3)
+{
+const char *w = ow->real3[(c1|0x20)-'a'];
+if(!w) return -1;
+for(; *w; w+=4)
+if(w[1] == c2 && w[2] == c3) return 1;
+return 0;
+}
+
+static void timeList(const char *name, const struct wordhash *h, const char * const *list, int rounds)
+{
+int i, r, hits = 0;
+long sum = 0;
+double t0, t1, t2;
+
+for(i=0; i<nwords; ++i) {
+if(wordInHash(h, words[i], wordlens[i]) != wordInList(list, words[i], wordlens[i])) {
+fprintf(stderr, "%s: mismatch on word %d\n", name, i);
+exit(1);
+}
+}
+
+t0 = now();
+for(r=0; r<rounds; ++r)
+for(i=0; i<nwords; ++i)
+sum += wordInList(list, words[i], wordlens[i]);
+t1 = now();
+for(r=0; r<rounds; ++r)
+for(i=0; i<nwords; ++i) {
+int k = wordInHash(h, words[i], wordlens[i]);
+sum -= k;
+if(k >= 0) ++hits;
+}
+t2 = now();
+
+printf("%-16s %6.1f ns linear %6.1f ns hashed, %d of %d words found%s\n",
+name, (t1-t0)*1e9/rounds/nwords, (t2-t1)*1e9/rounds/nwords,
+hits/rounds, nwords, (sum ? " (mismatch)" : ""));
+}
+
+int main(int argc, char **argv)
+{
+struct tp_context *tp = &tp_default;
+const struct OUTWORDS *ow;
+const struct tp_langhash *lh;
+int rounds = 2000, r, i, n;
+unsigned int s[8];
+const char *letters = "abcdefghijklmnopqrstuvwxyzAEIOUST";
+int nl = strlen(letters);
+int a, b, c;
+long sum;
+double t0, t1;
+
+if(argc > 1) rounds = atoi(argv[1]);
+if(rounds <= 0) rounds = 1;
+
+acs_lang = ACS_LANG_EN;
+if(getenv("LANG")) {
+if(!strncmp(getenv("LANG"), "de", 2)) acs_lang = ACS_LANG_DE;
+if(!strncmp(getenv("LANG"), "pt_BR", 5)) acs_lang = ACS_LANG_PT_BR;
+if(!strncmp(getenv("LANG"), "fr", 2)) acs_lang = ACS_LANG_FR;
+if(!strncmp(getenv("LANG"), "sk", 2)) acs_lang = ACS_LANG_SK;
+}
+if(setupTTS()) {
+fprintf(stderr, "cannot set up the preprocessor\n");
+exit(1);
+}
+ow = tp->ow;
+lh = tp->lh;
+
+addWords(ow->contractions, LISTMAX(contractions));
+addWords(ow->nohundred, LISTMAX(nohundred));
+addWords(ow->bigNumbers, LISTMAX(bigNumbers));
+addWords(ow->slashOrPhrases, LISTMAX(slashOrPhrases));
+addWords(ow->months, LISTMAX(months));
+addWords(ow->weekdays, LISTMAX(weekdays));
+addWords(ow->natoWords, LISTMAX(natoWords));
+
+timeList("contractions", &lh->contractions, ow->contractions, rounds);
+timeList("nohundred", &lh->nohundred, ow->nohundred, rounds);
+timeList("bigNumbers", &lh->bigNumbers, ow->bigNumbers, rounds);
+timeList("slashOrPhrases", &lh->slashOrPhrases, ow->slashOrPhrases, rounds);
+
+/* 2 and 3 letter words, with a null before and a space after,
+ * which is how isWord3 sees them in a sentence. */
+s[0] = 0;
+n = 0, sum = 0;
+for(a=0; a<nl; ++a)
+for(b=0; b<nl; ++b) {
+s[1] = letters[a], s[2] = letters[b], s[3] = ' ';
+if(isWord2(tp, s+1) != scan2(ow, acs_unaccent(s[1]), acs_unaccent(s[2]))) {
+fprintf(stderr, "isWord2 mismatch on %c%c\n", s[1], s[2]);
+exit(1);
+}
+for(c=0; c<nl; ++c) {
+s[3] = letters[c], s[4] = ' ';
+i = scan3(ow, acs_unaccent(s[1]), acs_unaccent(s[2]), acs_unaccent(s[3]));
+if(i == 1) i = isWord3(tp, s+1);
+if(isWord3(tp, s+1) != i) {
+fprintf(stderr, "isWord3 mismatch on %c%c%c\n", s[1], s[2], s[3]);
+exit(1);
+}
+}
+}
+
+t0 = now();
+for(r=0; r<rounds/20+1; ++r)
+for(a=0; a<nl; ++a)
+for(b=0; b<nl; ++b)
+for(c=0; c<nl; ++c) {
+s[1] = letters[a], s[2] = letters[b], s[3] = letters[c];
+sum += scan3(ow, acs_unaccent(s[1]), acs_unaccent(s[2]), acs_unaccent(s[3]));
+++n;
+}
+t1 = now();
+printf("%-16s %6.1f ns linear ", "real3", (t1-t0)*1e9/n);
+t0 = now();
+for(r=0; r<rounds/20+1; ++r)
+for(a=0; a<nl; ++a)
+for(b=0; b<nl; ++b)
+for(c=0; c<nl; ++c) {
+s[1] = letters[a], s[2] = letters[b], s[3] = letters[c], s[4] = ' ';
+sum += isWord3(tp, s+1);
+}
+t1 = now();
+printf("%6.1f ns isWord3\n", (t1-t0)*1e9/n);
+
+tp_release(tp);
+return sum == 12345; // keep the loops from being optimized away
+}